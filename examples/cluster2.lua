@@ -20,4 +20,26 @@ skynet.start(function()
 	-- test snax service
 	local pingserver = cluster.snax("db", "pingserver")
 	print(pingserver.req.ping "hello")
+
+	-- fan-out calls, the requests to the same node are written together
+	local N, M = 100, 100
+	local start = skynet.now()
+	local count = 0
+	local co = coroutine.running()
+	for i = 1, N do
+		skynet.fork(function()
+			for j = 1, M do
+				cluster.call("db", sdb, "GET", "a")
+			end
+			count = count + 1
+			if count == N then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	print(string.format("%d calls in %.2f s", N * M, (skynet.now() - start) / 100))
+	for k, v in pairs(cluster.stat "db") do
+		print(k, v)
+	end
 end)
@@ -0,0 +1,30 @@
+-- Save a sharedata snapshot offline, which can be mapped by sharedata.map(name, output)
+-- usage : ./3rd/lua/lua examples/snapshot.lua input.lua output
+
+package.cpath = "luaclib/?.so"
+package.path = "lualib/?.lua"
+
+if _VERSION ~= "Lua 5.3" then
+	error "Use lua 5.3"
+end
+
+local core = require "sharedata.core"
+
+local input, output = ...
+if not input or not output then
+	print "usage : lua examples/snapshot.lua input.lua output"
+	return
+end
+
+-- the same as sharedata.new(name, "@input")
+local value = setmetatable({}, { __index = _ENV })
+local f = assert(loadfile(input, "bt", value))
+local ret = f()
+setmetatable(value, nil)
+if type(ret) == "table" then
+	value = ret
+end
+
+local cobj = core.new(value)
+core.save(cobj, output)
+core.delete(cobj)
@@ -5,18 +5,21 @@ local CMD = {}
 local SOCKET = {}
 local gate
 local agent = {}
+local gate_of = {}	-- fd -> the gate (shard) which reports the connection
 
 function SOCKET.open(fd, addr)
 	skynet.error("New client from : " .. addr)
 	agent[fd] = skynet.newservice("agent")
-	skynet.call(agent[fd], "lua", "start", { gate = gate, client = fd, watchdog = skynet.self() })
+	skynet.call(agent[fd], "lua", "start", { gate = gate_of[fd], client = fd, watchdog = skynet.self() })
 end
 
 local function close_agent(fd)
 	local a = agent[fd]
+	local g = gate_of[fd]
 	agent[fd] = nil
+	gate_of[fd] = nil
 	if a then
-		skynet.call(gate, "lua", "kick", fd)
+		skynet.call(g, "lua", "kick", fd)
 		-- disconnect never return
 		skynet.send(a, "lua", "disconnect")
 	end
@@ -41,6 +44,8 @@ function SOCKET.data(fd, msg)
 end
 
 function CMD.start(conf)
+	-- set conf.shard to run several gates on the same port
+	gate = skynet.newservice(conf.shard and "shardgate" or "gate")
 	skynet.call(gate, "lua", "open" , conf)
 end
 
@@ -51,6 +56,9 @@ end
 skynet.start(function()
 	skynet.dispatch("lua", function(session, source, cmd, subcmd, ...)
 		if cmd == "socket" then
+			if subcmd == "open" then
+				gate_of[(...)] = source
+			end
 			local f = SOCKET[subcmd]
 			f(...)
 			-- socket api don't need return
@@ -59,6 +67,4 @@ skynet.start(function()
 			skynet.ret(skynet.pack(f(subcmd, ...)))
 		end
 	end)
-
-	gate = skynet.newservice("gate")
 end)
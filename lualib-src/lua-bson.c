@@ -40,9 +40,18 @@
 
 #define BSON_TYPE_SHIFT 5
 
-static char bson_numstrs[MAX_NUMBER][4];
+// the decimal keys of array index, with '\0'
+static char bson_numstrs[MAX_NUMBER][5];
 static int bson_numstr_len[MAX_NUMBER];
 
+// keep the buffer (not larger than CACHE_MAX) of last encoding for the next one
+#define CACHE_MAX (1024 * 1024)
+
+struct bson_cache {
+	uint8_t *ptr;
+	int cap;
+};
+
 struct bson {
 	int size;
 	int cap;
@@ -229,12 +238,31 @@ utf8_copy(const char *s, char *d, size_t limit) {
 	}
 }
 
+static inline int
+is_ascii(const char *str, size_t sz) {
+	size_t i;
+	uint64_t bits = 0;
+	for (i=0;i+8<=sz;i+=8) {
+		uint64_t v;
+		memcpy(&v, str+i, 8);
+		bits |= v;
+	}
+	for (;i<sz;i++) {
+		bits |= (uint8_t)str[i];
+	}
+	return (bits & 0x8080808080808080ULL) == 0;
+}
+
 static void
 write_string(struct bson *b, lua_State *L, const char *key, size_t sz) {
 	bson_reserve(b,sz+1);
 	char *dst = (char *)(b->ptr + b->size);
 	const char *src = key;
 	size_t n = sz;
+	if (is_ascii(src, n)) {
+		memcpy(dst, src, n);
+		n = 0;
+	}
 	while(n > 0) {
 		int c = utf8_copy(src, dst, n);
 		if (c == 0) {
@@ -423,23 +451,77 @@ append_one(struct bson *bs, lua_State *L, const char *key, size_t sz, int depth)
 static inline int 
 bson_numstr( char *str, unsigned int i ) {
 	if ( i < MAX_NUMBER) {
-		memcpy( str, bson_numstrs[i], 4 );
+		memcpy( str, bson_numstrs[i], 5 );
 		return bson_numstr_len[i];
 	} else {
 		return sprintf( str,"%u", i );
 	}
 }
 
+// append the number at the top of the stack with the array index key, write the bytes directly
+static void
+append_index_number(struct bson *bs, lua_State *L, unsigned int index) {
+	char tmp[32];
+	const char * key;
+	int klen;
+	if (index < MAX_NUMBER) {
+		key = bson_numstrs[index];
+		klen = bson_numstr_len[index] + 1;
+	} else {
+		klen = sprintf(tmp, "%u", index) + 1;
+		key = tmp;
+	}
+	bson_reserve(bs, 1 + klen + 8);
+	uint8_t * p = bs->ptr + bs->size;
+	uint64_t v;
+	int vsz;
+	if (lua_isinteger(L, -1)) {
+		int64_t i = lua_tointeger(L, -1);
+		if (is_32bit(i)) {
+			*p = BSON_INT32;
+			vsz = 4;
+		} else {
+			*p = BSON_INT64;
+			vsz = 8;
+		}
+		v = (uint64_t)i;
+	} else {
+		union {
+			double d;
+			uint64_t i;
+		} u;
+		u.d = lua_tonumber(L, -1);
+		*p = BSON_REAL;
+		vsz = 8;
+		v = u.i;
+	}
+	memcpy(p + 1, key, klen);
+	p += 1 + klen;
+	int i;
+	for (i=0;i<vsz;i++) {
+		p[i] = (v >> (i*8)) & 0xff;
+	}
+	bs->size += 1 + klen + vsz;
+}
+
 static void
 pack_array(lua_State *L, struct bson *b, int depth, size_t len) {
 	int length = reserve_length(b);
 	size_t i;
+	// a table without metatable can be read by lua_rawgeti
+	int raw = !lua_getmetatable(L, -1);
+	if (!raw) {
+		lua_pop(L, 1);
+	}
 	for (i=1;i<=len;i++) {
-		char numberkey[32];
-		size_t sz = bson_numstr(numberkey, i - 1);
-		const char * key = numberkey;
-		lua_geti(L, -1, i);
-		append_one(b, L, key, sz, depth);
+		int t = raw ? lua_rawgeti(L, -1, i) : lua_geti(L, -1, i);
+		if (t == LUA_TNUMBER) {
+			append_index_number(b, L, i - 1);
+		} else {
+			char numberkey[32];
+			size_t sz = bson_numstr(numberkey, i - 1);
+			append_one(b, L, numberkey, sz, depth);
+		}
 		lua_pop(L, 1);
 	}
 	write_byte(b,0);
@@ -590,8 +672,72 @@ make_object(lua_State *L, int type, const void * ptr, size_t len) {
 	luaL_pushresult(&b);
 }
 
+static inline int
+read_size(lua_State *L, struct bson_reader *br) {
+	int sz = read_int32(L, br);
+	if (sz < 0) {
+		luaL_error(L, "Invalid bson size %d", sz);
+	}
+	return sz;
+}
+
 static void
-unpack_dict(lua_State *L, struct bson_reader *br, bool array) {
+skip_value(lua_State *L, struct bson_reader *br, int bt) {
+	switch (bt) {
+	case BSON_REAL:
+	case BSON_DATE:
+	case BSON_TIMESTAMP:
+	case BSON_INT64:
+		read_bytes(L, br, 8);
+		break;
+	case BSON_INT32:
+		read_bytes(L, br, 4);
+		break;
+	case BSON_BOOLEAN:
+		read_bytes(L, br, 1);
+		break;
+	case BSON_OBJECTID:
+		read_bytes(L, br, 12);
+		break;
+	case BSON_STRING:
+	case BSON_JSCODE:
+	case BSON_SYMBOL:
+		read_bytes(L, br, read_size(L, br));
+		break;
+	case BSON_DOCUMENT:
+	case BSON_ARRAY:
+	case BSON_CODEWS: {
+		int sz = read_size(L, br);
+		if (sz < 4) {
+			luaL_error(L, "Invalid bson size %d", sz);
+		}
+		read_bytes(L, br, sz - 4);
+		break;
+	}
+	case BSON_BINARY:
+		read_bytes(L, br, read_size(L, br) + 1);	// subtype and data
+		break;
+	case BSON_DBPOINTER:
+		read_bytes(L, br, read_size(L, br) + 12);
+		break;
+	case BSON_REGEX: {
+		size_t sz;
+		read_cstring(L, br, &sz);
+		read_cstring(L, br, &sz);
+		break;
+	}
+	case BSON_MINKEY:
+	case BSON_MAXKEY:
+	case BSON_NULL:
+		break;
+	default:
+		luaL_error(L, "Invalid bson type : %d", bt);
+	}
+}
+
+// fields is the stack index of the projection table { key = true }, or 0 for all the keys
+static void
+unpack_dict(lua_State *L, struct bson_reader *br, bool array, int fields) {
 	luaL_checkstack(L, 16, NULL);	// reserve enough stack space to unpack table
 	int sz = read_int32(L, br);
 	const void * bytes = read_bytes(L, br, sz-5);
@@ -614,6 +760,15 @@ unpack_dict(lua_State *L, struct bson_reader *br, bool array) {
 			lua_pushinteger(L,id);
 		} else {
 			lua_pushlstring(L, key, klen);
+			if (fields) {
+				lua_pushvalue(L, -1);
+				if (lua_rawget(L, fields) == LUA_TNIL) {
+					lua_pop(L, 2);
+					skip_value(L, &t, bt);
+					continue;
+				}
+				lua_pop(L, 1);
+			}
 		}
 		switch (bt) {
 		case BSON_REAL:
@@ -631,10 +786,10 @@ unpack_dict(lua_State *L, struct bson_reader *br, bool array) {
 			break;
 		}
 		case BSON_DOCUMENT:
-			unpack_dict(L, &t, false);
+			unpack_dict(L, &t, false, 0);
 			break;
 		case BSON_ARRAY:
-			unpack_dict(L, &t, true);
+			unpack_dict(L, &t, true, 0);
 			break;
 		case BSON_BINARY: {
 			int sz = read_int32(L, &t);
@@ -903,6 +1058,11 @@ lreplace(lua_State *L) {
 	return 0;
 }
 
+/*
+	userdata/lightuserdata bson document
+	table fields { key = true } (optional), only decode these keys at the top level
+	return table
+ */
 static int
 ldecode(lua_State *L) {
 	const int32_t * data = lua_touserdata(L,1);
@@ -912,8 +1072,9 @@ ldecode(lua_State *L) {
 	const uint8_t * b = (const uint8_t *)data;
 	int32_t len = get_length(b);
 	struct bson_reader br = { b , len };
+	int fields = lua_istable(L, 2) ? 2 : 0;
 
-	unpack_dict(L, &br, false);
+	unpack_dict(L, &br, false, fields);
 
 	return 1;
 }
@@ -938,39 +1099,98 @@ bson_meta(lua_State *L) {
 	lua_setmetatable(L, -2);
 }
 
+static inline void
+bson_create_cached(struct bson *b, struct bson_cache *c) {
+	if (c->ptr) {
+		// take the buffer away, so the nested encoding (in __pairs) uses another one
+		b->size = 0;
+		b->cap = c->cap;
+		b->ptr = c->ptr;
+		c->ptr = NULL;
+	} else {
+		bson_create(b);
+	}
+}
+
+static inline void
+bson_destroy_cached(struct bson *b, struct bson_cache *c) {
+	if (b->ptr != b->buffer && c->ptr == NULL && b->cap <= CACHE_MAX) {
+		c->ptr = b->ptr;
+		c->cap = b->cap;
+	} else {
+		bson_destroy(b);
+	}
+}
+
 static int
-lencode(lua_State *L) {
-	struct bson b;
-	bson_create(&b);
-	lua_settop(L,1);
-	luaL_checktype(L, 1, LUA_TTABLE);
-	if (luaL_getmetafield(L, -1, "__pairs") != LUA_TNIL) {
-		pack_meta_dict(L, &b, 0);
+lcache_gc(lua_State *L) {
+	struct bson_cache * c = lua_touserdata(L, 1);
+	free(c->ptr);
+	c->ptr = NULL;
+	return 0;
+}
+
+/*
+	lightuserdata bson
+	table dict (or key, value, ... of the ordered dict)
+
+	Run in lua_pcall, so the (cached) buffer is given back even if packing raises an error.
+ */
+static int
+pack_dict(lua_State *L) {
+	struct bson * b = lua_touserdata(L, 1);
+	lua_remove(L, 1);
+	if (luaL_getmetafield(L, 1, "__pairs") != LUA_TNIL) {
+		pack_meta_dict(L, b, 0);
 	} else {
-		pack_simple_dict(L, &b, 0);
+		pack_simple_dict(L, b, 0);
+	}
+	return 0;
+}
+
+static int
+pack_ordered(lua_State *L) {
+	struct bson * b = lua_touserdata(L, 1);
+	lua_remove(L, 1);
+	pack_ordered_dict(L, b, lua_gettop(L), 0);
+	return 0;
+}
+
+// call pack with the arguments on the stack, return the encoded bson object
+static int
+encode_cached(lua_State *L, lua_CFunction pack) {
+	struct bson_cache * c = lua_touserdata(L, lua_upvalueindex(1));
+	int n = lua_gettop(L);
+	struct bson b;
+	bson_create_cached(&b, c);
+	lua_pushcfunction(L, pack);
+	lua_pushlightuserdata(L, &b);
+	lua_rotate(L, 1, 2);
+	if (lua_pcall(L, n + 1, 0, 0) != LUA_OK) {
+		bson_destroy_cached(&b, c);
+		return lua_error(L);
 	}
 	void * ud = lua_newuserdata(L, b.size);
 	memcpy(ud, b.ptr, b.size);
-	bson_destroy(&b);
+	bson_destroy_cached(&b, c);
 	bson_meta(L);
 	return 1;
 }
 
+static int
+lencode(lua_State *L) {
+	lua_settop(L,1);
+	luaL_checktype(L, 1, LUA_TTABLE);
+	return encode_cached(L, pack_dict);
+}
+
 static int
 lencode_order(lua_State *L) {
-	struct bson b;
-	bson_create(&b);
 	int n = lua_gettop(L);
 	if (n%2 != 0) {
 		return luaL_error(L, "Invalid ordered dict");
 	}
-	pack_ordered_dict(L, &b, n, 0);
-	lua_settop(L,1);
-	void * ud = lua_newuserdata(L, b.size);
-	memcpy(ud, b.ptr, b.size);
-	bson_destroy(&b);
-	bson_meta(L);
-	return 1;
+	return encode_cached(L, pack_ordered);
 }
 
 static int
@@ -1266,11 +1486,9 @@ luaopen_bson(lua_State *L) {
 	for (i=0;i<MAX_NUMBER;i++) {
 		char tmp[8];
 		bson_numstr_len[i] = sprintf(tmp,"%d",i);
-		memcpy(bson_numstrs[i], tmp, bson_numstr_len[i]);
+		memcpy(bson_numstrs[i], tmp, bson_numstr_len[i] + 1);
 	}
 	luaL_Reg l[] = {
-		{ "encode", lencode },
-		{ "encode_order", lencode_order },
 		{ "date", ldate },
 		{ "timestamp", ltimestamp  },
 		{ "regex", lregex },
@@ -1282,6 +1500,19 @@ luaopen_bson(lua_State *L) {
 
 	luaL_newlib(L,l);
 
+	struct bson_cache * c = lua_newuserdata(L, sizeof(*c));
+	c->ptr = NULL;
+	c->cap = 0;
+	lua_createtable(L, 0, 1);
+	lua_pushcfunction(L, lcache_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_setmetatable(L, -2);
+	lua_pushvalue(L, -1);
+	lua_pushcclosure(L, lencode, 1);
+	lua_setfield(L, -3, "encode");
+	lua_pushcclosure(L, lencode_order, 1);
+	lua_setfield(L, -2, "encode_order");
+
 	typeclosure(L);
 	lua_setfield(L,-2,"type");
 	char null[] = { 0, BSON_NULL };
@@ -12,6 +12,7 @@
 	uint32_t/session session
 	lightuserdata msg
 	uint32_t sz
+	integer version (optional, 1 or 2)
 
 	return 
 		string request
@@ -20,6 +21,8 @@
 
 #define TEMP_LENGTH 0x8200
 #define MULTI_PART 0x8000
+// the max size of a v2 frame, leave some room for the header
+#define MAX_FRAME 0x7fff0000
 
 static void
 fill_uint32(uint8_t * buf, uint32_t n) {
@@ -36,6 +39,25 @@ fill_header(lua_State *L, uint8_t *buf, int sz) {
 	buf[1] = sz & 0xff;
 }
 
+static void
+fill_header4(uint8_t *buf, uint32_t sz) {
+	buf[0] = (sz >> 24) & 0xff;
+	buf[1] = (sz >> 16) & 0xff;
+	buf[2] = (sz >> 8) & 0xff;
+	buf[3] = sz & 0xff;
+}
+
+// v2 frame : DWORD size (big-endian) + head + msg, never split
+static void
+push_frame(lua_State *L, uint8_t *head, int headsz, const void *msg, uint32_t sz) {
+	luaL_Buffer b;
+	fill_header4(head, headsz - 4 + sz);
+	luaL_buffinitsize(L, &b, headsz + sz);
+	luaL_addlstring(&b, (const char *)head, headsz);
+	luaL_addlstring(&b, (const char *)msg, sz);
+	luaL_pushresult(&b);
+}
+
 /*
 	The request package : 
 		first WORD is size of the package with big-endian
@@ -73,7 +95,38 @@ fill_header(lua_State *L, uint8_t *buf, int sz) {
 		BYTE 2/3 ; 2:multipart, 3:multipart end
 		DWORD SESSION
 		PADDING msgpart(sz)
+
+	version 2 (negotiated by handshake, See clusterd.lua) :
+		first DWORD is size of the package with big-endian,
+		the content is the same as the package (size <= 0x8000) of version 1 in any size,
+		so there is no multi part.
  */
+static void
+packreq_number_v2(lua_State *L, int session, void * msg, uint32_t sz, int is_push) {
+	uint32_t addr = (uint32_t)lua_tointeger(L,1);
+	uint8_t buf[13];
+	buf[4] = 0;
+	fill_uint32(buf+5, addr);
+	fill_uint32(buf+9, is_push ? 0 : (uint32_t)session);
+	push_frame(L, buf, 13, msg, sz);
+}
+
+static void
+packreq_string_v2(lua_State *L, int session, void * msg, uint32_t sz, int is_push) {
+	size_t namelen = 0;
+	const char *name = lua_tolstring(L, 1, &namelen);
+	if (name == NULL || namelen < 1 || namelen > 255) {
+		skynet_free(msg);
+		luaL_error(L, "name is too long %s", name);
+	}
+	uint8_t buf[4+2+255+4];
+	buf[4] = 0x80;
+	buf[5] = (uint8_t)namelen;
+	memcpy(buf+6, name, namelen);
+	fill_uint32(buf+6+namelen, is_push ? 0 : (uint32_t)session);
+	push_frame(L, buf, 10+namelen, msg, sz);
+}
+
 static int
 packreq_number(lua_State *L, int session, void * msg, uint32_t sz, int is_push) {
 	uint32_t addr = (uint32_t)lua_tointeger(L,1);
@@ -172,7 +225,18 @@ packrequest(lua_State *L, int is_push) {
 	}
 	int addr_type = lua_type(L,1);
 	int multipak;
-	if (addr_type == LUA_TNUMBER) {
+	if (luaL_optinteger(L, 5, 1) == 2) {
+		if (sz > MAX_FRAME) {
+			skynet_free(msg);
+			return luaL_error(L, "Request message is too large (%d)", sz);
+		}
+		if (addr_type == LUA_TNUMBER) {
+			packreq_number_v2(L, session, msg, sz, is_push);
+		} else {
+			packreq_string_v2(L, session, msg, sz, is_push);
+		}
+		multipak = 0;
+	} else if (addr_type == LUA_TNUMBER) {
 		multipak = packreq_number(L, session, msg, sz, is_push);
 	} else {
 		multipak = packreq_string(L, session, msg, sz, is_push);
@@ -217,6 +281,11 @@ unpack_uint32(const uint8_t * buf) {
 	return buf[0] | buf[1]<<8 | buf[2]<<16 | buf[3]<<24;
 }
 
+static inline uint32_t
+unpack_uint32_be(const uint8_t * buf) {
+	return (uint32_t)buf[0]<<24 | buf[1]<<16 | buf[2]<<8 | buf[3];
+}
+
 static int
 unpackreq_number(lua_State *L, const uint8_t * buf, int sz) {
 	if (sz < 9) {
@@ -351,12 +420,19 @@ lunpackrequest(lua_State *L) {
 		type = 1, msg
 		type = 2, DWORD size
 		type = 3/4, msg
+
+	version 2 :
+	DWORD size (big endian)
+	DWORD session
+	BYTE type (0 or 1)
+	PADDING msg
  */
 /*
 	int session
 	boolean ok
 	lightuserdata msg
 	int sz
+	integer version (optional, 1 or 2)
 	return string response
  */
 static int
@@ -375,6 +451,20 @@ lpackresponse(lua_State *L) {
 		sz = (size_t)luaL_checkinteger(L, 4);
 	}
 
+	if (luaL_optinteger(L, 5, 1) == 2) {
+		uint8_t head[9];
+		if (sz > MAX_FRAME) {
+			if (ok) {
+				return luaL_error(L, "Response message is too large (%d)", (int)sz);
+			}
+			sz = MULTI_PART;
+		}
+		fill_uint32(head+4, session);
+		head[8] = ok;
+		push_frame(L, head, 9, msg, sz);
+		return 1;
+	}
+
 	if (!ok) {
 		if (sz > MULTI_PART) {
 			// truncate the error msg if too long
@@ -437,9 +527,7 @@ lpackresponse(lua_State *L) {
 		boolean padding
  */
 static int
-lunpackresponse(lua_State *L) {
-	size_t sz;
-	const char * buf = luaL_checklstring(L, 1, &sz);
+unpackresponse(lua_State *L, const char * buf, size_t sz) {
 	if (sz < 5) {
 		return 0;
 	}
@@ -474,6 +562,62 @@ lunpackresponse(lua_State *L) {
 	}
 }
 
+static int
+lunpackresponse(lua_State *L) {
+	size_t sz;
+	const char * buf = luaL_checklstring(L, 1, &sz);
+	return unpackresponse(L, buf, sz);
+}
+
+/*
+	string data (bytes read from socket)
+	integer version (1 or 2)
+	table result
+	return integer n
+		string rest (the uncomplete package)
+		integer need (the bytes needed to complete the package in rest)
+
+	Unpack all the complete responses in data, result[4*i+1 .. 4*i+4] is
+	session, ok, msg, padding of the response i (from 0).
+ */
+static int
+lunpackresponses(lua_State *L) {
+	size_t sz;
+	const uint8_t * buf = (const uint8_t *)luaL_checklstring(L, 1, &sz);
+	int hsz = luaL_checkinteger(L, 2) == 2 ? 4 : 2;
+	luaL_checktype(L, 3, LUA_TTABLE);
+	int n = 0;
+	size_t need = 0;
+	while (sz >= hsz) {
+		size_t psz = (hsz == 4) ? unpack_uint32_be(buf) : (buf[0] << 8 | buf[1]);
+		if (sz < hsz + psz) {
+			need = hsz + psz - sz;
+			break;
+		}
+		int ret = unpackresponse(L, (const char *)buf + hsz, psz);
+		if (ret == 0) {
+			return luaL_error(L, "Invalid cluster response");
+		}
+		int i;
+		for (i=ret;i<4;i++) {
+			lua_pushnil(L);
+		}
+		for (i=4;i>0;i--) {
+			lua_seti(L, 3, n*4+i);
+		}
+		++n;
+		buf += hsz + psz;
+		sz -= hsz + psz;
+	}
+	if (sz > 0 && need == 0) {
+		need = hsz - sz;
+	}
+	lua_pushinteger(L, n);
+	lua_pushlstring(L, (const char *)buf, sz);
+	lua_pushinteger(L, need);
+	return 3;
+}
+
 static int
 lconcat(lua_State *L) {
 	if (!lua_istable(L,1))
@@ -515,6 +659,7 @@ luaopen_cluster_core(lua_State *L) {
 		{ "unpackrequest", lunpackrequest },
 		{ "packresponse", lpackresponse },
 		{ "unpackresponse", lunpackresponse },
+		{ "unpackresponses", lunpackresponses },
 		{ "concat", lconcat },
 		{ NULL, NULL },
 	};
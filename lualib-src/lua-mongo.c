@@ -197,28 +197,31 @@ op_query(lua_State *L) {
 	return 1;
 }
 
+struct reply_header {
+//	int32_t length; // total message size, including this
+	int32_t request_id; // identifier for this message
+	int32_t response_id; // requestID from the original request
+						// (used in reponses from db)
+	int32_t opcode; // request type
+	int32_t flags;
+	int32_t cursor_id[2];
+	int32_t starting;
+	int32_t number;
+};
+
 // 1 string data
-// 2 result document table
+// 2 result document table (optional)
 // return boolean succ (false -> request id, error document)
 //	number request_id
 //  document first
 //	string cursor_id
 //  integer startfrom
+// Without the table, all the documents are checked and use next_document to walk them.
 static int
 op_reply(lua_State *L) {
 	size_t data_len = 0;
 	const char * data = luaL_checklstring(L,1,&data_len);
-	struct {
-//		int32_t length; // total message size, including this
-		int32_t request_id; // identifier for this message
-		int32_t response_id; // requestID from the original request
-							// (used in reponses from db)
-		int32_t opcode; // request type 
-		int32_t flags;
-		int32_t cursor_id[2];
-		int32_t starting;
-		int32_t number;
-	} const *reply = (const void *)data;
+	const struct reply_header *reply = (const void *)data;
 
 	if (data_len < sizeof(*reply)) {
 		lua_pushboolean(L, 0);
@@ -263,8 +266,20 @@ op_reply(lua_State *L) {
 			lua_rawseti(L, 2, i);
 		}
 	} else {
-		if (sz >= 4) {
-			sz -= get_length((document)doc);
+		int i = 0;
+		while (sz >= 4) {
+			int32_t doc_len = get_length((document)doc);
+			if (doc_len < 5 || doc_len > sz) {
+				break;
+			}
+			doc += doc_len;
+			sz -= doc_len;
+			++i;
+		}
+		if (sz == 0 && i != number) {
+			lua_pushboolean(L,0);
+			lua_pushinteger(L, id);
+			return 2;
 		}
 	}
 	if (sz != 0) {
@@ -287,6 +302,28 @@ op_reply(lua_State *L) {
 	return 5;
 }
 
+/*
+	1 string data (checked by op_reply without the table)
+	2 lightuserdata document in data
+	return the next document, or nil
+ */
+static int
+op_next_document(lua_State *L) {
+	size_t data_len = 0;
+	const uint8_t * data = (const uint8_t *)luaL_checklstring(L,1,&data_len);
+	const uint8_t * doc = lua_touserdata(L,2);
+	const uint8_t * end = data + data_len;
+	if (doc < data + sizeof(struct reply_header) || doc + 4 > end) {
+		return luaL_error(L, "Invalid document");
+	}
+	doc += get_length((document)doc);
+	if (doc + 4 > end) {
+		return 0;
+	}
+	lua_pushlightuserdata(L, (void *)doc);
+	return 1;
+}
+
 /*
 	1 string cursor_id
 	return string package
@@ -537,6 +574,7 @@ luaopen_mongo_driver(lua_State *L) {
 	luaL_Reg l[] ={
 		{ "query", op_query },
 		{ "reply", op_reply },
+		{ "next", op_next_document },
 		{ "kill", op_kill },
 		{ "delete", op_delete },
 		{ "more", op_get_more },
@@ -8,6 +8,9 @@
 #include <string.h>
 
 #include "atomic.h"
+#include "skynet_handle.h"
+
+#define GROUP_META "multicast.group"
 
 struct mc_package {
 	int reference;
@@ -15,6 +18,13 @@ struct mc_package {
 	void *data;
 };
 
+// the local subscribers of a channel, the handles are sorted
+struct mc_group {
+	int n;
+	int cap;
+	uint32_t *handle;
+};
+
 static int
 pack(lua_State *L, void *data, size_t size) {
 	struct mc_package * pack = skynet_malloc(sizeof(struct mc_package));
@@ -136,10 +146,208 @@ mc_remote(lua_State *L) {
 	return 2;
 }
 
+static int
+group_gc(lua_State *L) {
+	struct mc_group *g = lua_touserdata(L, 1);
+	skynet_free(g->handle);
+	g->handle = NULL;
+	g->n = 0;
+	g->cap = 0;
+	return 0;
+}
+
+/*
+	return userdata group
+ */
+static int
+mc_newgroup(lua_State *L) {
+	struct mc_group *g = lua_newuserdata(L, sizeof(*g));
+	g->n = 0;
+	g->cap = 0;
+	g->handle = NULL;
+	if (luaL_newmetatable(L, GROUP_META)) {
+		lua_pushcfunction(L, group_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+// return the position of handle, or where it should be inserted
+static int
+group_find(struct mc_group *g, uint32_t handle) {
+	int begin = 0;
+	int end = g->n;
+	while (begin < end) {
+		int mid = (begin + end) / 2;
+		if (g->handle[mid] < handle) {
+			begin = mid + 1;
+		} else {
+			end = mid;
+		}
+	}
+	return begin;
+}
+
+/*
+	userdata group
+	integer handle
+
+	return true if the handle is a new subscriber
+ */
+static int
+mc_subscribe(lua_State *L) {
+	struct mc_group *g = luaL_checkudata(L, 1, GROUP_META);
+	uint32_t handle = (uint32_t)luaL_checkinteger(L, 2);
+	int pos = group_find(g, handle);
+	if (pos < g->n && g->handle[pos] == handle) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+	if (g->n >= g->cap) {
+		int cap = g->cap == 0 ? 16 : g->cap * 2;
+		uint32_t * h = skynet_malloc(cap * sizeof(uint32_t));
+		if (g->n > 0) {
+			memcpy(h, g->handle, g->n * sizeof(uint32_t));
+		}
+		skynet_free(g->handle);
+		g->handle = h;
+		g->cap = cap;
+	}
+	memmove(g->handle + pos + 1, g->handle + pos, (g->n - pos) * sizeof(uint32_t));
+	g->handle[pos] = handle;
+	++g->n;
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+/*
+	userdata group
+	integer handle
+
+	return true if the handle is removed
+ */
+static int
+mc_unsubscribe(lua_State *L) {
+	struct mc_group *g = luaL_checkudata(L, 1, GROUP_META);
+	uint32_t handle = (uint32_t)luaL_checkinteger(L, 2);
+	int pos = group_find(g, handle);
+	if (pos >= g->n || g->handle[pos] != handle) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+	--g->n;
+	memmove(g->handle + pos, g->handle + pos + 1, (g->n - pos) * sizeof(uint32_t));
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+/*
+	userdata group
+
+	return the number of subscribers
+ */
+static int
+mc_count(lua_State *L) {
+	struct mc_group *g = luaL_checkudata(L, 1, GROUP_META);
+	lua_pushinteger(L, g->n);
+	return 1;
+}
+
+/*
+	userdata group
+	lightuserdata struct mc_package **
+	integer size (must be sizeof(struct mc_package *))
+	integer source
+	integer channel
+
+	Bind the reference of the package to the number of subscribers, and push the package
+	pointer into the message queue of each subscriber (the channel id use the session field).
+	The struct mc_package ** is freed, and so is the package when there is no subscriber.
+	return the number of the subscribers received
+ */
+static int
+mc_publish(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	struct mc_group *g = luaL_checkudata(L, 1, GROUP_META);
+	struct mc_package ** ptr = lua_touserdata(L, 2);
+	int sz = luaL_checkinteger(L, 3);
+	uint32_t source = (uint32_t)luaL_checkinteger(L, 4);
+	int channel = luaL_checkinteger(L, 5);
+	if (ptr == NULL || sz != sizeof(ptr)) {
+		return luaL_error(L, "Invalid multicast package size %d", sz);
+	}
+	struct mc_package *pack = *ptr;
+	skynet_free(ptr);
+	if (pack->reference != 0) {
+		return luaL_error(L, "Can't bind a multicast package more than once");
+	}
+	// hold one more reference until all the messages are sent
+	pack->reference = g->n + 1;
+	int i;
+	int fail = 0;
+	for (i=0;i<g->n;i++) {
+		// the message (the pointer to the package) is copied by skynet_send
+		if (skynet_send(ctx, source, g->handle[i], PTYPE_MULTICAST, channel, &pack, sizeof(pack)) < 0) {
+			++fail;
+		}
+	}
+	int ref = ATOM_SUB(&pack->reference, fail + 1);
+	if (ref <= 0) {
+		skynet_free(pack->data);
+		skynet_free(pack);
+	}
+	lua_pushinteger(L, g->n - fail);
+	return 1;
+}
+
+/*
+	lightuserdata struct mc_package **
+	integer size (must be sizeof(struct mc_package *))
+	integer source
+	integer channel
+	table addresses (multicastd of other nodes)
+	integer exclude (optional, the harbor id not to send)
+
+	Send a copy of the message (not the package) to each address, the package is not changed.
+	return the number of the copies sent
+ */
+static int
+mc_forward(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	struct mc_package ** ptr = lua_touserdata(L, 1);
+	int sz = luaL_checkinteger(L, 2);
+	uint32_t source = (uint32_t)luaL_checkinteger(L, 3);
+	int channel = luaL_checkinteger(L, 4);
+	luaL_checktype(L, 5, LUA_TTABLE);
+	int exclude = (int)luaL_optinteger(L, 6, -1);
+	if (ptr == NULL || sz != sizeof(ptr)) {
+		return luaL_error(L, "Invalid multicast package size %d", sz);
+	}
+	struct mc_package *pack = *ptr;
+	int n = lua_rawlen(L, 5);
+	int i;
+	int count = 0;
+	for (i=1;i<=n;i++) {
+		lua_rawgeti(L, 5, i);
+		uint32_t address = (uint32_t)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		if ((int)(address >> HANDLE_REMOTE_SHIFT) == exclude) {
+			continue;
+		}
+		// skynet_send copies the data
+		if (skynet_send(ctx, source, address, PTYPE_MULTICAST, channel, pack->data, pack->size) >= 0) {
+			++count;
+		}
+	}
+	lua_pushinteger(L, count);
+	return 1;
+}
+
 static int
 mc_nextid(lua_State *L) {
 	uint32_t id = (uint32_t)luaL_checkinteger(L, 1);
-	id += 256;
+	id += 1u << (32 - HANDLE_REMOTE_SHIFT);	// keep the low bits (harbor id)
 	lua_pushinteger(L, (uint32_t)id);
 
 	return 1;
@@ -155,9 +363,26 @@ luaopen_multicast_core(lua_State *L) {
 		{ "remote", mc_remote },
 		{ "packremote", mc_packremote },
 		{ "nextid", mc_nextid },
+		{ "newgroup", mc_newgroup },
+		{ "subscribe", mc_subscribe },
+		{ "unsubscribe", mc_unsubscribe },
+		{ "count", mc_count },
 		{ NULL, NULL },
 	};
 	luaL_checkversion(L);
 	luaL_newlib(L,l);
+
+	// publish needs the skynet context
+	luaL_Reg l2[] = {
+		{ "publish", mc_publish },
+		{ "forward", mc_forward },
+		{ NULL, NULL },
+	};
+	lua_getfield(L, LUA_REGISTRYINDEX, "skynet_context");
+	struct skynet_context *ctx = lua_touserdata(L,-1);
+	if (ctx == NULL) {
+		return luaL_error(L, "Init skynet context first");
+	}
+	luaL_setfuncs(L,l2,1);
 	return 1;
 }
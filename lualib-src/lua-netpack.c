@@ -464,6 +464,47 @@ ltostring(lua_State *L) {
 	return 1;
 }
 
+/*
+	lightuserdata msg
+	integer size
+	integer index (optional)
+
+	Read the batched message forwarded by gate (batch mode) :
+	uint32_t n, { uint32_t offset, uint32_t size } [n], data ...
+
+	return n (without index), or lightuserdata, size of the index-th package (1-based).
+	The package pointers are valid only during the dispatch of the message.
+ */
+static int
+lbatch(lua_State *L) {
+	const uint8_t * msg = lua_touserdata(L, 1);
+	size_t sz = luaL_checkinteger(L, 2);
+	if (msg == NULL || sz < sizeof(uint32_t)) {
+		return luaL_error(L, "Invalid batch message");
+	}
+	uint32_t n;
+	memcpy(&n, msg, sizeof(n));
+	if ((sz - sizeof(uint32_t)) / (2 * sizeof(uint32_t)) < n) {
+		return luaL_error(L, "Invalid batch message (n = %d)", (int)n);
+	}
+	if (lua_isnoneornil(L, 3)) {
+		lua_pushinteger(L, n);
+		return 1;
+	}
+	lua_Integer index = luaL_checkinteger(L, 3);
+	if (index < 1 || index > n) {
+		return 0;
+	}
+	uint32_t item[2];
+	memcpy(item, msg + sizeof(uint32_t) + (index-1) * sizeof(item), sizeof(item));
+	if (item[0] > sz || sz - item[0] < item[1]) {
+		return luaL_error(L, "Invalid batch message (package %d)", (int)index);
+	}
+	lua_pushlightuserdata(L, (void *)(msg + item[0]));
+	lua_pushinteger(L, item[1]);
+	return 2;
+}
+
 LUAMOD_API int
 luaopen_netpack(lua_State *L) {
 	luaL_checkversion(L);
@@ -472,6 +513,7 @@ luaopen_netpack(lua_State *L) {
 		{ "pack", lpack },
 		{ "clear", lclear },
 		{ "tostring", ltostring },
+		{ "batch", lbatch },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L,l);
@@ -30,82 +30,117 @@
 // hibits 0~31 : len
 #define TYPE_LONG_STRING 5
 #define TYPE_TABLE 6
+#define TYPE_STRING_REF 7
+// hibits 0 : format header, 1~30 : index+1 , 31 : integer index followed
 
 #define MAX_COOKIE 32
 #define COMBINE_TYPE(t,v) ((t) | (v) << 3)
 
-#define BLOCK_SIZE 128
+#define MIN_BUFFER 64
 #define MAX_DEPTH 32
 
-struct block {
-	struct block * next;
-	char buffer[BLOCK_SIZE];
+/*
+	String references
+
+	A stream begins with the format header (TYPE_STRING_REF, 0) uses string references :
+	each string (length >= MIN_REF_STRING) written in full gets the next index (from 0),
+	and TYPE_STRING_REF (index) repeats it. The packer writes the header only when a string is repeated,
+	so the other streams are the same as the old format.
+	It's off by default (see luaseri_stringref) : the older nodes can't unpack the header,
+	and luaseri_lazyunpack can't forward the views of such a stream, it unpacks the stream fully.
+ */
+#define MIN_REF_STRING 2
+#define REF_SLOTS 1024
+#define REF_PROBE 8
+#define REF_STACK 64
+#define REF_HEADER COMBINE_TYPE(TYPE_STRING_REF, 0)
+
+struct ref_slot {
+	const char * str;
+	uint32_t gen;
+	int index;
+	int offset;	// the string in write_block buffer
+	int len;
 };
 
+// The strings written by luaseri_pack in this thread, slots of other generations are empty.
+static __thread struct ref_slot REF_CACHE[REF_SLOTS];
+static __thread uint32_t REF_GEN = 0;
+// registry key of the switch of string references (per lua state)
+static int REF_ENABLE;
+
+/*
+	The result is written into one buffer which grows by skynet_realloc,
+	and the buffer is returned directly (no copy) by luaseri_pack.
+ */
 struct write_block {
-	struct block * head;
-	struct block * current;
+	char * buffer;
 	int len;
-	int ptr;
+	int cap;
+	int ref;	// string references enabled, the first byte is reserved for the header
+	int ref_used;
+	int nstr;	// strings can be referenced
+	uint32_t gen;
+};
+
+struct string_slice {
+	const char * ptr;
+	int len;
+};
+
+struct string_table {
+	int n;
+	int cap;
+	int index;	// stack index of the userdata of s, when it's larger than REF_STACK
+	struct string_slice * s;
 };
 
 struct read_block {
 	char * buffer;
 	int len;
 	int ptr;
+	struct string_table * st;	// NULL if the stream doesn't use string references
 };
 
-inline static struct block *
-blk_alloc(void) {
-	struct block *b = skynet_malloc(sizeof(struct block));
-	b->next = NULL;
-	return b;
+static void
+wb_grow(struct write_block *b, int sz) {
+	int cap = b->cap * 2;
+	while (cap < b->len + sz) {
+		cap *= 2;
+	}
+	b->buffer = skynet_realloc(b->buffer, cap);
+	b->cap = cap;
 }
 
 inline static void
 wb_push(struct write_block *b, const void *buf, int sz) {
-	const char * buffer = buf;
-	if (b->ptr == BLOCK_SIZE) {
-_again:
-		b->current = b->current->next = blk_alloc();
-		b->ptr = 0;
-	}
-	if (b->ptr <= BLOCK_SIZE - sz) {
-		memcpy(b->current->buffer + b->ptr, buffer, sz);
-		b->ptr+=sz;
-		b->len+=sz;
-	} else {
-		int copy = BLOCK_SIZE - b->ptr;
-		memcpy(b->current->buffer + b->ptr, buffer, copy);
-		buffer += copy;
-		b->len += copy;
-		sz -= copy;
-		goto _again;
+	if (b->len + sz > b->cap) {
+		wb_grow(b, sz);
 	}
+	memcpy(b->buffer + b->len, buf, sz);
+	b->len += sz;
 }
 
 static void
-wb_init(struct write_block *wb , struct block *b) {
-	wb->head = b;
-	assert(b->next == NULL);
+wb_init(struct write_block *wb , int cap) {
+	if (cap < MIN_BUFFER) {
+		cap = MIN_BUFFER;
+	}
+	wb->buffer = skynet_malloc(cap);
 	wb->len = 0;
-	wb->current = wb->head;
-	wb->ptr = 0;
+	wb->cap = cap;
+	wb->ref = 0;
+	wb->ref_used = 0;
+	wb->nstr = 0;
+	wb->gen = 0;
 }
 
 static void
 wb_free(struct write_block *wb) {
-	struct block *blk = wb->head;
-	blk = blk->next;	// the first block is on stack
-	while (blk) {
-		struct block * next = blk->next;
-		skynet_free(blk);
-		blk = next;
-	}
-	wb->head = NULL;
-	wb->current = NULL;
-	wb->ptr = 0;
+	skynet_free(wb->buffer);
+	wb->buffer = NULL;
 	wb->len = 0;
+	wb->cap = 0;
 }
 
 static void
@@ -113,6 +148,7 @@ rball_init(struct read_block * rb, char * buffer, int size) {
 	rb->buffer = buffer;
 	rb->len = size;
 	rb->ptr = 0;
+	rb->st = NULL;
 }
 
 static void *
@@ -187,8 +223,50 @@ wb_pointer(struct write_block *wb, void *v) {
 	wb_push(wb, &v, sizeof(v));
 }
 
+static inline void
+wb_ref(struct write_block *wb, int index) {
+	if (index < MAX_COOKIE-2) {
+		uint8_t n = COMBINE_TYPE(TYPE_STRING_REF, index+1);
+		wb_push(wb, &n, 1);
+	} else {
+		uint8_t n = COMBINE_TYPE(TYPE_STRING_REF, MAX_COOKIE-1);
+		wb_push(wb, &n, 1);
+		wb_integer(wb, index);
+	}
+	wb->ref_used = 1;
+}
+
+// return 1 if the string is written before (and write the reference), or register it
+static int
+wb_string_ref(struct write_block *wb, const char *str, int len) {
+	uint32_t h = (uint32_t)((uintptr_t)str >> 3);
+	int i;
+	int offset = wb->len + (len < MAX_COOKIE ? 1 : (len < 0x10000 ? 3 : 5));
+	for (i=0;i<REF_PROBE;i++) {
+		struct ref_slot * slot = &REF_CACHE[(h + i) & (REF_SLOTS-1)];
+		if (slot->gen != wb->gen) {
+			slot->str = str;
+			slot->gen = wb->gen;
+			slot->index = wb->nstr;
+			slot->offset = offset;
+			slot->len = len;
+			break;
+		}
+		// The lua string may be collected (by __pairs) and the address reused, so compare the content.
+		if (slot->str == str && slot->len == len && memcmp(wb->buffer + slot->offset, str, len) == 0) {
+			wb_ref(wb, slot->index);
+			return 1;
+		}
+	}
+	++wb->nstr;
+	return 0;
+}
+
 static inline void
 wb_string(struct write_block *wb, const char *str, int len) {
+	if (wb->ref && len >= MIN_REF_STRING && wb_string_ref(wb, str, len)) {
+		return;
+	}
 	if (len < MAX_COOKIE) {
 		uint8_t n = COMBINE_TYPE(TYPE_SHORT_STRING, len);
 		wb_push(wb, &n, 1);
@@ -212,7 +290,16 @@ wb_string(struct write_block *wb, const char *str, int len) {
 	}
 }
 
+#define SERI_VIEW "skynet.seriview"
+
+// A table which is not unpacked yet, see luaseri_lazyunpack
+struct seri_view {
+	const char * ptr;	// the serialized table (type byte included)
+	int sz;
+};
+
 static void pack_one(lua_State *L, struct write_block *b, int index, int depth);
+static int count_strings(lua_State *L, struct seri_view *v);
 
 static int
 wb_table_array(lua_State *L, struct write_block * wb, int index, int depth) {
@@ -326,6 +413,19 @@ pack_one(lua_State *L, struct write_block *b, int index, int depth) {
 	case LUA_TLIGHTUSERDATA:
 		wb_pointer(b, lua_touserdata(L,index));
 		break;
+	case LUA_TUSERDATA: {
+		struct seri_view * v = luaL_testudata(L, index, SERI_VIEW);
+		if (v == NULL) {
+			wb_free(b);
+			luaL_error(L, "Unsupport type %s to serialize", lua_typename(L, type));
+		}
+		// a lazy table from luaseri_lazyunpack, forward the bytes as they are
+		if (b->ref) {
+			b->nstr += count_strings(L, v);
+		}
+		wb_push(b, v->ptr, v->sz);
+		break;
+	}
 	case LUA_TTABLE: {
 		if (index < 0) {
 			index = lua_gettop(L) + index + 1;
@@ -420,6 +520,21 @@ get_pointer(lua_State *L, struct read_block *rb) {
 	return userdata;
 }
 
+static void
+st_add(lua_State *L, struct string_table *st, const char *p, int len) {
+	if (st->n >= st->cap) {
+		int cap = st->cap * 2;
+		struct string_slice * s = lua_newuserdata(L, cap * sizeof(*s));
+		memcpy(s, st->s, st->n * sizeof(*s));
+		lua_replace(L, st->index);
+		st->s = s;
+		st->cap = cap;
+	}
+	st->s[st->n].ptr = p;
+	st->s[st->n].len = len;
+	++st->n;
+}
+
 static void
 get_buffer(lua_State *L, struct read_block *rb, int len) {
 	char * p = rb_read(rb,len);
@@ -427,12 +542,37 @@ get_buffer(lua_State *L, struct read_block *rb, int len) {
 		invalid_stream(L,rb);
 	}
 	lua_pushlstring(L,p,len);
+	if (rb->st && len >= MIN_REF_STRING) {
+		st_add(L, rb->st, p, len);
+	}
+}
+
+static void
+get_ref(lua_State *L, struct read_block *rb, int cookie) {
+	struct string_table * st = rb->st;
+	if (st == NULL || cookie == 0) {
+		invalid_stream(L,rb);
+	}
+	lua_Integer index;
+	if (cookie == MAX_COOKIE-1) {
+		uint8_t *t = rb_read(rb, 1);
+		if (t == NULL || (*t & 7) != TYPE_NUMBER || (*t >> 3) == TYPE_NUMBER_REAL) {
+			invalid_stream(L,rb);
+		}
+		index = get_integer(L, rb, *t >> 3);
+	} else {
+		index = cookie - 1;
+	}
+	if (index < 0 || index >= st->n) {
+		invalid_stream(L,rb);
+	}
+	lua_pushlstring(L, st->s[index].ptr, st->s[index].len);
 }
 
 static void unpack_one(lua_State *L, struct read_block *rb);
 
-static void
-unpack_table(lua_State *L, struct read_block *rb, int array_size) {
+static int
+get_array_size(lua_State *L, struct read_block *rb, int array_size) {
 	if (array_size == MAX_COOKIE-1) {
 		uint8_t type;
 		uint8_t *t = rb_read(rb, sizeof(type));
@@ -446,6 +586,12 @@ unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 		}
 		array_size = get_integer(L,rb,cookie);
 	}
+	return array_size;
+}
+
+static void
+unpack_table(lua_State *L, struct read_block *rb, int array_size) {
+	array_size = get_array_size(L, rb, array_size);
 	luaL_checkstack(L,LUA_MINSTACK,NULL);
 	lua_createtable(L,array_size,0);
 	int i;
@@ -513,6 +659,9 @@ push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 		unpack_table(L,rb,cookie);
 		break;
 	}
+	case TYPE_STRING_REF:
+		get_ref(L,rb,cookie);
+		break;
 	default: {
 		invalid_stream(L,rb);
 		break;
@@ -531,25 +680,26 @@ unpack_one(lua_State *L, struct read_block *rb) {
 	push_value(L, rb, type & 0x7, type>>3);
 }
 
-static void
-seri(lua_State *L, struct block *b, int len) {
-	uint8_t * buffer = skynet_malloc(len);
-	uint8_t * ptr = buffer;
-	int sz = len;
-	while(len>0) {
-		if (len >= BLOCK_SIZE) {
-			memcpy(ptr, b->buffer, BLOCK_SIZE);
-			ptr += BLOCK_SIZE;
-			len -= BLOCK_SIZE;
-			b = b->next;
-		} else {
-			memcpy(ptr, b->buffer, len);
+// Guess the size of the result from the top level arguments, to avoid most of the reallocs.
+static int
+estimate_size(lua_State *L, int from) {
+	int n = lua_gettop(L);
+	int sz = 0;
+	int i;
+	for (i=from+1;i<=n;i++) {
+		switch(lua_type(L,i)) {
+		case LUA_TSTRING:
+			sz += (int)lua_rawlen(L,i) + 5;
+			break;
+		case LUA_TTABLE:
+			sz += 16 + (int)lua_rawlen(L,i) * 9;
+			break;
+		default:
+			sz += 9;
 			break;
 		}
 	}
-	
-	lua_pushlightuserdata(L, buffer);
-	lua_pushinteger(L, sz);
+	return sz;
 }
 
 int
@@ -578,6 +728,18 @@ luaseri_unpack(lua_State *L) {
 	struct read_block rb;
 	rball_init(&rb, buffer, len);
 
+	struct string_slice slice[REF_STACK];
+	struct string_table st;
+	if (*(uint8_t *)buffer == REF_HEADER) {
+		rb_read(&rb, 1);
+		st.n = 0;
+		st.cap = REF_STACK;
+		st.s = slice;
+		lua_pushnil(L);
+		st.index = lua_gettop(L);
+		rb.st = &st;
+	}
+
 	int i;
 	for (i=0;;i++) {
 		if (i%8==7) {
@@ -591,22 +753,480 @@ luaseri_unpack(lua_State *L) {
 		push_value(L, &rb, type & 0x7, type>>3);
 	}
 
+	if (rb.st) {
+		lua_remove(L, st.index);
+	}
+
 	// Need not free buffer
 
 	return lua_gettop(L) - 1;
 }
 
+/*
+	Lazy unpack
+
+	The leading non-table values are unpacked as usual, and each table is returned as a view
+	(userdata SERI_VIEW) over a copy of the serialized bytes. The fields of a view are decoded
+	on demand by __index / __len / __pairs (each access scans the table), nested tables are views too.
+	skynet.pack writes a view back as its raw bytes, so a view can be forwarded without re-serialization.
+ */
+
+static int
+get_length(lua_State *L, struct read_block *rb, int cookie) {
+	if (cookie == 2) {
+		uint16_t n;
+		uint16_t *plen = rb_read(rb, 2);
+		if (plen == NULL) {
+			invalid_stream(L,rb);
+		}
+		memcpy(&n, plen, sizeof(n));
+		return n;
+	} else {
+		uint32_t n;
+		if (cookie != 4) {
+			invalid_stream(L,rb);
+		}
+		uint32_t *plen = rb_read(rb, 4);
+		if (plen == NULL) {
+			invalid_stream(L,rb);
+		}
+		memcpy(&n, plen, sizeof(n));
+		return (int)n;
+	}
+}
+
+static void skip_one(lua_State *L, struct read_block *rb, int depth, int *nstr);
+
+static void
+skip_bytes(lua_State *L, struct read_block *rb, int sz) {
+	if (rb_read(rb, sz) == NULL) {
+		invalid_stream(L,rb);
+	}
+}
+
+// skip a value, and count the strings can be referenced (if nstr isn't NULL)
+static void
+skip_value(lua_State *L, struct read_block *rb, int type, int cookie, int depth, int *nstr) {
+	switch(type) {
+	case TYPE_NIL:
+	case TYPE_BOOLEAN:
+		break;
+	case TYPE_NUMBER:
+		switch (cookie) {
+		case TYPE_NUMBER_ZERO:
+			break;
+		case TYPE_NUMBER_BYTE:
+		case TYPE_NUMBER_WORD:
+		case TYPE_NUMBER_DWORD:
+			skip_bytes(L, rb, cookie);
+			break;
+		case TYPE_NUMBER_QWORD:
+		case TYPE_NUMBER_REAL:
+			skip_bytes(L, rb, 8);
+			break;
+		default:
+			invalid_stream(L,rb);
+		}
+		break;
+	case TYPE_USERDATA:
+		skip_bytes(L, rb, sizeof(void *));
+		break;
+	case TYPE_SHORT_STRING:
+		skip_bytes(L, rb, cookie);
+		if (nstr && cookie >= MIN_REF_STRING) {
+			++*nstr;
+		}
+		break;
+	case TYPE_LONG_STRING:
+		skip_bytes(L, rb, get_length(L, rb, cookie));
+		if (nstr) {
+			++*nstr;
+		}
+		break;
+	case TYPE_TABLE: {
+		if (depth > MAX_DEPTH) {
+			invalid_stream(L,rb);
+		}
+		int array_size = get_array_size(L, rb, cookie);
+		int i;
+		for (i=0;i<array_size;i++) {
+			skip_one(L, rb, depth+1, nstr);
+		}
+		for (;;) {
+			uint8_t *t = rb_read(rb, 1);
+			if (t == NULL) {
+				invalid_stream(L,rb);
+			}
+			if ((*t & 7) == TYPE_NIL) {
+				break;
+			}
+			skip_value(L, rb, *t & 7, *t >> 3, depth+1, nstr);
+			skip_one(L, rb, depth+1, nstr);
+		}
+		break;
+	}
+	default:
+		invalid_stream(L,rb);
+	}
+}
+
+static void
+skip_one(lua_State *L, struct read_block *rb, int depth, int *nstr) {
+	uint8_t *t = rb_read(rb, 1);
+	if (t == NULL) {
+		invalid_stream(L,rb);
+	}
+	skip_value(L, rb, *t & 7, *t >> 3, depth, nstr);
+}
+
+// push a view of the table at rb (the type byte is read already), the blob of views is at blob_index
+static void
+push_view(lua_State *L, struct read_block *rb, int cookie, int blob_index) {
+	const char * ptr = rb->buffer + rb->ptr - 1;
+	skip_value(L, rb, TYPE_TABLE, cookie, 0, NULL);
+	struct seri_view * v = lua_newuserdata(L, sizeof(*v));
+	v->ptr = ptr;
+	v->sz = (int)(rb->buffer + rb->ptr - ptr);
+	lua_pushvalue(L, blob_index);
+	lua_setuservalue(L, -2);
+	luaL_setmetatable(L, SERI_VIEW);
+}
+
+// push the next value of rb, tables as views
+static void
+push_lazy(lua_State *L, struct read_block *rb, int blob_index) {
+	uint8_t *t = rb_read(rb, 1);
+	if (t == NULL) {
+		invalid_stream(L,rb);
+	}
+	int type = *t & 7;
+	int cookie = *t >> 3;
+	if (type == TYPE_TABLE) {
+		push_view(L, rb, cookie, blob_index);
+	} else {
+		push_value(L, rb, type, cookie);
+	}
+}
+
+// read the table header of a view, return the array size
+static int
+view_begin(lua_State *L, struct seri_view *v, struct read_block *rb) {
+	rball_init(rb, (char *)v->ptr, v->sz);
+	uint8_t *t = rb_read(rb, 1);
+	if (t == NULL || (*t & 7) != TYPE_TABLE) {
+		invalid_stream(L,rb);
+	}
+	return get_array_size(L, rb, *t >> 3);
+}
+
+// compare the key at rb (type byte is read already) with the key at index 2, and skip it
+static int
+match_key(lua_State *L, struct read_block *rb, int type, int cookie) {
+	switch (type) {
+	case TYPE_SHORT_STRING:
+	case TYPE_LONG_STRING: {
+		int len = type == TYPE_SHORT_STRING ? cookie : get_length(L, rb, cookie);
+		const char * str = rb_read(rb, len);
+		if (str == NULL) {
+			invalid_stream(L,rb);
+		}
+		if (lua_type(L, 2) != LUA_TSTRING) {
+			return 0;
+		}
+		size_t sz;
+		const char * key = lua_tolstring(L, 2, &sz);
+		return sz == (size_t)len && memcmp(key, str, len) == 0;
+	}
+	case TYPE_NUMBER: {
+		if (lua_type(L, 2) != LUA_TNUMBER) {
+			skip_value(L, rb, type, cookie, 0, NULL);
+			return 0;
+		}
+		if (cookie == TYPE_NUMBER_REAL) {
+			return lua_tonumber(L, 2) == get_real(L, rb);
+		}
+		lua_Integer k;
+		lua_Integer n = get_integer(L, rb, cookie);
+		return lua_isinteger(L, 2) ? (lua_tointeger(L, 2) == n) :
+			(lua_numbertointeger(lua_tonumber(L, 2), &k) && k == n);
+	}
+	case TYPE_BOOLEAN:
+		return lua_type(L, 2) == LUA_TBOOLEAN && lua_toboolean(L, 2) == cookie;
+	default:
+		skip_value(L, rb, type, cookie, 0, NULL);
+		return 0;
+	}
+}
+
+static int
+count_strings(lua_State *L, struct seri_view *v) {
+	struct read_block rb;
+	int n = 0;
+	rball_init(&rb, (char *)v->ptr, v->sz);
+	skip_one(L, &rb, 0, &n);
+	return n;
+}
+
+static int
+lview_index(lua_State *L) {
+	struct seri_view * v = luaL_checkudata(L, 1, SERI_VIEW);
+	lua_getuservalue(L, 1);
+	int blob = lua_gettop(L);
+	struct read_block rb;
+	int array_size = view_begin(L, v, &rb);
+	int i;
+	if (lua_isinteger(L, 2)) {
+		lua_Integer k = lua_tointeger(L, 2);
+		if (k > 0 && k <= array_size) {
+			for (i=1;i<k;i++) {
+				skip_one(L, &rb, 0, NULL);
+			}
+			push_lazy(L, &rb, blob);
+			return 1;
+		}
+	}
+	for (i=0;i<array_size;i++) {
+		skip_one(L, &rb, 0, NULL);
+	}
+	for (;;) {
+		uint8_t *t = rb_read(&rb, 1);
+		if (t == NULL) {
+			invalid_stream(L,&rb);
+		}
+		int type = *t & 7;
+		if (type == TYPE_NIL) {
+			return 0;
+		}
+		if (match_key(L, &rb, type, *t >> 3)) {
+			push_lazy(L, &rb, blob);
+			return 1;
+		}
+		skip_one(L, &rb, 0, NULL);
+	}
+}
+
+static int
+lview_len(lua_State *L) {
+	struct seri_view * v = luaL_checkudata(L, 1, SERI_VIEW);
+	struct read_block rb;
+	lua_pushinteger(L, view_begin(L, v, &rb));
+	return 1;
+}
+
+/*
+	upvalue 1 : view
+	upvalue 2 : read position
+	upvalue 3 : index of the next array item (0 for hash part)
+	upvalue 4 : array size
+ */
+static int
+lview_next(lua_State *L) {
+	struct seri_view * v = lua_touserdata(L, lua_upvalueindex(1));
+	int ptr = lua_tointeger(L, lua_upvalueindex(2));
+	int index = lua_tointeger(L, lua_upvalueindex(3));
+	int array_size = lua_tointeger(L, lua_upvalueindex(4));
+	if (ptr < 0) {
+		return 0;
+	}
+	lua_settop(L, 0);
+	lua_getuservalue(L, lua_upvalueindex(1));
+	struct read_block rb;
+	rball_init(&rb, (char *)v->ptr + ptr, v->sz - ptr);
+	for (;;) {
+		if (index > 0) {
+			lua_pushinteger(L, index);
+			push_lazy(L, &rb, 1);
+			index = index < array_size ? index + 1 : 0;
+		} else {
+			uint8_t *t = rb_read(&rb, 1);
+			if (t == NULL) {
+				invalid_stream(L,&rb);
+			}
+			if ((*t & 7) == TYPE_NIL) {
+				lua_pushinteger(L, -1);
+				lua_replace(L, lua_upvalueindex(2));
+				return 0;
+			}
+			push_value(L, &rb, *t & 7, *t >> 3);
+			push_lazy(L, &rb, 1);
+		}
+		if (!lua_isnil(L, -1)) {
+			break;
+		}
+		// skip nil in array part
+		lua_pop(L, 2);
+	}
+	lua_pushinteger(L, index);
+	lua_replace(L, lua_upvalueindex(3));
+	lua_pushinteger(L, ptr + rb.ptr);
+	lua_replace(L, lua_upvalueindex(2));
+	return 2;
+}
+
+static int
+lview_pairs(lua_State *L) {
+	struct seri_view * v = luaL_checkudata(L, 1, SERI_VIEW);
+	struct read_block rb;
+	int array_size = view_begin(L, v, &rb);
+	lua_pushvalue(L, 1);
+	lua_pushinteger(L, rb.ptr);
+	lua_pushinteger(L, array_size > 0 ? 1 : 0);
+	lua_pushinteger(L, array_size);
+	lua_pushcclosure(L, lview_next, 4);
+	return 1;
+}
+
+static int
+lview_tostring(lua_State *L) {
+	struct seri_view * v = luaL_checkudata(L, 1, SERI_VIEW);
+	lua_pushfstring(L, "seriview: %p (%d bytes)", v->ptr, v->sz);
+	return 1;
+}
+
+static void
+view_metatable(lua_State *L) {
+	if (luaL_newmetatable(L, SERI_VIEW)) {
+		luaL_Reg l[] = {
+			{ "__index", lview_index },
+			{ "__len", lview_len },
+			{ "__pairs", lview_pairs },
+			{ "__tostring", lview_tostring },
+			{ NULL, NULL },
+		};
+		luaL_setfuncs(L, l, 0);
+	}
+	lua_pop(L, 1);
+}
+
+int
+luaseri_lazyunpack(lua_State *L) {
+	if (lua_isnoneornil(L,1)) {
+		return 0;
+	}
+	void * buffer;
+	int len;
+	if (lua_type(L,1) == LUA_TSTRING) {
+		size_t sz;
+		buffer = (void *)lua_tolstring(L,1,&sz);
+		len = (int)sz;
+	} else {
+		buffer = lua_touserdata(L,1);
+		len = luaL_checkinteger(L,2);
+	}
+	if (len == 0) {
+		return 0;
+	}
+	if (buffer == NULL) {
+		return luaL_error(L, "deserialize null pointer");
+	}
+	if (*(uint8_t *)buffer == REF_HEADER) {
+		// The views need the stream without string references (see luaseri_stringref), unpack it fully.
+		return luaseri_unpack(L);
+	}
+	view_metatable(L);
+	lua_settop(L,1);
+	struct read_block rb;
+	rball_init(&rb, buffer, len);
+	int blob = 0;
+	int i;
+	for (i=0;;i++) {
+		if (i%8==7) {
+			luaL_checkstack(L,LUA_MINSTACK,NULL);
+		}
+		uint8_t *t = rb_read(&rb, 1);
+		if (t==NULL)
+			break;
+		int type = *t & 7;
+		if (type == TYPE_TABLE) {
+			if (blob == 0) {
+				// copy the rest of the message for the views, the message is freed after dispatch
+				int offset = rb.ptr - 1;
+				int rest = rb.len + 1;
+				char * copy = lua_newuserdata(L, rest);
+				memcpy(copy, rb.buffer + offset, rest);
+				rball_init(&rb, copy, rest);
+				rb_read(&rb, 1);
+				lua_insert(L, 1);
+				blob = 1;
+			}
+			push_view(L, &rb, *t >> 3, blob);
+		} else {
+			push_value(L, &rb, type, *t >> 3);
+		}
+	}
+	if (blob) {
+		lua_remove(L, 1);
+	}
+	return lua_gettop(L) - 1;
+}
+
+/*
+	boolean enable
+
+	Enable or disable (default) string references in luaseri_pack of this lua state.
+	Enable it only when all the receivers can unpack them, and the messages are not read by luaseri_lazyunpack :
+	the views need the streams without references, it unpacks the tables fully otherwise.
+ */
+int
+luaseri_stringref(lua_State *L) {
+	if (lua_toboolean(L, 1)) {
+		lua_pushboolean(L, 1);
+	} else {
+		lua_pushnil(L);
+	}
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &REF_ENABLE);
+	return 0;
+}
+
+/*
+	userdata view
+
+	return the table fully unpacked
+ */
+int
+luaseri_viewtable(lua_State *L) {
+	struct seri_view * v = luaL_testudata(L, 1, SERI_VIEW);
+	if (v == NULL) {
+		if (lua_istable(L, 1)) {
+			lua_settop(L, 1);
+			return 1;
+		}
+		return luaL_argerror(L, 1, "need a table or a lazy table");
+	}
+	struct read_block rb;
+	rball_init(&rb, (char *)v->ptr, v->sz);
+	unpack_one(L, &rb);
+	return 1;
+}
+
 LUAMOD_API int
 luaseri_pack(lua_State *L) {
-	struct block temp;
-	temp.next = NULL;
 	struct write_block wb;
-	wb_init(&wb, &temp);
+	wb_init(&wb, estimate_size(L, 0) + 1);
+	int enable = lua_rawgetp(L, LUA_REGISTRYINDEX, &REF_ENABLE) != LUA_TNIL;
+	lua_pop(L, 1);
+	if (enable) {
+		wb.ref = 1;
+		wb.gen = ++REF_GEN;
+		if (wb.gen == 0) {
+			// slots of generation 0 are never used
+			wb.gen = ++REF_GEN;
+		}
+		wb.len = 1;
+	}
 	pack_from(L,&wb,0);
-	assert(wb.head == &temp);
-	seri(L, &temp, wb.len);
+	if (wb.ref) {
+		if (wb.ref_used) {
+			wb.buffer[0] = REF_HEADER;
+		} else {
+			// the same as the format without string references
+			memmove(wb.buffer, wb.buffer + 1, wb.len - 1);
+			--wb.len;
+		}
+	}
 
-	wb_free(&wb);
+	lua_pushlightuserdata(L, wb.buffer);
+	lua_pushinteger(L, wb.len);
 
 	return 2;
 }
@@ -5,5 +5,8 @@
 
 int luaseri_pack(lua_State *L);
 int luaseri_unpack(lua_State *L);
+int luaseri_lazyunpack(lua_State *L);
+int luaseri_viewtable(lua_State *L);
+int luaseri_stringref(lua_State *L);
 
 #endif
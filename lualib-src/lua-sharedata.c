@@ -5,7 +5,12 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "atomic.h"
 
 #define KEYTYPE_INTEGER 0
@@ -18,6 +23,14 @@
 #define VALUETYPE_TABLE 4
 #define VALUETYPE_INTEGER 5
 
+// The array part of all integers (or all floats) is stored as a packed column without arraytype
+#define COLUMN_NONE 0
+#define COLUMN_INT8 1
+#define COLUMN_INT16 2
+#define COLUMN_INT32 3
+#define COLUMN_INT64 4
+#define COLUMN_REAL 5
+
 struct table;
 
 union value {
@@ -38,19 +51,71 @@ struct node {
 	uint8_t nocolliding;	// 0 means colliding slot
 };
 
+struct pstring {
+	const char * str;
+	size_t sz;
+};
+
 struct state {
 	int dirty;
 	int ref;
 	struct table * root;
+	struct pstring * strings;	// interned strings of the state, index by the string index
 };
 
 struct table {
 	int sizearray;
 	int sizehash;
+	int coltype;	// COLUMN_* , the array is a packed column if not COLUMN_NONE
 	uint8_t *arraytype;
 	union value * array;
 	struct node * hash;
+	int sizedisp;
+	int32_t * disp;	// displacements of the minimal perfect hash, or NULL (use node.next)
+	struct pstring * strings;	// interned strings of L
 	lua_State * L;
+	int ref;	// owners of this node, unchanged subtrees are shared between versions
+	struct image * image;	// not NULL if the table is mapped from a snapshot file
+};
+
+/*
+	The snapshot file (see lsaveconf) is position-independent :
+
+	struct image_header
+	struct image_table [ntables]	// the root is the first one
+	arraytype, array, hash, disp of each table (8 bytes aligned)
+	strings : (uint32_t size, bytes, '\0') ...
+
+	The string key and value are the offset in strings, the table value is the index of image_table.
+ */
+
+#define IMAGE_MAGIC "SKSD"
+
+struct image_header {
+	char magic[4];
+	uint32_t nodesize;
+	uint32_t ntables;
+	uint32_t reserved;
+	uint64_t strings;
+	uint64_t size;
+};
+
+struct image_table {
+	int32_t sizearray;
+	int32_t sizehash;
+	int32_t sizedisp;
+	int32_t coltype;
+	uint64_t arraytype;
+	uint64_t array;
+	uint64_t hash;
+	uint64_t disp;
+};
+
+struct image {
+	void * base;
+	size_t size;
+	const char * strings;
+	struct table * tables;	// headers of the mapped tables, share the L of the root
 };
 
 struct context {
@@ -64,6 +129,56 @@ struct ctrl {
 	struct table * update;
 };
 
+static inline const char *
+getstring(struct table *tbl, int index, size_t *sz) {
+	if (tbl->strings) {
+		struct pstring *s = &tbl->strings[index];
+		*sz = s->sz;
+		return s->str;
+	}
+	if (tbl->image) {
+		const char * str = tbl->image->strings + index;
+		*sz = *(const uint32_t *)str;
+		return str + sizeof(uint32_t);
+	}
+	return lua_tolstring(tbl->L, index, sz);
+}
+
+static const int column_size[] = { sizeof(union value), 1, 2, 4, 8, sizeof(lua_Number) };
+
+// the value of the array part [index] (base 0), return the value type
+static inline uint8_t
+arrayvalue(struct table *tbl, int index, union value *v) {
+	switch (tbl->coltype) {
+	case COLUMN_INT8:
+		v->d = ((int8_t *)tbl->array)[index];
+		return VALUETYPE_INTEGER;
+	case COLUMN_INT16:
+		v->d = ((int16_t *)tbl->array)[index];
+		return VALUETYPE_INTEGER;
+	case COLUMN_INT32:
+		v->d = ((int32_t *)tbl->array)[index];
+		return VALUETYPE_INTEGER;
+	case COLUMN_INT64:
+		v->d = ((int64_t *)tbl->array)[index];
+		return VALUETYPE_INTEGER;
+	case COLUMN_REAL:
+		v->n = ((lua_Number *)tbl->array)[index];
+		return VALUETYPE_REAL;
+	default:
+		*v = tbl->array[index];
+		return tbl->arraytype[index];
+	}
+}
+
+static inline struct table *
+gettable(struct table *tbl, union value *v) {
+	if (tbl->image) {
+		return &tbl->image->tables[v->d];
+	}
+	return v->tbl;
+}
+
 static int
 countsize(lua_State *L, int sizearray) {
 	int n = 0;
@@ -121,6 +236,57 @@ stringindex(struct context *ctx, const char * str, size_t sz) {
 
 static int convtable(lua_State *L);
 
+// the number of struct table use the string pool L, stored in the extra space of L
+static inline int *
+tablecount(lua_State *L) {
+	return (int *)lua_getextraspace(L);
+}
+
+static struct table *
+newtable(struct context *ctx) {
+	struct table * tbl = (struct table *)malloc(sizeof(struct table));
+	if (tbl == NULL) {
+		return NULL;
+	}
+	memset(tbl, 0, sizeof(struct table));
+	tbl->L = ctx->L;
+	tbl->ref = 1;
+	++*tablecount(ctx->L);
+	return tbl;
+}
+
+static struct node * lookup_key(struct table *tbl, uint32_t keyhash, int key, int keytype, const char *str, size_t sz);
+
+// the sub table of the old version at the key (in L's keyindex), or NULL
+static struct table *
+oldtable(lua_State *L, struct table *tbl, int keyindex) {
+	uint32_t keyhash;
+	int key = 0;
+	int keytype;
+	size_t sz = 0;
+	const char * str = NULL;
+	if (lua_type(L, keyindex) == LUA_TNUMBER) {
+		key = (int)lua_tointeger(L, keyindex);
+		if (key > 0 && key <= tbl->sizearray) {
+			--key;
+			if (tbl->coltype != COLUMN_NONE || tbl->arraytype[key] != VALUETYPE_TABLE)
+				return NULL;
+			return gettable(tbl, &tbl->array[key]);
+		}
+		keytype = KEYTYPE_INTEGER;
+		keyhash = (uint32_t)key;
+	} else {
+		str = lua_tolstring(L, keyindex, &sz);
+		keyhash = calchash(str, sz);
+		keytype = KEYTYPE_STRING;
+	}
+	struct node *n = lookup_key(tbl, keyhash, key, keytype, str, sz);
+	if (n && n->valuetype == VALUETYPE_TABLE) {
+		return gettable(tbl, &n->v);
+	}
+	return NULL;
+}
+
 static void
 setvalue(struct context * ctx, lua_State *L, int index, struct node *n) {
 	int vt = lua_type(L, index);
@@ -149,21 +315,52 @@ setvalue(struct context * ctx, lua_State *L, int index, struct node *n) {
 		n->valuetype = VALUETYPE_BOOLEAN;
 		break;
 	case LUA_TTABLE: {
+		int absidx = lua_absindex(L, index);
+		struct table *old = NULL;
+		if (lua_type(L, 4) == LUA_TTABLE) {
+			// patch : the key is below the value, the old version at 3, the changed keys at 4
+			old = oldtable(L, lua_touserdata(L, 3), absidx - 1);
+			lua_pushvalue(L, absidx - 1);
+			int mark = lua_rawget(L, 4);
+			if (old && mark == LUA_TNIL) {
+				// unchanged, share the sub table with the old version
+				lua_pop(L, 1);
+				if (old->image) {
+					// the mapped tables are released with the image
+					++*tablecount(old->L);
+				} else {
+					++old->ref;
+				}
+				n->v.tbl = old;
+				n->valuetype = VALUETYPE_TABLE;
+				break;
+			}
+			if (old == NULL || mark != LUA_TTABLE) {
+				// new or replaced sub table
+				old = NULL;
+				lua_pop(L, 1);
+				lua_pushnil(L);
+			}
+		} else {
+			lua_pushnil(L);
+		}
+		// the changed keys of this sub table (or nil) is at the top
 		struct table *tbl = ctx->tbl;
-		ctx->tbl = (struct table *)malloc(sizeof(struct table));
+		ctx->tbl = newtable(ctx);
 		if (ctx->tbl == NULL) {
 			ctx->tbl = tbl;
 			luaL_error(L, "memory error");
 			// never get here
 		}
-		memset(ctx->tbl, 0, sizeof(struct table));
-		int absidx = lua_absindex(L, index);
 
 		lua_pushcfunction(L, convtable);
 		lua_pushvalue(L, absidx);
 		lua_pushlightuserdata(L, ctx);
+		lua_pushlightuserdata(L, old);
+		lua_pushvalue(L, -5);
 
-		lua_call(L, 2, 0);
+		lua_call(L, 4, 0);
+		lua_pop(L, 1);
 
 		n->v.tbl = ctx->tbl;
 		n->valuetype = VALUETYPE_TABLE;
@@ -181,8 +378,12 @@ setvalue(struct context * ctx, lua_State *L, int index, struct node *n) {
 static void
 setarray(struct context *ctx, lua_State *L, int index, int key) {
 	struct node n;
-	setvalue(ctx, L, index, &n);
 	struct table *tbl = ctx->tbl;
+	if (tbl->coltype != COLUMN_NONE) {
+		// filled by fillcolumn
+		return;
+	}
+	setvalue(ctx, L, index, &n);
 	--key;	// base 0
 	tbl->arraytype[key] = n.valuetype;
 	tbl->array[key] = n.v;
@@ -253,6 +454,7 @@ fillcolliding(lua_State *L, struct context *ctx) {
 				for (i=emptyslot;i<sizehash;i++) {
 					if (tbl->hash[i].valuetype == VALUETYPE_NIL) {
 						n = &tbl->hash[i];
+						emptyslot = i + 1;
 						break;
 					}
 				}
@@ -271,30 +473,280 @@ fillcolliding(lua_State *L, struct context *ctx) {
 	}
 }
 
+static inline uint32_t
+phash(uint32_t h, uint32_t seed) {
+	h ^= seed;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+// map h to [0, n) by multiply and shift, cheaper than modulo
+static inline int
+phrange(uint32_t h, int n) {
+	return (int)(((uint64_t)h * (uint32_t)n) >> 32);
+}
+
+// the slot of keyhash in the minimal perfect hash
+static inline int
+phslot(struct table *tbl, uint32_t keyhash) {
+	int32_t d = tbl->disp[phrange(phash(keyhash, 0), tbl->sizedisp)];
+	if (d < 0) {
+		return -d - 1;
+	}
+	return phrange(phash(keyhash, d), tbl->sizehash);
+}
+
+#define PHASH_KEYS_PER_BUCKET 4
+#define PHASH_MAXSEED 0x10000
+
+struct phbucket {
+	int index;
+	int n;
+	int first;	// first key in the sorted keys
+};
+
+static int
+compare_bucket(const void *a, const void *b) {
+	const struct phbucket *ba = a;
+	const struct phbucket *bb = b;
+	if (ba->n != bb->n) {
+		return bb->n - ba->n;
+	}
+	return ba->index - bb->index;
+}
+
+static int
+compare_uint32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return x < y ? -1 : (x > y);
+}
+
+// placing the bucket (the hashes of the keys in h) with seed d, return 0 if any slot collides
+static int
+place_bucket(uint32_t *h, int n, uint32_t d, int sizehash, uint8_t *used, int *slot) {
+	int i, j;
+	for (i=0;i<n;i++) {
+		slot[i] = phrange(phash(h[i], d), sizehash);
+		if (used[slot[i]]) {
+			return 0;
+		}
+		for (j=0;j<i;j++) {
+			if (slot[j] == slot[i]) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+static int
+phash_layout(struct table *tbl, uint32_t *keys, struct phbucket *b, uint8_t *used, int *slot, struct node *hash) {
+	int sizehash = tbl->sizehash;
+	int sizedisp = tbl->sizedisp;
+	int i,j;
+	// keys are the hashes, all different
+	for (i=0;i<sizehash;i++) {
+		keys[i] = tbl->hash[i].keyhash;
+	}
+	qsort(keys, sizehash, sizeof(uint32_t), compare_uint32);
+	for (i=1;i<sizehash;i++) {
+		if (keys[i] == keys[i-1]) {
+			return 0;
+		}
+	}
+	for (i=0;i<sizedisp;i++) {
+		b[i].index = i;
+		b[i].n = 0;
+	}
+	for (i=0;i<sizehash;i++) {
+		++b[phrange(phash(keys[i], 0), sizedisp)].n;
+	}
+	// group the keys by bucket
+	int first = 0;
+	for (i=0;i<sizedisp;i++) {
+		b[i].first = first;
+		first += b[i].n;
+		b[i].n = 0;
+	}
+	uint32_t * grouped = (uint32_t *)slot + sizehash;
+	for (i=0;i<sizehash;i++) {
+		struct phbucket *bk = &b[phrange(phash(keys[i], 0), sizedisp)];
+		grouped[bk->first + bk->n++] = keys[i];
+	}
+	// the biggest bucket first
+	qsort(b, sizedisp, sizeof(struct phbucket), compare_bucket);
+	int freeslot = 0;
+	for (i=0;i<sizedisp;i++) {
+		struct phbucket *bk = &b[i];
+		uint32_t *h = &grouped[bk->first];
+		if (bk->n == 0) {
+			tbl->disp[bk->index] = 0;
+			continue;
+		}
+		if (bk->n == 1) {
+			// use the free slot directly
+			while (used[freeslot]) {
+				++freeslot;
+			}
+			tbl->disp[bk->index] = -freeslot - 1;
+			slot[0] = freeslot;
+		} else {
+			uint32_t d;
+			for (d=1;d<PHASH_MAXSEED;d++) {
+				if (place_bucket(h, bk->n, d, sizehash, used, slot)) {
+					break;
+				}
+			}
+			if (d == PHASH_MAXSEED) {
+				return 0;
+			}
+			tbl->disp[bk->index] = d;
+		}
+		for (j=0;j<bk->n;j++) {
+			used[slot[j]] = 1;
+		}
+	}
+	// move the nodes into their slots
+	for (i=0;i<sizehash;i++) {
+		struct node *n = &tbl->hash[i];
+		struct node *to = &hash[phslot(tbl, n->keyhash)];
+		*to = *n;
+		to->next = -1;
+		to->nocolliding = 1;
+	}
+	return 1;
+}
+
+// Build the minimal perfect hash, a lookup is a single probe then. Keep the chained hash if failed.
+static void
+buildphash(struct table *tbl) {
+	int sizehash = tbl->sizehash;
+	int sizedisp = (sizehash + PHASH_KEYS_PER_BUCKET - 1) / PHASH_KEYS_PER_BUCKET;
+	uint32_t *keys = malloc(sizehash * sizeof(uint32_t));
+	struct phbucket *b = malloc(sizedisp * sizeof(struct phbucket));
+	uint8_t *used = malloc(sizehash);
+	int *slot = malloc(sizehash * 2 * sizeof(int));	// slot of bucket and the grouped keys
+	struct node *hash = malloc(sizehash * sizeof(struct node));
+	tbl->disp = malloc(sizedisp * sizeof(int32_t));
+	tbl->sizedisp = sizedisp;
+	if (keys && b && used && slot && hash && tbl->disp) {
+		memset(used, 0, sizehash);
+		if (phash_layout(tbl, keys, b, used, slot, hash)) {
+			free(tbl->hash);
+			tbl->hash = hash;
+			hash = NULL;
+		}
+	}
+	if (hash) {
+		free(hash);
+		free(tbl->disp);
+		tbl->disp = NULL;
+		tbl->sizedisp = 0;
+	}
+	free(keys);
+	free(b);
+	free(used);
+	free(slot);
+}
+
+// the column type of the array part (1 .. sizearray) in table 1
+static int
+columntype(lua_State *L, int sizearray) {
+	int i;
+	int isint = 0;
+	lua_Integer min = 0, max = 0;
+	for (i=1;i<=sizearray;i++) {
+		if (lua_rawgeti(L, 1, i) != LUA_TNUMBER) {
+			lua_pop(L, 1);
+			return COLUMN_NONE;
+		}
+		int integer = lua_isinteger(L, -1);
+		if (i == 1) {
+			isint = integer;
+		} else if (isint != integer) {
+			lua_pop(L, 1);
+			return COLUMN_NONE;
+		}
+		if (integer) {
+			lua_Integer v = lua_tointeger(L, -1);
+			if (i == 1 || v < min)
+				min = v;
+			if (i == 1 || v > max)
+				max = v;
+		}
+		lua_pop(L, 1);
+	}
+	if (!isint)
+		return COLUMN_REAL;
+	if (min >= INT8_MIN && max <= INT8_MAX)
+		return COLUMN_INT8;
+	if (min >= INT16_MIN && max <= INT16_MAX)
+		return COLUMN_INT16;
+	if (min >= INT32_MIN && max <= INT32_MAX)
+		return COLUMN_INT32;
+	return COLUMN_INT64;
+}
+
+static void
+fillcolumn(lua_State *L, struct table *tbl) {
+	int i;
+	for (i=0;i<tbl->sizearray;i++) {
+		lua_rawgeti(L, 1, i+1);
+		switch (tbl->coltype) {
+		case COLUMN_INT8:
+			((int8_t *)tbl->array)[i] = (int8_t)lua_tointeger(L, -1);
+			break;
+		case COLUMN_INT16:
+			((int16_t *)tbl->array)[i] = (int16_t)lua_tointeger(L, -1);
+			break;
+		case COLUMN_INT32:
+			((int32_t *)tbl->array)[i] = (int32_t)lua_tointeger(L, -1);
+			break;
+		case COLUMN_INT64:
+			((int64_t *)tbl->array)[i] = (int64_t)lua_tointeger(L, -1);
+			break;
+		case COLUMN_REAL:
+			((lua_Number *)tbl->array)[i] = lua_tonumber(L, -1);
+			break;
+		}
+		lua_pop(L, 1);
+	}
+}
+
 // table need convert
 // struct context * ctx
+// struct table * old version (optional, for patch)
+// table changed keys of the old version (optional, for patch)
 static int
 convtable(lua_State *L) {
 	int i;
 	struct context *ctx = lua_touserdata(L,2);
 	struct table *tbl = ctx->tbl;
 
-	tbl->L = ctx->L;
-
 	int sizearray = lua_rawlen(L, 1);
 	if (sizearray) {
-		tbl->arraytype = (uint8_t *)malloc(sizearray * sizeof(uint8_t));
-		if (tbl->arraytype == NULL) {
-			goto memerror;
-		}
-		for (i=0;i<sizearray;i++) {
-			tbl->arraytype[i] = VALUETYPE_NIL;
+		tbl->coltype = columntype(L, sizearray);
+		if (tbl->coltype == COLUMN_NONE) {
+			tbl->arraytype = (uint8_t *)malloc(sizearray * sizeof(uint8_t));
+			if (tbl->arraytype == NULL) {
+				goto memerror;
+			}
+			for (i=0;i<sizearray;i++) {
+				tbl->arraytype[i] = VALUETYPE_NIL;
+			}
 		}
-		tbl->array = (union value *)malloc(sizearray * sizeof(union value));
+		tbl->array = (union value *)malloc(sizearray * column_size[tbl->coltype]);
 		if (tbl->array == NULL) {
 			goto memerror;
 		}
 		tbl->sizearray = sizearray;
+		if (tbl->coltype != COLUMN_NONE) {
+			fillcolumn(L, tbl);
+		}
 	}
 	int sizehash = countsize(L, sizearray);
 	if (sizehash) {
@@ -310,12 +762,15 @@ convtable(lua_State *L) {
 
 		fillnocolliding(L, ctx);
 		fillcolliding(L, ctx);
+		buildphash(tbl);
 	} else {
 		int i;
 		for (i=1;i<=sizearray;i++) {
+			// setvalue needs the key below the value
+			lua_pushinteger(L, i);
 			lua_rawgeti(L, 1, i);
 			setarray(ctx, L, -1, i);
-			lua_pop(L,1);
+			lua_pop(L,2);
 		}
 	}
 
@@ -325,22 +780,50 @@ memerror:
 }
 
 static void
-delete_tbl(struct table *tbl) {
+release_image(struct image *img) {
+	lua_State *L = img->tables[0].L;
+	if (--*tablecount(L) > 0) {
+		return;
+	}
+	munmap(img->base, img->size);
+	free(img->tables);
+	free(img);
+	lua_close(L);
+}
+
+// The string pool of a table is closed with its last table, except the pool closing (in error)
+static void
+delete_tbl(struct table *tbl, lua_State *closing) {
 	int i;
-	for (i=0;i<tbl->sizearray;i++) {
+	if (tbl->image) {
+		release_image(tbl->image);
+		return;
+	}
+	if (--tbl->ref > 0) {
+		// shared by another version
+		return;
+	}
+	for (i=0;tbl->arraytype && i<tbl->sizearray;i++) {
 		if (tbl->arraytype[i] == VALUETYPE_TABLE) {
-			delete_tbl(tbl->array[i].tbl);
+			delete_tbl(tbl->array[i].tbl, closing);
 		}
 	}
 	for (i=0;i<tbl->sizehash;i++) {
 		if (tbl->hash[i].valuetype == VALUETYPE_TABLE) {
-			delete_tbl(tbl->hash[i].v.tbl);
+			delete_tbl(tbl->hash[i].v.tbl, closing);
 		}
 	}
+	lua_State *L = tbl->L;
 	free(tbl->arraytype);
 	free(tbl->array);
 	free(tbl->hash);
+	free(tbl->disp);
 	free(tbl);
+	if (L != closing && --*tablecount(L) == 0) {
+		struct state * s = lua_touserdata(L, 1);
+		free(s->strings);
+		lua_close(L);
+	}
 }
 
 static int
@@ -358,8 +841,11 @@ pconv(lua_State *L) {
 	lua_pushcfunction(pL, convtable);
 	lua_pushvalue(pL,1);
 	lua_pushlightuserdata(pL, ctx);
+	// old version and changed keys for patch, or nil
+	lua_pushvalue(pL,2);
+	lua_pushvalue(pL,3);
 
-	ret = lua_pcall(pL, 2, 0, 0);
+	ret = lua_pcall(pL, 4, 0, 0);
 	if (ret != LUA_OK) {
 		size_t sz = 0;
 		const char * error = lua_tolstring(pL, -1, &sz);
@@ -374,6 +860,27 @@ pconv(lua_State *L) {
 	return 1;
 }
 
+// set the interned strings to the new tables (of L)
+static void
+setstrings(struct table *tbl, lua_State *L, struct pstring *strings) {
+	int i;
+	if (tbl->L != L) {
+		// shared with the old version
+		return;
+	}
+	tbl->strings = strings;
+	for (i=0;tbl->arraytype && i<tbl->sizearray;i++) {
+		if (tbl->arraytype[i] == VALUETYPE_TABLE) {
+			setstrings(tbl->array[i].tbl, L, strings);
+		}
+	}
+	for (i=0;i<tbl->sizehash;i++) {
+		if (tbl->hash[i].valuetype == VALUETYPE_TABLE) {
+			setstrings(tbl->hash[i].v.tbl, L, strings);
+		}
+	}
+}
+
 static void
 convert_stringmap(struct context *ctx, struct table *tbl) {
 	lua_State *L = ctx->L;
@@ -384,6 +891,7 @@ convert_stringmap(struct context *ctx, struct table *tbl) {
 	s->dirty = 0;
 	s->ref = 0;
 	s->root = tbl;
+	s->strings = NULL;
 	lua_replace(L, 1);
 	lua_replace(L, -2);
 
@@ -399,14 +907,24 @@ convert_stringmap(struct context *ctx, struct table *tbl) {
 	lua_pop(L, 1);
 
 	lua_gc(L, LUA_GCCOLLECT, 0);
+
+	// the strings are kept in the stack, so the pointers are stable
+	struct pstring * strings = malloc((ctx->string_index + 1) * sizeof(struct pstring));
+	if (strings) {
+		int i;
+		for (i=2;i<=ctx->string_index;i++) {
+			strings[i].str = lua_tolstring(L, i, &strings[i].sz);
+		}
+		s->strings = strings;
+		setstrings(tbl, L, strings);
+	}
 }
 
 static int
-lnewconf(lua_State *L) {
+newconf(lua_State *L) {
 	int ret;
 	struct context ctx;
 	struct table * tbl = NULL;
-	luaL_checktype(L,1,LUA_TTABLE);
 	ctx.L = luaL_newstate();
 	ctx.tbl = NULL;
 	ctx.string_index = 1;	// 1 reserved for dirty flag
@@ -414,7 +932,8 @@ lnewconf(lua_State *L) {
 		lua_pushliteral(L, "memory error");
 		goto error;
 	}
-	tbl = (struct table *)malloc(sizeof(struct table));
+	*tablecount(ctx.L) = 0;
+	tbl = newtable(&ctx);
 	if (tbl == NULL) {
 		// lua_pushliteral may fail because of memory error, close first.
 		lua_close(ctx.L);
@@ -422,7 +941,6 @@ lnewconf(lua_State *L) {
 		lua_pushliteral(L, "memory error");
 		goto error;
 	}
-	memset(tbl, 0, sizeof(struct table));
 	ctx.tbl = tbl;
 
 	lua_pushcfunction(ctx.L, pconv);
@@ -444,16 +962,26 @@ lnewconf(lua_State *L) {
 
 	return 1;
 error:
+	if (tbl) {
+		delete_tbl(tbl, ctx.L);
+	}
 	if (ctx.L) {
 		lua_close(ctx.L);
 	}
-	if (tbl) {
-		delete_tbl(tbl);
-	}
 	lua_error(L);
 	return -1;
 }
 
+static int
+lnewconf(lua_State *L) {
+	luaL_checktype(L,1,LUA_TTABLE);
+	lua_settop(L,1);
+	// no old version
+	lua_pushnil(L);
+	lua_pushnil(L);
+	return newconf(L);
+}
+
 static struct table *
 get_table(lua_State *L, int index) {
 	struct table *tbl = lua_touserdata(L,index);
@@ -463,16 +991,514 @@ get_table(lua_State *L, int index) {
 	return tbl;
 }
 
+/*
+	table new value
+	lightuserdata old version
+	table changed keys of the old version, { key = true } for a rebuilt sub table, { key = { ... } } for a patched one
+	return lightuserdata
+
+	Only the changed sub tables are converted, the others are shared with the old version.
+ */
+static int
+lpatchconf(lua_State *L) {
+	luaL_checktype(L,1,LUA_TTABLE);
+	get_table(L,2);
+	luaL_checktype(L,3,LUA_TTABLE);
+	lua_settop(L,3);
+	return newconf(L);
+}
+
 static int
 ldeleteconf(lua_State *L) {
 	struct table *tbl = get_table(L,1);
-	lua_close(tbl->L);
-	delete_tbl(tbl);
+	delete_tbl(tbl, NULL);
+	return 0;
+}
+
+// snapshot
+
+#define SAVE_TABLES 3
+#define SAVE_TABLELIST 4
+#define SAVE_STRINGS 5
+#define SAVE_STRINGLIST 6
+
+struct savectx {
+	int ntables;
+	int nstrings;
+	size_t strings;	// size of strings
+};
+
+static int
+savestring(lua_State *L, struct savectx *sc, struct table *tbl, int index) {
+	size_t sz = 0;
+	const char * str = getstring(tbl, index, &sz);
+	lua_pushlstring(L, str, sz);
+	if (lua_rawget(L, SAVE_STRINGS) == LUA_TNUMBER) {
+		int offset = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		return offset;
+	}
+	lua_pop(L, 1);
+	if (sc->strings + sizeof(uint32_t) + sz + 1 > 0x7fffffff) {
+		return luaL_error(L, "Too many strings");
+	}
+	int offset = (int)sc->strings;
+	lua_pushlstring(L, str, sz);
+	lua_pushvalue(L, -1);
+	lua_rawseti(L, SAVE_STRINGLIST, ++sc->nstrings);
+	lua_pushinteger(L, offset);
+	lua_rawset(L, SAVE_STRINGS);
+	sc->strings += (sizeof(uint32_t) + sz + 1 + 3) & ~3;
+	return offset;
+}
+
+static void
+collect_value(lua_State *L, struct savectx *sc, struct table *tbl, uint8_t vt, union value *v);
+
+static void
+collect_tbl(lua_State *L, struct savectx *sc, struct table *tbl) {
+	int i;
+	if (lua_rawgetp(L, SAVE_TABLES, tbl) != LUA_TNIL) {
+		lua_pop(L, 1);
+		return;
+	}
+	lua_pop(L, 1);
+	lua_pushinteger(L, sc->ntables);
+	lua_rawsetp(L, SAVE_TABLES, tbl);
+	lua_pushlightuserdata(L, tbl);
+	lua_rawseti(L, SAVE_TABLELIST, ++sc->ntables);
+	for (i=0;tbl->arraytype && i<tbl->sizearray;i++) {
+		collect_value(L, sc, tbl, tbl->arraytype[i], &tbl->array[i]);
+	}
+	for (i=0;i<tbl->sizehash;i++) {
+		struct node *n = &tbl->hash[i];
+		if (n->keytype == KEYTYPE_STRING) {
+			savestring(L, sc, tbl, n->key);
+		}
+		collect_value(L, sc, tbl, n->valuetype, &n->v);
+	}
+}
+
+static void
+collect_value(lua_State *L, struct savectx *sc, struct table *tbl, uint8_t vt, union value *v) {
+	if (vt == VALUETYPE_STRING) {
+		savestring(L, sc, tbl, v->string);
+	} else if (vt == VALUETYPE_TABLE) {
+		collect_tbl(L, sc, gettable(tbl, v));
+	}
+}
+
+static int
+saved_string(lua_State *L, struct table *tbl, int index) {
+	size_t sz = 0;
+	const char * str = getstring(tbl, index, &sz);
+	lua_pushlstring(L, str, sz);
+	lua_rawget(L, SAVE_STRINGS);
+	int offset = lua_tointeger(L, -1);
+	lua_pop(L, 1);
+	return offset;
+}
+
+static void
+save_value(lua_State *L, struct table *tbl, uint8_t vt, union value *v, union value *out) {
+	memset(out, 0, sizeof(*out));
+	switch (vt) {
+	case VALUETYPE_STRING:
+		out->string = saved_string(L, tbl, v->string);
+		break;
+	case VALUETYPE_TABLE:
+		lua_rawgetp(L, SAVE_TABLES, gettable(tbl, v));
+		out->d = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		break;
+	default:
+		*out = *v;
+		break;
+	}
+}
+
+// size of arraytype and array in snapshot
+static uint64_t
+arraysize(int coltype, int sizearray) {
+	uint64_t sz = ((uint64_t)sizearray * column_size[coltype] + 7) & ~7;
+	if (coltype == COLUMN_NONE) {
+		sz += (sizearray + 7) & ~7;
+	}
+	return sz;
+}
+
+static void
+save_tbl(lua_State *L, FILE *f, struct table *tbl) {
+	static const char padding[8] = { 0 };
+	int i;
+	if (tbl->coltype != COLUMN_NONE) {
+		size_t sz = tbl->sizearray * column_size[tbl->coltype];
+		fwrite(tbl->array, 1, sz, f);
+		fwrite(padding, 1, (8 - sz % 8) % 8, f);
+	} else {
+		fwrite(tbl->arraytype, 1, tbl->sizearray, f);
+		fwrite(padding, 1, (8 - tbl->sizearray % 8) % 8, f);
+		for (i=0;i<tbl->sizearray;i++) {
+			union value v;
+			save_value(L, tbl, tbl->arraytype[i], &tbl->array[i], &v);
+			fwrite(&v, sizeof(v), 1, f);
+		}
+	}
+	for (i=0;i<tbl->sizehash;i++) {
+		struct node *n = &tbl->hash[i];
+		struct node tmp;
+		memset(&tmp, 0, sizeof(tmp));
+		save_value(L, tbl, n->valuetype, &n->v, &tmp.v);
+		tmp.key = n->keytype == KEYTYPE_STRING ? saved_string(L, tbl, n->key) : n->key;
+		tmp.next = n->next;
+		tmp.keyhash = n->keyhash;
+		tmp.keytype = n->keytype;
+		tmp.valuetype = n->valuetype;
+		tmp.nocolliding = n->nocolliding;
+		fwrite(&tmp, sizeof(tmp), 1, f);
+	}
+	fwrite(tbl->disp, sizeof(int32_t), tbl->sizedisp, f);
+	fwrite(padding, 1, tbl->sizedisp % 2 * sizeof(int32_t), f);
+}
+
+/*
+	lightuserdata conf
+	string filename
+
+	Save the conf into a position-independent snapshot file, which can be mapped by lmapconf.
+ */
+static int
+lsaveconf(lua_State *L) {
+	struct table *root = get_table(L,1);
+	const char * filename = luaL_checkstring(L, 2);
+	struct savectx sc = { 0, 0, 0 };
+	int i;
+	lua_settop(L, 2);
+	lua_newtable(L);	// SAVE_TABLES
+	lua_newtable(L);	// SAVE_TABLELIST
+	lua_newtable(L);	// SAVE_STRINGS
+	lua_newtable(L);	// SAVE_STRINGLIST
+	collect_tbl(L, &sc, root);
+
+	struct image_header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, IMAGE_MAGIC, sizeof(h.magic));
+	h.nodesize = sizeof(struct node);
+	h.ntables = sc.ntables;
+	uint64_t offset = sizeof(h) + sc.ntables * sizeof(struct image_table);
+	for (i=1;i<=sc.ntables;i++) {
+		lua_rawgeti(L, SAVE_TABLELIST, i);
+		struct table *tbl = lua_touserdata(L, -1);
+		lua_pop(L, 1);
+		offset += arraysize(tbl->coltype, tbl->sizearray);
+		offset += tbl->sizehash * sizeof(struct node);
+		offset += (tbl->sizedisp * sizeof(int32_t) + 7) & ~7;
+	}
+	h.strings = offset;
+	h.size = offset + sc.strings;
+
+	// Write a temporary file in the same directory and rename it to filename at last.
+	// The old file may be mapped by lmapconf (MAP_SHARED), truncating it in place raises SIGBUS in the readers.
+	size_t len = strlen(filename);
+	char * tmpname = lua_newuserdata(L, len + sizeof(".XXXXXX"));
+	memcpy(tmpname, filename, len);
+	memcpy(tmpname + len, ".XXXXXX", sizeof(".XXXXXX"));
+	int fd = mkstemp(tmpname);
+	if (fd < 0) {
+		return luaL_error(L, "Can't write %s", filename);
+	}
+	fchmod(fd, 0644);
+	FILE *f = fdopen(fd, "wb");
+	if (f == NULL) {
+		close(fd);
+		unlink(tmpname);
+		return luaL_error(L, "Can't write %s", filename);
+	}
+	fwrite(&h, sizeof(h), 1, f);
+	offset = sizeof(h) + sc.ntables * sizeof(struct image_table);
+	for (i=1;i<=sc.ntables;i++) {
+		lua_rawgeti(L, SAVE_TABLELIST, i);
+		struct table *tbl = lua_touserdata(L, -1);
+		lua_pop(L, 1);
+		struct image_table desc;
+		memset(&desc, 0, sizeof(desc));
+		desc.sizearray = tbl->sizearray;
+		desc.sizehash = tbl->sizehash;
+		desc.sizedisp = tbl->sizedisp;
+		desc.coltype = tbl->coltype;
+		desc.arraytype = offset;
+		if (tbl->coltype == COLUMN_NONE) {
+			offset += (tbl->sizearray + 7) & ~7;
+		}
+		desc.array = offset;
+		offset += ((uint64_t)tbl->sizearray * column_size[tbl->coltype] + 7) & ~7;
+		desc.hash = offset;
+		offset += tbl->sizehash * sizeof(struct node);
+		desc.disp = offset;
+		offset += (tbl->sizedisp * sizeof(int32_t) + 7) & ~7;
+		fwrite(&desc, sizeof(desc), 1, f);
+	}
+	for (i=1;i<=sc.ntables;i++) {
+		lua_rawgeti(L, SAVE_TABLELIST, i);
+		struct table *tbl = lua_touserdata(L, -1);
+		lua_pop(L, 1);
+		save_tbl(L, f, tbl);
+	}
+	for (i=1;i<=sc.nstrings;i++) {
+		static const char padding[4] = { 0 };
+		size_t sz = 0;
+		lua_rawgeti(L, SAVE_STRINGLIST, i);
+		const char * str = lua_tolstring(L, -1, &sz);
+		uint32_t size = (uint32_t)sz;
+		fwrite(&size, sizeof(size), 1, f);
+		fwrite(str, 1, sz + 1, f);
+		fwrite(padding, 1, (4 - (sizeof(size) + sz + 1) % 4) % 4, f);
+		lua_pop(L, 1);
+	}
+	int err = ferror(f);
+	if (fclose(f) != 0) {
+		err = 1;
+	}
+	if (err || rename(tmpname, filename) != 0) {
+		unlink(tmpname);
+		return luaL_error(L, "Write %s failed", filename);
+	}
 	return 0;
 }
 
+// [offset, offset + len) is in the tables part, don't add them (offset may be huge)
+static inline int
+check_range(const struct image_header *h, uint64_t offset, uint64_t len) {
+	return offset <= h->strings && len <= h->strings - offset;
+}
+
+static int
+check_string(const struct image_header *h, int offset) {
+	uint64_t rest = h->size - h->strings;	// size of the strings part
+	if (offset < 0 || offset % 4 != 0 || (uint64_t)offset > rest || sizeof(uint32_t) > rest - offset) {
+		return 0;
+	}
+	const char * str = (const char *)h + h->strings + offset;
+	uint32_t sz = *(const uint32_t *)str;
+	if ((uint64_t)sz + 1 > rest - offset - sizeof(uint32_t)) {
+		return 0;
+	}
+	return str[sizeof(uint32_t) + sz] == '\0';
+}
+
+static int
+check_value(const struct image_header *h, uint8_t vt, const union value *v) {
+	switch (vt) {
+	case VALUETYPE_NIL:
+	case VALUETYPE_REAL:
+	case VALUETYPE_BOOLEAN:
+	case VALUETYPE_INTEGER:
+		return 1;
+	case VALUETYPE_STRING:
+		return check_string(h, v->string);
+	case VALUETYPE_TABLE:
+		return v->d >= 0 && v->d < h->ntables;
+	default:
+		return 0;
+	}
+}
+
+// the chains of node.next must be in range and without loops, mark[] is the in-degree (at most 1)
+static int
+check_chain(const struct node *hash, int sizehash, uint8_t *mark) {
+	int i;
+	memset(mark, 0, sizehash);
+	for (i=0;i<sizehash;i++) {
+		int next = hash[i].next;
+		if (next >= sizehash || (next >= 0 && mark[next]++)) {
+			return 0;
+		}
+	}
+	// walk the chains from the heads, the nodes left are in the loops
+	for (i=0;i<sizehash;i++) {
+		if (mark[i] == 0) {
+			int n = i;
+			do {
+				mark[n] = 2;
+				n = hash[n].next;
+			} while (n >= 0);
+		}
+	}
+	for (i=0;i<sizehash;i++) {
+		if (mark[i] != 2) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int
+check_table(const struct image_header *h, const struct image_table *t, uint8_t *mark) {
+	const char * base = (const char *)h;
+	int i;
+	if (t->array % 8 != 0 || t->hash % 8 != 0 || t->disp % 8 != 0) {
+		return 0;
+	}
+	if (t->coltype == COLUMN_NONE) {
+		const uint8_t * arraytype = (const uint8_t *)(base + t->arraytype);
+		const union value * array = (const union value *)(base + t->array);
+		for (i=0;i<t->sizearray;i++) {
+			if (!check_value(h, arraytype[i], &array[i])) {
+				return 0;
+			}
+		}
+	}
+	const struct node * hash = (const struct node *)(base + t->hash);
+	for (i=0;i<t->sizehash;i++) {
+		const struct node *n = &hash[i];
+		if (n->keytype == KEYTYPE_STRING) {
+			if (!check_string(h, n->key)) {
+				return 0;
+			}
+		} else if (n->keytype != KEYTYPE_INTEGER) {
+			return 0;
+		}
+		if (!check_value(h, n->valuetype, &n->v)) {
+			return 0;
+		}
+	}
+	if (t->sizedisp > 0) {
+		const int32_t * disp = (const int32_t *)(base + t->disp);
+		for (i=0;i<t->sizedisp;i++) {
+			// a negative displacement is the slot (-d-1)
+			if (disp[i] < -t->sizehash) {
+				return 0;
+			}
+		}
+	} else if (t->sizehash > 0 && !check_chain(hash, t->sizehash, mark)) {
+		return 0;
+	}
+	return 1;
+}
+
+/*
+	Validate the snapshot before mapping, a broken (or hostile) file must not make the readers
+	access out of the mapping or loop forever : the tables, the strings and node.next are all checked.
+ */
+static int
+check_image(const struct image_header *h, size_t size) {
+	if (size < sizeof(*h) || memcmp(h->magic, IMAGE_MAGIC, sizeof(h->magic)) != 0) {
+		return 0;
+	}
+	if (h->nodesize != sizeof(struct node) || h->size != size || h->ntables == 0 || h->strings > size) {
+		return 0;
+	}
+	if ((size - sizeof(*h)) / sizeof(struct image_table) < h->ntables) {
+		return 0;
+	}
+	const struct image_table *desc = (const struct image_table *)(h+1);
+	int maxhash = 0;
+	uint32_t i;
+	for (i=0;i<h->ntables;i++) {
+		const struct image_table *t = &desc[i];
+		if (t->sizearray < 0 || t->sizehash < 0 || t->sizedisp < 0 ||
+			t->coltype < COLUMN_NONE || t->coltype > COLUMN_REAL ||
+			(t->sizehash > 0 && t->sizedisp > t->sizehash) ||
+			!check_range(h, t->arraytype, t->sizearray) ||
+			!check_range(h, t->array, (uint64_t)t->sizearray * column_size[t->coltype]) ||
+			!check_range(h, t->hash, (uint64_t)t->sizehash * sizeof(struct node)) ||
+			!check_range(h, t->disp, (uint64_t)t->sizedisp * sizeof(int32_t))) {
+			return 0;
+		}
+		if (t->sizehash > maxhash) {
+			maxhash = t->sizehash;
+		}
+	}
+	uint8_t * mark = malloc((size_t)maxhash + 1);
+	if (mark == NULL) {
+		return 0;
+	}
+	for (i=0;i<h->ntables;i++) {
+		if (!check_table(h, &desc[i], mark)) {
+			free(mark);
+			return 0;
+		}
+	}
+	free(mark);
+	return 1;
+}
+
+/*
+	string filename
+	return lightuserdata
+
+	Map a snapshot file read-only, the pages are shared by the processes mapping the same file.
+ */
+static int
+lmapconf(lua_State *L) {
+	const char * filename = luaL_checkstring(L, 1);
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return luaL_error(L, "Can't open %s", filename);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return luaL_error(L, "Can't stat %s", filename);
+	}
+	size_t size = st.st_size;
+	void * base = size > 0 ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (base == MAP_FAILED) {
+		return luaL_error(L, "Can't map %s", filename);
+	}
+	const struct image_header *h = base;
+	if (!check_image(h, size)) {
+		munmap(base, size);
+		return luaL_error(L, "Invalid snapshot %s", filename);
+	}
+	struct image * img = malloc(sizeof(*img));
+	struct table * tables = malloc(h->ntables * sizeof(struct table));
+	lua_State *sL = luaL_newstate();
+	if (img == NULL || tables == NULL || sL == NULL) {
+		free(img);
+		free(tables);
+		if (sL) {
+			lua_close(sL);
+		}
+		munmap(base, size);
+		return luaL_error(L, "memory error");
+	}
+	img->base = base;
+	img->size = size;
+	img->strings = (const char *)base + h->strings;
+	img->tables = tables;
+	const struct image_table *desc = (const struct image_table *)(h+1);
+	uint32_t i;
+	for (i=0;i<h->ntables;i++) {
+		struct table *tbl = &tables[i];
+		tbl->sizearray = desc[i].sizearray;
+		tbl->sizehash = desc[i].sizehash;
+		tbl->coltype = desc[i].coltype;
+		tbl->arraytype = tbl->coltype == COLUMN_NONE ? (uint8_t *)base + desc[i].arraytype : NULL;
+		tbl->array = (union value *)((char *)base + desc[i].array);
+		tbl->hash = (struct node *)((char *)base + desc[i].hash);
+		tbl->sizedisp = desc[i].sizedisp;
+		tbl->disp = tbl->sizedisp ? (int32_t *)((char *)base + desc[i].disp) : NULL;
+		tbl->strings = NULL;
+		tbl->L = sL;
+		tbl->ref = 1;
+		tbl->image = img;
+	}
+	// the mapped tables share one reference count (in tablecount) and the state of the root
+	*tablecount(sL) = 1;
+	struct state * s = lua_newuserdata(sL, sizeof(*s));
+	s->dirty = 0;
+	s->ref = 0;
+	s->root = &tables[0];
+	s->strings = NULL;
+
+	lua_pushlightuserdata(L, &tables[0]);
+	return 1;
+}
+
 static void
-pushvalue(lua_State *L, lua_State *sL, uint8_t vt, union value *v) {
+pushvalue(lua_State *L, struct table *tbl, uint8_t vt, union value *v) {
 	switch(vt) {
 	case VALUETYPE_REAL:
 		lua_pushnumber(L, v->n);
@@ -482,7 +1508,7 @@ pushvalue(lua_State *L, lua_State *sL, uint8_t vt, union value *v) {
 		break;
 	case VALUETYPE_STRING: {
 		size_t sz = 0;
-		const char *str = lua_tolstring(sL, v->string, &sz);
+		const char *str = getstring(tbl, v->string, &sz);
 		lua_pushlstring(L, str, sz);
 		break;
 	}
@@ -490,7 +1516,7 @@ pushvalue(lua_State *L, lua_State *sL, uint8_t vt, union value *v) {
 		lua_pushboolean(L, v->boolean);
 		break;
 	case VALUETYPE_TABLE:
-		lua_pushlightuserdata(L, v->tbl);
+		lua_pushlightuserdata(L, gettable(tbl, v));
 		break;
 	default:
 		lua_pushnil(L);
@@ -502,6 +1528,17 @@ static struct node *
 lookup_key(struct table *tbl, uint32_t keyhash, int key, int keytype, const char *str, size_t sz) {
 	if (tbl->sizehash == 0)
 		return NULL;
+	if (tbl->disp) {
+		// single probe
+		struct node *n = &tbl->hash[phslot(tbl, keyhash)];
+		if (n->keyhash != keyhash || n->keytype != keytype)
+			return NULL;
+		if (keytype == KEYTYPE_INTEGER)
+			return n->key == key ? n : NULL;
+		size_t sz2 = 0;
+		const char * str2 = getstring(tbl, n->key, &sz2);
+		return (sz == sz2 && memcmp(str,str2,sz) == 0) ? n : NULL;
+	}
 	struct node *n = &tbl->hash[keyhash % tbl->sizehash];
 	if (keyhash != n->keyhash && n->nocolliding)
 		return NULL;
@@ -515,7 +1552,7 @@ lookup_key(struct table *tbl, uint32_t keyhash, int key, int keytype, const char
 				// n->keytype == KEYTYPE_STRING
 				if (keytype == KEYTYPE_STRING) {
 					size_t sz2 = 0;
-					const char * str2 = lua_tolstring(tbl->L, n->key, &sz2);
+					const char * str2 = getstring(tbl, n->key, &sz2);
 					if (sz == sz2 && memcmp(str,str2,sz) == 0) {
 						return n;
 					}
@@ -545,7 +1582,9 @@ lindexconf(lua_State *L) {
 		key = (int)lua_tointeger(L, 2);
 		if (key > 0 && key <= tbl->sizearray) {
 			--key;
-			pushvalue(L, tbl->L, tbl->arraytype[key], &tbl->array[key]);
+			union value v;
+			uint8_t vt = arrayvalue(tbl, key, &v);
+			pushvalue(L, tbl, vt, &v);
 			return 1;
 		}
 		keytype = KEYTYPE_INTEGER;
@@ -558,7 +1597,7 @@ lindexconf(lua_State *L) {
 
 	struct node *n = lookup_key(tbl, keyhash, key, keytype, str, sz);
 	if (n) {
-		pushvalue(L, tbl->L, n->valuetype, &n->v);
+		pushvalue(L, tbl, n->valuetype, &n->v);
 		return 1;
 	} else {
 		return 0;
@@ -566,12 +1605,12 @@ lindexconf(lua_State *L) {
 }
 
 static void
-pushkey(lua_State *L, lua_State *sL, struct node *n) {
+pushkey(lua_State *L, struct table *tbl, struct node *n) {
 	if (n->keytype == KEYTYPE_INTEGER) {
 		lua_pushinteger(L, n->key);
 	} else {
 		size_t sz = 0;
-		const char * str = lua_tolstring(sL, n->key, &sz);
+		const char * str = getstring(tbl, n->key, &sz);
 		lua_pushlstring(L, str, sz);
 	}
 }
@@ -579,7 +1618,7 @@ pushkey(lua_State *L, lua_State *sL, struct node *n) {
 static int
 pushfirsthash(lua_State *L, struct table * tbl) {
 	if (tbl->sizehash) {
-		pushkey(L, tbl->L, &tbl->hash[0]);
+		pushkey(L, tbl, &tbl->hash[0]);
 		return 1;
 	} else {
 		return 0;
@@ -593,7 +1632,7 @@ lnextkey(lua_State *L) {
 		if (tbl->sizearray > 0) {
 			int i;
 			for (i=0;i<tbl->sizearray;i++) {
-				if (tbl->arraytype[i] != VALUETYPE_NIL) {
+				if (tbl->arraytype == NULL || tbl->arraytype[i] != VALUETYPE_NIL) {
 					lua_pushinteger(L, i+1);
 					return 1;
 				}
@@ -616,7 +1655,7 @@ lnextkey(lua_State *L) {
 		if (key > 0 && key <= sizearray) {
 			lua_Integer i;
 			for (i=key;i<sizearray;i++) {
-				if (tbl->arraytype[i] != VALUETYPE_NIL) {
+				if (tbl->arraytype == NULL || tbl->arraytype[i] != VALUETYPE_NIL) {
 					lua_pushinteger(L, i+1);
 					return 1;
 				}
@@ -638,7 +1677,7 @@ lnextkey(lua_State *L) {
 		if (index == tbl->sizehash) {
 			return 0;
 		}
-		pushkey(L, tbl->L, n);
+		pushkey(L, tbl, n);
 		return 1;
 	} else {
 		return 0;
@@ -659,6 +1698,148 @@ lhashlen(lua_State *L) {
 	return 1;
 }
 
+// range [i, j] of the array part from the args at index, return the count
+static int
+checkrange(lua_State *L, struct table *tbl, int index, int *from) {
+	lua_Integer i = luaL_optinteger(L, index, 1);
+	lua_Integer j = luaL_optinteger(L, index+1, tbl->sizearray);
+	if (i < 1)
+		i = 1;
+	if (j > tbl->sizearray)
+		j = tbl->sizearray;
+	*from = (int)i - 1;
+	return j < i ? 0 : (int)(j - i + 1);
+}
+
+/*
+	lightuserdata conf
+	integer i (default 1)
+	integer j (default #conf)
+	return table { conf[i], ... , conf[j] }
+ */
+static int
+lslice(lua_State *L) {
+	struct table *tbl = get_table(L,1);
+	int from;
+	int n = checkrange(L, tbl, 2, &from);
+	int i;
+	lua_createtable(L, n, 0);
+	for (i=0;i<n;i++) {
+		union value v;
+		uint8_t vt = arrayvalue(tbl, from + i, &v);
+		pushvalue(L, tbl, vt, &v);
+		lua_rawseti(L, -2, i+1);
+	}
+	return 1;
+}
+
+/*
+	lightuserdata conf
+	integer i (default 1)
+	integer j (default #conf)
+	return number conf[i] + ... + conf[j] , integer if all the values are integers
+ */
+static int
+lsum(lua_State *L) {
+	struct table *tbl = get_table(L,1);
+	int from;
+	int n = checkrange(L, tbl, 2, &from);
+	int i;
+	lua_Integer isum = 0;
+	lua_Number nsum = 0;
+	int real = 0;
+	switch (tbl->coltype) {
+	case COLUMN_INT8:
+		for (i=0;i<n;i++)
+			isum += ((int8_t *)tbl->array)[from+i];
+		break;
+	case COLUMN_INT16:
+		for (i=0;i<n;i++)
+			isum += ((int16_t *)tbl->array)[from+i];
+		break;
+	case COLUMN_INT32:
+		for (i=0;i<n;i++)
+			isum += ((int32_t *)tbl->array)[from+i];
+		break;
+	case COLUMN_INT64:
+		for (i=0;i<n;i++)
+			isum = (lua_Integer)((lua_Unsigned)isum + (lua_Unsigned)((int64_t *)tbl->array)[from+i]);
+		break;
+	case COLUMN_REAL:
+		for (i=0;i<n;i++)
+			nsum += ((lua_Number *)tbl->array)[from+i];
+		real = 1;
+		break;
+	default:
+		for (i=0;i<n;i++) {
+			union value *v = &tbl->array[from+i];
+			switch (tbl->arraytype[from+i]) {
+			case VALUETYPE_INTEGER:
+				isum = (lua_Integer)((lua_Unsigned)isum + (lua_Unsigned)v->d);
+				break;
+			case VALUETYPE_REAL:
+				nsum += v->n;
+				real = 1;
+				break;
+			default:
+				return luaL_error(L, "Invalid value [%d] to sum", from+i+1);
+			}
+		}
+		break;
+	}
+	if (real) {
+		lua_pushnumber(L, nsum + (lua_Number)isum);
+	} else {
+		lua_pushinteger(L, isum);
+	}
+	return 1;
+}
+
+// compare the number at index with the value, return <0, 0, >0
+static int
+compare_number(lua_State *L, int index, uint8_t vt, union value *v) {
+	if (vt == VALUETYPE_INTEGER && lua_isinteger(L, index)) {
+		lua_Integer a = lua_tointeger(L, index);
+		return a < v->d ? -1 : (a > v->d);
+	}
+	lua_Number a = lua_tonumber(L, index);
+	lua_Number b;
+	if (vt == VALUETYPE_INTEGER) {
+		b = (lua_Number)v->d;
+	} else if (vt == VALUETYPE_REAL) {
+		b = v->n;
+	} else {
+		return luaL_error(L, "Need a number array to search");
+	}
+	return a < b ? -1 : (a > b);
+}
+
+/*
+	lightuserdata conf (the array part is sorted in ascending order)
+	number v
+	return integer the last index k with conf[k] <= v, 0 if v < conf[1]
+ */
+static int
+lbsearch(lua_State *L) {
+	struct table *tbl = get_table(L,1);
+	luaL_checknumber(L, 2);
+	int low = 0;
+	int high = tbl->sizearray;
+	// the answer is in [low, high]
+	while (low < high) {
+		int mid = low + (high - low + 1) / 2;
+		union value v;
+		uint8_t vt = arrayvalue(tbl, mid - 1, &v);
+		if (compare_number(L, 2, vt, &v) >= 0) {
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+	}
+	lua_pushinteger(L, low);
+	return 1;
+}
+
 static int
 releaseobj(lua_State *L) {
 	struct ctrl *c = lua_touserdata(L, 1);
@@ -699,7 +1880,14 @@ lmarkdirty(lua_State *L) {
 
 static int
 lisdirty(lua_State *L) {
-	struct table *tbl = get_table(L,1);
+	struct table *tbl;
+	if (lua_type(L,1) == LUA_TUSERDATA) {
+		// the box of the root, sub tables may be shared with the older versions
+		struct ctrl * c = lua_touserdata(L, 1);
+		tbl = c->root;
+	} else {
+		tbl = get_table(L,1);
+	}
 	struct state * s = lua_touserdata(tbl->L, 1);
 	int d = s->dirty;
 	lua_pushboolean(L, d);
@@ -769,6 +1957,9 @@ luaopen_sharedata_core(lua_State *L) {
 	luaL_Reg l[] = {
 		// used by host
 		{ "new", lnewconf },
+		{ "patch", lpatchconf },
+		{ "save", lsaveconf },
+		{ "map", lmapconf },
 		{ "delete", ldeleteconf },
 		{ "markdirty", lmarkdirty },
 		{ "getref", lgetref },
@@ -781,6 +1972,9 @@ luaopen_sharedata_core(lua_State *L) {
 		{ "nextkey", lnextkey },
 		{ "len", llen },
 		{ "hashlen", lhashlen },
+		{ "slice", lslice },
+		{ "sum", lsum },
+		{ "bsearch", lbsearch },
 		{ "isdirty", lisdirty },
 		{ "needupdate", lneedupdate },
 		{ "update", lupdate },
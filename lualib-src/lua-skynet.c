@@ -405,6 +405,9 @@ luaopen_skynet_core(lua_State *L) {
 		{ "harbor", lharbor },     //判断是否远程节点 所属节点的harbor服务的handle
 		{ "pack", luaseri_pack },  //lua数据结构的序列化和反序列化  lua数据结构 ==》userdata + size
 		{ "unpack", luaseri_unpack },
+		{ "lazyunpack", luaseri_lazyunpack },	// tables are unpacked on demand
+		{ "viewtable", luaseri_viewtable },
+		{ "stringref", luaseri_stringref },
 		{ "packstring", lpackstring },////将userdata和size数据转换为lua string
 		{ "trash" , ltrash }, //释放lightuserdata
 		{ "callback", lcallback }, //设置skynet_context总的cb和cb_ud 分别为_cb何lua_state 同时记录lua_function到注册表中
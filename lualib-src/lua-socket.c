@@ -15,199 +15,239 @@
 #include <arpa/inet.h>
 
 #include "skynet_socket.h"
+#include "socket_server.h"
 
 //socketdriver.so 
 
 #define BACKLOG 32
-// 2 ** 12 == 4096
-#define LARGE_PAGE_NODE 12
-#define BUFFER_LIMIT (256 * 1024)
-
-struct buffer_node {
-	char * msg;
-	int sz;
-	struct buffer_node *next;
-};
+// Drop the storage of an empty buffer if it grows larger than this
+#define BUFFER_SHRINK (64 * 1024)
+
+/*
+	The received data of a socket is kept in one contiguous block.
 
+	[data, data + offset) has been read, [data + offset, data + offset + size) is pending,
+	and the rest of the block (up to cap) is free space for the next push.
+	When the buffer is empty, the next message is adopted directly (no copy).
+	Otherwise it is appended, the pending bytes are moved to the front or the block is
+	reallocated when there is not enough room at the tail.
+ */
 struct socket_buffer {
-	int size;
+	char * data;
+	int cap;
 	int offset;
-	struct buffer_node *head;
-	struct buffer_node *tail;
+	int size;
 };
 
-static int
-lfreepool(lua_State *L) {
-	struct buffer_node * pool = lua_touserdata(L, 1);
-	int sz = lua_rawlen(L,1) / sizeof(*pool);
-	int i;
-	for (i=0;i<sz;i++) {
-		struct buffer_node *node = &pool[i];
-		if (node->msg) {
-			skynet_free(node->msg);
-			node->msg = NULL;
-		}
-	}
-	return 0;
+static void
+buffer_release(struct socket_buffer *sb) {
+	skynet_free(sb->data);
+	sb->data = NULL;
+	sb->cap = 0;
+	sb->offset = 0;
+	sb->size = 0;
 }
 
 static int
-lnewpool(lua_State *L, int sz) {
-	struct buffer_node * pool = lua_newuserdata(L, sizeof(struct buffer_node) * sz);
-	int i;
-	for (i=0;i<sz;i++) {
-		pool[i].msg = NULL;
-		pool[i].sz = 0;
-		pool[i].next = &pool[i+1];
-	}
-	pool[sz-1].next = NULL;
-	if (luaL_newmetatable(L, "buffer_pool")) {
-		lua_pushcfunction(L, lfreepool);
-		lua_setfield(L, -2, "__gc");
-	}
-	lua_setmetatable(L, -2);
-	return 1;
+lfreebuffer(lua_State *L) {
+	struct socket_buffer * sb = lua_touserdata(L, 1);
+	buffer_release(sb);
+	return 0;
 }
 
 static int
 lnewbuffer(lua_State *L) {
 	struct socket_buffer * sb = lua_newuserdata(L, sizeof(*sb));	
-	sb->size = 0;
+	sb->data = NULL;
+	sb->cap = 0;
 	sb->offset = 0;
-	sb->head = NULL;
-	sb->tail = NULL;
+	sb->size = 0;
+	if (luaL_newmetatable(L, "socket_buffer")) {
+		lua_pushcfunction(L, lfreebuffer);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
 	
 	return 1;
 }
 
+static struct socket_buffer *
+check_buffer(lua_State *L, int index) {
+	struct socket_buffer * sb = luaL_testudata(L, index, "socket_buffer");
+	if (sb == NULL) {
+		luaL_error(L, "Need buffer object at param %d", index);
+	}
+	return sb;
+}
+
+static void
+buffer_consume(struct socket_buffer *sb, int sz) {
+	sb->size -= sz;
+	if (sb->size == 0) {
+		sb->offset = 0;
+		if (sb->cap > BUFFER_SHRINK) {
+			buffer_release(sb);
+		}
+	} else {
+		sb->offset += sz;
+	}
+}
+
+static void
+buffer_append(struct socket_buffer *sb, char *msg, int sz) {
+	if (sb->size == 0 && sb->cap < sz) {
+		// adopt the message block as the storage
+		skynet_free(sb->data);
+		sb->data = msg;
+		sb->cap = sz;
+		sb->offset = 0;
+		sb->size = sz;
+		return;
+	}
+	int need = sb->size + sz;
+	if (sb->offset + need > sb->cap) {
+		if (need <= sb->cap) {
+			memmove(sb->data, sb->data + sb->offset, sb->size);
+		} else {
+			int cap = sb->cap * 2;
+			if (cap < need) {
+				cap = need;
+			}
+			char * data;
+			if (sb->offset == 0) {
+				data = skynet_realloc(sb->data, cap);
+			} else {
+				data = skynet_malloc(cap);
+				memcpy(data, sb->data + sb->offset, sb->size);
+				skynet_free(sb->data);
+			}
+			sb->data = data;
+			sb->cap = cap;
+		}
+		sb->offset = 0;
+	}
+	memcpy(sb->data + sb->offset + sb->size, msg, sz);
+	sb->size = need;
+	skynet_free(msg);
+}
+
+static const char *
+memfind_scalar(const char *s, size_t sz, const char *sep, size_t seplen) {
+	const char * last = s + sz - seplen;
+	while (s <= last) {
+		s = memchr(s, sep[0], last - s + 1);
+		if (s == NULL) {
+			return NULL;
+		}
+		if (memcmp(s + 1, sep + 1, seplen - 1) == 0) {
+			return s;
+		}
+		++s;
+	}
+	return NULL;
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+/*
+	Compare the first and the last byte of sep against a whole block at once,
+	and only verify the candidates whose both ends match.
+ */
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define MEMFIND_BLOCK 32
+#define MEMFIND_VEC __m256i
+#define MEMFIND_SET1 _mm256_set1_epi8
+#define MEMFIND_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define MEMFIND_MASK(f, l, bf, bl) (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(f, bf), _mm256_cmpeq_epi8(l, bl)))
+
+#else
+
+#include <emmintrin.h>
+
+#define MEMFIND_BLOCK 16
+#define MEMFIND_VEC __m128i
+#define MEMFIND_SET1 _mm_set1_epi8
+#define MEMFIND_LOAD(p) _mm_loadu_si128((const __m128i *)(p))
+#define MEMFIND_MASK(f, l, bf, bl) (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(f, bf), _mm_cmpeq_epi8(l, bl)))
+
+#endif
+
+static const char *
+memfind_simd(const char *s, size_t sz, const char *sep, size_t seplen) {
+	const MEMFIND_VEC first = MEMFIND_SET1(sep[0]);
+	const MEMFIND_VEC last = MEMFIND_SET1(sep[seplen-1]);
+	size_t i = 0;
+	while (i + seplen - 1 + MEMFIND_BLOCK <= sz) {
+		MEMFIND_VEC block_first = MEMFIND_LOAD(s + i);
+		MEMFIND_VEC block_last = MEMFIND_LOAD(s + i + seplen - 1);
+		uint32_t mask = MEMFIND_MASK(first, last, block_first, block_last);
+		while (mask) {
+			int bit = __builtin_ctz(mask);
+			if (memcmp(s + i + bit + 1, sep + 1, seplen - 2) == 0) {
+				return s + i + bit;
+			}
+			mask &= mask - 1;
+		}
+		i += MEMFIND_BLOCK;
+	}
+	return memfind_scalar(s + i, sz - i, sep, seplen);
+}
+
+#endif
+
+/*
+	Find the first occurrence of sep (seplen bytes) in s (sz bytes).
+	return NULL if not found.
+ */
+static const char *
+memfind(const char *s, size_t sz, const char *sep, size_t seplen) {
+	if (seplen == 0) {
+		return s;
+	}
+	if (sz < seplen) {
+		return NULL;
+	}
+	if (seplen == 1) {
+		return memchr(s, sep[0], sz);
+	}
+#if defined(__AVX2__) || defined(__SSE2__)
+	return memfind_simd(s, sz, sep, seplen);
+#else
+	return memfind_scalar(s, sz, sep, seplen);
+#endif
+}
+
 /*
 	userdata send_buffer
-	table pool
 	lightuserdata msg
 	int size
 
 	return size
 
-	Comment: The table pool record all the buffers chunk, 
-	and the first index [1] is a lightuserdata : free_node. We can always use this pointer for struct buffer_node .
-	The following ([2] ...)  userdatas in table pool is the buffer chunk (for struct buffer_node), 
-	we never free them until the VM closed. The size of first chunk ([2]) is 16 struct buffer_node,
-	and the second size is 32 ... The largest size of chunk is LARGE_PAGE_NODE (4096)
-
-	lpushbbuffer will get a free struct buffer_node from table pool, and then put the msg/size in it.
-	lpopbuffer return the struct buffer_node back to table pool (By calling return_free_node).
+	The buffer takes the ownership of msg.
  */
 static int
 lpushbuffer(lua_State *L) {
-	struct socket_buffer *sb = lua_touserdata(L,1);
-	if (sb == NULL) {
-		return luaL_error(L, "need buffer object at param 1");
-	}
-	char * msg = lua_touserdata(L,3);
+	struct socket_buffer *sb = check_buffer(L,1);
+	char * msg = lua_touserdata(L,2);
 	if (msg == NULL) {
-		return luaL_error(L, "need message block at param 3");
+		return luaL_error(L, "need message block at param 2");
 	}
-	int pool_index = 2;
-	luaL_checktype(L,pool_index,LUA_TTABLE);
-	int sz = luaL_checkinteger(L,4);
-	lua_rawgeti(L,pool_index,1);
-	struct buffer_node * free_node = lua_touserdata(L,-1);	// sb poolt msg size free_node
-	lua_pop(L,1);
-	if (free_node == NULL) {
-		int tsz = lua_rawlen(L,pool_index);
-		if (tsz == 0)
-			tsz++;
-		int size = 8;
-		if (tsz <= LARGE_PAGE_NODE-3) {
-			size <<= tsz;
-		} else {
-			size <<= LARGE_PAGE_NODE-3;
-		}
-		lnewpool(L, size);	
-		free_node = lua_touserdata(L,-1);
-		lua_rawseti(L, pool_index, tsz+1);
-	}
-	lua_pushlightuserdata(L, free_node->next);	
-	lua_rawseti(L, pool_index, 1);	// sb poolt msg size
-	free_node->msg = msg;
-	free_node->sz = sz;
-	free_node->next = NULL;
-
-	if (sb->head == NULL) {
-		assert(sb->tail == NULL);
-		sb->head = sb->tail = free_node;
+	int sz = luaL_checkinteger(L,3);
+	if (sz <= 0) {
+		skynet_free(msg);
 	} else {
-		sb->tail->next = free_node;
-		sb->tail = free_node;
+		buffer_append(sb, msg, sz);
 	}
-	sb->size += sz;
-
 	lua_pushinteger(L, sb->size);
 
 	return 1;
 }
 
-static void
-return_free_node(lua_State *L, int pool, struct socket_buffer *sb) {
-	struct buffer_node *free_node = sb->head;
-	sb->offset = 0;
-	sb->head = free_node->next;
-	if (sb->head == NULL) {
-		sb->tail = NULL;
-	}
-	lua_rawgeti(L,pool,1);
-	free_node->next = lua_touserdata(L,-1);
-	lua_pop(L,1);
-	skynet_free(free_node->msg);
-	free_node->msg = NULL;
-
-	free_node->sz = 0;
-	lua_pushlightuserdata(L, free_node);
-	lua_rawseti(L, pool, 1);
-}
-
-static void
-pop_lstring(lua_State *L, struct socket_buffer *sb, int sz, int skip) {
-	struct buffer_node * current = sb->head;
-	if (sz < current->sz - sb->offset) {
-		lua_pushlstring(L, current->msg + sb->offset, sz-skip);
-		sb->offset+=sz;
-		return;
-	}
-	if (sz == current->sz - sb->offset) {
-		lua_pushlstring(L, current->msg + sb->offset, sz-skip);
-		return_free_node(L,2,sb);
-		return;
-	}
-
-	luaL_Buffer b;
-	luaL_buffinit(L, &b);
-	for (;;) {
-		int bytes = current->sz - sb->offset;
-		if (bytes >= sz) {
-			if (sz > skip) {
-				luaL_addlstring(&b, current->msg + sb->offset, sz - skip);
-			} 
-			sb->offset += sz;
-			if (bytes == sz) {
-				return_free_node(L,2,sb);
-			}
-			break;
-		}
-		int real_sz = sz - skip;
-		if (real_sz > 0) {
-			luaL_addlstring(&b, current->msg + sb->offset, (real_sz < bytes) ? real_sz : bytes);
-		}
-		return_free_node(L,2,sb);
-		sz-=bytes;
-		if (sz==0)
-			break;
-		current = sb->head;
-		assert(current);
-	}
-	luaL_pushresult(&b);
-}
-
 static int
 lheader(lua_State *L) {
 	size_t len;
@@ -229,22 +269,17 @@ lheader(lua_State *L) {
 
 /*
 	userdata send_buffer
-	table pool
 	integer sz 
  */
 static int
 lpopbuffer(lua_State *L) {
-	struct socket_buffer * sb = lua_touserdata(L, 1);
-	if (sb == NULL) {
-		return luaL_error(L, "Need buffer object at param 1");
-	}
-	luaL_checktype(L,2,LUA_TTABLE);
-	int sz = luaL_checkinteger(L,3);
+	struct socket_buffer * sb = check_buffer(L, 1);
+	int sz = luaL_checkinteger(L,2);
 	if (sb->size < sz || sz == 0) {
 		lua_pushnil(L);
 	} else {
-		pop_lstring(L,sb,sz,0);
-		sb->size -= sz;
+		lua_pushlstring(L, sb->data + sb->offset, sz);
+		buffer_consume(sb, sz);
 	}
 	lua_pushinteger(L, sb->size);
 
@@ -253,38 +288,72 @@ lpopbuffer(lua_State *L) {
 
 /*
 	userdata send_buffer
-	table pool
+	integer sz
+	integer offset (optional, default 0)
+
+	return lightuserdata, sz  (nil if there are not enough bytes)
+
+	The pointer refers to the buffer itself and it's valid until the next operation on the buffer.
+	Use skip to discard the bytes after peek.
  */
 static int
-lclearbuffer(lua_State *L) {
-	struct socket_buffer * sb = lua_touserdata(L, 1);
-	if (sb == NULL) {
-		return luaL_error(L, "Need buffer object at param 1");
+lpeekbuffer(lua_State *L) {
+	struct socket_buffer * sb = check_buffer(L, 1);
+	int sz = luaL_checkinteger(L,2);
+	int offset = luaL_optinteger(L,3,0);
+	if (sz <= 0 || offset < 0 || sb->size - offset < sz) {
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_pushlightuserdata(L, sb->data + sb->offset + offset);
+	lua_pushinteger(L, sz);
+	return 2;
+}
+
+/*
+	userdata send_buffer
+	integer sz
+
+	return size
+ */
+static int
+lskipbuffer(lua_State *L) {
+	struct socket_buffer * sb = check_buffer(L, 1);
+	int sz = luaL_checkinteger(L,2);
+	if (sz < 0 || sz > sb->size) {
+		return luaL_error(L, "Invalid skip size %d (buffer size %d)", sz, sb->size);
 	}
-	luaL_checktype(L,2,LUA_TTABLE);
-	while(sb->head) {
-		return_free_node(L,2,sb);
+	if (sz > 0) {
+		buffer_consume(sb, sz);
 	}
-	sb->size = 0;
+	lua_pushinteger(L, sb->size);
+	return 1;
+}
+
+static int
+lbuffersize(lua_State *L) {
+	struct socket_buffer * sb = check_buffer(L, 1);
+	lua_pushinteger(L, sb->size);
+	return 1;
+}
+
+/*
+	userdata send_buffer
+ */
+static int
+lclearbuffer(lua_State *L) {
+	struct socket_buffer * sb = check_buffer(L, 1);
+	buffer_release(sb);
 	return 0;
 }
 
 static int
 lreadall(lua_State *L) {
-	struct socket_buffer * sb = lua_touserdata(L, 1);
-	if (sb == NULL) {
-		return luaL_error(L, "Need buffer object at param 1");
-	}
-	luaL_checktype(L,2,LUA_TTABLE);
-	luaL_Buffer b;
-	luaL_buffinit(L, &b);
-	while(sb->head) {
-		struct buffer_node *current = sb->head;
-		luaL_addlstring(&b, current->msg + sb->offset, current->sz - sb->offset);
-		return_free_node(L,2,sb);
+	struct socket_buffer * sb = check_buffer(L, 1);
+	lua_pushlstring(L, sb->data + sb->offset, sb->size);
+	if (sb->size > 0) {
+		buffer_consume(sb, sb->size);
 	}
-	luaL_pushresult(&b);
-	sb->size = 0;
 	return 1;
 }
 
@@ -296,67 +365,64 @@ ldrop(lua_State *L) {
 	return 0;
 }
 
-static bool
-check_sep(struct buffer_node * node, int from, const char *sep, int seplen) {
-	for (;;) {
-		int sz = node->sz - from;
-		if (sz >= seplen) {
-			return memcmp(node->msg+from,sep,seplen) == 0;
-		}
-		if (sz > 0) {
-			if (memcmp(node->msg + from, sep, sz)) {
-				return false;
-			}
-		}
-		node = node->next;
-		sep += sz;
-		seplen -= sz;
-		from = 0;
-	}
-}
-
 /*
 	userdata send_buffer
-	table pool , nil for check
 	string sep
+	boolean check (only check if there is a line)
  */
 static int
 lreadline(lua_State *L) {
-	struct socket_buffer * sb = lua_touserdata(L, 1);
-	if (sb == NULL) {
-		return luaL_error(L, "Need buffer object at param 1");
+	struct socket_buffer * sb = check_buffer(L, 1);
+	size_t seplen = 0;
+	const char *sep = luaL_checklstring(L,2,&seplen);
+	bool check = lua_toboolean(L, 3);
+	if (sb->size == 0)
+		return 0;
+	const char * line = sb->data + sb->offset;
+	const char * pos = memfind(line, sb->size, sep, seplen);
+	if (pos == NULL)
+		return 0;
+	if (check) {
+		lua_pushboolean(L,true);
+	} else {
+		int sz = pos - line;
+		lua_pushlstring(L, line, sz);
+		buffer_consume(sb, sz + seplen);
 	}
-	// only check
-	bool check = !lua_istable(L, 2);
+	return 1;
+}
+
+/*
+	string s
+	string sep
+	integer init (optional, default 1)
+
+	return the position of sep in s (like string.find(s, sep, init, true)), or nil
+ */
+static int
+lmemfind(lua_State *L) {
+	size_t sz = 0;
+	const char * str = luaL_checklstring(L,1,&sz);
 	size_t seplen = 0;
-	const char *sep = luaL_checklstring(L,3,&seplen);
-	int i;
-	struct buffer_node *current = sb->head;
-	if (current == NULL)
+	const char * sep = luaL_checklstring(L,2,&seplen);
+	lua_Integer init = luaL_optinteger(L,3,1);
+	if (init < 0) {
+		init += (lua_Integer)sz + 1;
+		if (init < 1)
+			init = 1;
+	} else if (init == 0) {
+		init = 1;
+	}
+	if (init > (lua_Integer)sz + 1) {
 		return 0;
-	int from = sb->offset;
-	int bytes = current->sz - from;
-	for (i=0;i<=sb->size - (int)seplen;i++) {
-		if (check_sep(current, from, sep, seplen)) {
-			if (check) {
-				lua_pushboolean(L,true);
-			} else {
-				pop_lstring(L, sb, i+seplen, seplen);
-				sb->size -= i+seplen;
-			}
-			return 1;
-		}
-		++from;
-		--bytes;
-		if (bytes == 0) {
-			current = current->next;
-			from = 0;
-			if (current == NULL)
-				break;
-			bytes = current->sz;
-		}
 	}
-	return 0;
+	const char * pos = memfind(str + init - 1, sz - (init - 1), sep, seplen);
+	if (pos == NULL) {
+		return 0;
+	}
+	lua_pushinteger(L, pos - str + 1);
+	lua_pushinteger(L, pos - str + seplen);
+	return 2;
 }
 
 static int
@@ -478,8 +544,14 @@ llisten(lua_State *L) {
 	const char * host = luaL_checkstring(L,1);
 	int port = luaL_checkinteger(L,2);
 	int backlog = luaL_optinteger(L,3,BACKLOG);
+	int reuseport = lua_toboolean(L,4);
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
-	int id = skynet_socket_listen(ctx, host,port,backlog);
+	int id;
+	if (reuseport) {
+		id = skynet_socket_listen_reuseport(ctx, host,port,backlog);
+	} else {
+		id = skynet_socket_listen(ctx, host,port,backlog);
+	}
 	if (id < 0) {
 		return luaL_error(L, "Listen error");
 	}
@@ -598,6 +670,23 @@ lnodelay(lua_State *L) {
 	return 0;
 }
 
+/*
+	return accept, wakeup, fail
+
+	accept : connections accepted since start
+	wakeup : listen socket events which accept at least one connection (accept / wakeup is the average batch)
+	fail : accept failed (EMFILE, ENFILE, or no free socket slot)
+ */
+static int
+laccept_stat(lua_State *L) {
+	struct socket_accept_stat stat;
+	skynet_socket_accept_stat(&stat);
+	lua_pushinteger(L, (lua_Integer)stat.accept);
+	lua_pushinteger(L, (lua_Integer)stat.wakeup);
+	lua_pushinteger(L, (lua_Integer)stat.fail);
+	return 3;
+}
+
 static int
 ludp(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -685,14 +774,19 @@ luaopen_socketdriver(lua_State *L) {
 		{ "buffer", lnewbuffer },
 		{ "push", lpushbuffer },
 		{ "pop", lpopbuffer },
+		{ "peek", lpeekbuffer },
+		{ "skip", lskipbuffer },
+		{ "size", lbuffersize },
 		{ "drop", ldrop },
 		{ "readall", lreadall },
 		{ "clear", lclearbuffer },
 		{ "readline", lreadline },
+		{ "memfind", lmemfind },
 		{ "str2p", lstr2p },
 		{ "header", lheader },
 
 		{ "unpack", lunpack },
+		{ "accept_stat", laccept_stat },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L,l);
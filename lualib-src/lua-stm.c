@@ -7,29 +7,46 @@
 #include <assert.h>
 #include <string.h>
 
-#include "rwlock.h"
 #include "skynet_malloc.h"
 #include "atomic.h"
 
+/*
+	The current copy is swapped without lock. A reader registers itself in active[epoch] while it
+	loads the copy and grabs a reference. The writer retires the old copy into retired[epoch], and
+	releases the copies retired in the previous epoch when no reader is active in it, then goes into
+	the next epoch.
+ */
+
 struct stm_object {
-	struct rwlock lock;
 	int reference;
+	int epoch;
+	int active[2];
+	uint32_t version;
 	struct stm_copy * copy;
+	struct stm_copy * retired[2];	// only the writer (or the last owner) touches them
 };
 
 struct stm_copy {
 	int reference;
+	uint32_t version;
 	uint32_t sz;
 	void * msg;
+	uint32_t deltasz;
+	void * delta;	// optional, the diff from the previous version
+	struct stm_copy * next;	// retired list
 };
 
-// msg should alloc by skynet_malloc 
+// msg and delta should alloc by skynet_malloc
 static struct stm_copy *
-stm_newcopy(void * msg, int32_t sz) {
+stm_newcopy(void * msg, int32_t sz, void * delta, int32_t deltasz) {
 	struct stm_copy * copy = skynet_malloc(sizeof(*copy));
 	copy->reference = 1;
+	copy->version = 0;
 	copy->sz = sz;
 	copy->msg = msg;
+	copy->deltasz = deltasz;
+	copy->delta = delta;
+	copy->next = NULL;
 
 	return copy;
 }
@@ -37,9 +54,15 @@ stm_newcopy(void * msg, int32_t sz) {
 static struct stm_object *
 stm_new(void * msg, int32_t sz) {
 	struct stm_object * obj = skynet_malloc(sizeof(*obj));
-	rwlock_init(&obj->lock);
 	obj->reference = 1;
-	obj->copy = stm_newcopy(msg, sz);
+	obj->epoch = 0;
+	obj->active[0] = 0;
+	obj->active[1] = 0;
+	obj->version = 1;
+	obj->copy = stm_newcopy(msg, sz, NULL, 0);
+	obj->copy->version = 1;
+	obj->retired[0] = NULL;
+	obj->retired[1] = NULL;
 
 	return obj;
 }
@@ -50,68 +73,112 @@ stm_releasecopy(struct stm_copy *copy) {
 		return;
 	if (ATOM_DEC(&copy->reference) == 0) {
 		skynet_free(copy->msg);
+		if (copy->delta) {
+			skynet_free(copy->delta);
+		}
 		skynet_free(copy);
 	}
 }
 
+static void
+stm_releaselist(struct stm_copy *copy) {
+	while (copy) {
+		struct stm_copy *next = copy->next;
+		stm_releasecopy(copy);
+		copy = next;
+	}
+}
+
+// called by the writer after the copy is swapped out
+static void
+stm_retire(struct stm_object *obj, struct stm_copy *copy) {
+	int e = obj->epoch;
+	if (copy) {
+		copy->next = obj->retired[e & 1];
+		obj->retired[e & 1] = copy;
+	}
+	int prev = (e + 1) & 1;
+	__sync_synchronize();
+	if (obj->active[prev] == 0) {
+		// nobody reads in the previous epoch, so nobody can see the copies retired in it
+		stm_releaselist(obj->retired[prev]);
+		obj->retired[prev] = NULL;
+		ATOM_INC(&obj->epoch);
+	}
+}
+
+static void
+stm_free(struct stm_object *obj) {
+	stm_releasecopy(obj->copy);
+	stm_releaselist(obj->retired[0]);
+	stm_releaselist(obj->retired[1]);
+	skynet_free(obj);
+}
+
 static void
 stm_release(struct stm_object *obj) {
 	assert(obj->copy);
-	rwlock_wlock(&obj->lock);
 	// writer release the stm object, so release the last copy .
-	stm_releasecopy(obj->copy);
+	struct stm_copy *copy = obj->copy;
 	obj->copy = NULL;
-	if (--obj->reference > 0) {
-		// stm object grab by readers, reset the copy to NULL.
-		rwlock_wunlock(&obj->lock);
+	__sync_synchronize();
+	// the readers leave the fast path (see lread) and drop the last copy
+	obj->version = obj->version + 1;
+	stm_retire(obj, copy);
+	if (ATOM_DEC(&obj->reference) > 0) {
+		// stm object grab by readers, they read NULL now.
 		return;
 	}
-	// no one grab the stm object, no need to unlock wlock.
-	skynet_free(obj);
+	stm_free(obj);
 }
 
 static void
 stm_releasereader(struct stm_object *obj) {
-	rwlock_rlock(&obj->lock);
 	if (ATOM_DEC(&obj->reference) == 0) {
-		// last reader, no writer. so no need to unlock
+		// last reader, no writer.
 		assert(obj->copy == NULL);
-		skynet_free(obj);
-		return;
+		stm_free(obj);
 	}
-	rwlock_runlock(&obj->lock);
 }
 
 static void
 stm_grab(struct stm_object *obj) {
-	rwlock_rlock(&obj->lock);
 	int ref = ATOM_FINC(&obj->reference);
-	rwlock_runlock(&obj->lock);
 	assert(ref > 0);
 }
 
 static struct stm_copy *
 stm_copy(struct stm_object *obj) {
-	rwlock_rlock(&obj->lock);
+	int e;
+	for (;;) {
+		e = obj->epoch;
+		ATOM_INC(&obj->active[e & 1]);
+		if (e == obj->epoch) {
+			break;
+		}
+		// the writer goes into the next epoch
+		ATOM_DEC(&obj->active[e & 1]);
+	}
 	struct stm_copy * ret = obj->copy;
 	if (ret) {
 		int ref = ATOM_FINC(&ret->reference);
 		assert(ref > 0);
 	}
-	rwlock_runlock(&obj->lock);
+	ATOM_DEC(&obj->active[e & 1]);
 	
 	return ret;
 }
 
 static void
-stm_update(struct stm_object *obj, void *msg, int32_t sz) {
-	struct stm_copy *copy = stm_newcopy(msg, sz);
-	rwlock_wlock(&obj->lock);
+stm_update(struct stm_object *obj, void *msg, int32_t sz, void *delta, int32_t deltasz) {
+	struct stm_copy *copy = stm_newcopy(msg, sz, delta, deltasz);
+	copy->version = obj->version + 1;
 	struct stm_copy *oldcopy = obj->copy;
 	obj->copy = copy;
-	rwlock_wunlock(&obj->lock);
+	__sync_synchronize();
+	obj->version = copy->version;
 
-	stm_releasecopy(oldcopy);
+	stm_retire(obj, oldcopy);
 }
 
 // lua binding
@@ -128,18 +195,26 @@ lcopy(lua_State *L) {
 	return 1;
 }
 
+// the message (string, or userdata and size) at index, return the next index
+static int
+getmsg(lua_State *L, int index, void **msg, size_t *sz) {
+	if (lua_isuserdata(L, index)) {
+		*msg = lua_touserdata(L, index);
+		*sz = (size_t)luaL_checkinteger(L, index+1);
+		return index + 2;
+	} else {
+		const char * tmp = luaL_checklstring(L, index, sz);
+		*msg = skynet_malloc(*sz);
+		memcpy(*msg, tmp, *sz);
+		return index + 1;
+	}
+}
+
 static int
 lnewwriter(lua_State *L) {
 	void * msg;
 	size_t sz;
-	if (lua_isuserdata(L,1)) {
-		msg = lua_touserdata(L, 1);
-		sz = (size_t)luaL_checkinteger(L, 2);
-	} else {
-		const char * tmp = luaL_checklstring(L,1,&sz);
-		msg = skynet_malloc(sz);
-		memcpy(msg, tmp, sz);
-	}
+	getmsg(L, 1, &msg, &sz);
 	struct boxstm * box = lua_newuserdata(L, sizeof(*box));
 	box->obj = stm_new(msg,sz);
 	lua_pushvalue(L, lua_upvalueindex(1));
@@ -157,20 +232,23 @@ ldeletewriter(lua_State *L) {
 	return 0;
 }
 
+/*
+	userdata writer
+	message (string, or userdata and size)
+	delta (optional, string, or userdata and size) : the diff from the previous version
+ */
 static int
 lupdate(lua_State *L) {
 	struct boxstm * box = lua_touserdata(L, 1);
 	void * msg;
 	size_t sz;
-	if (lua_isuserdata(L, 2)) {
-		msg = lua_touserdata(L, 2);
-		sz = (size_t)luaL_checkinteger(L, 3);
-	} else {
-		const char * tmp = luaL_checklstring(L,2,&sz);
-		msg = skynet_malloc(sz);
-		memcpy(msg, tmp, sz);
+	void * delta = NULL;
+	size_t deltasz = 0;
+	int index = getmsg(L, 2, &msg, &sz);
+	if (!lua_isnoneornil(L, index)) {
+		getmsg(L, index, &delta, &deltasz);
 	}
-	stm_update(box->obj, msg, sz);
+	stm_update(box->obj, msg, sz, delta, deltasz);
 
 	return 0;
 }
@@ -202,27 +280,54 @@ ldeletereader(lua_State *L) {
 	return 0;
 }
 
+/*
+	userdata reader
+	function f(msg, sz, ud)
+	ud
+	function fdelta(delta, sz, ud) (optional) : called instead of f if the reader is one version behind
+		and the writer publishes a delta.
+	return false (not update) or true and the results of f (or fdelta)
+ */
 static int
 lread(lua_State *L) {
 	struct boxreader * box = lua_touserdata(L, 1);
 	luaL_checktype(L, 2, LUA_TFUNCTION);
 
+	struct stm_copy * lastcopy = box->lastcopy;
+	if (lastcopy && lastcopy->version == box->obj->version) {
+		// not update, check without grabbing the copy
+		lua_pushboolean(L, 0);
+		return 1;
+	}
 	struct stm_copy * copy = stm_copy(box->obj);
-	if (copy == box->lastcopy) {
+	if (copy == lastcopy) {
 		// not update
 		stm_releasecopy(copy);
 		lua_pushboolean(L, 0);
 		return 1;
 	}
 
-	stm_releasecopy(box->lastcopy);
+	int delta = lastcopy && copy && copy->delta &&
+		lastcopy->version + 1 == copy->version &&
+		lua_type(L, 4) == LUA_TFUNCTION;
+	stm_releasecopy(lastcopy);
 	box->lastcopy = copy;
 	if (copy) {
-		lua_settop(L, 3);
+		lua_settop(L, 4);
+		if (delta) {
+			lua_replace(L, 2);
+		} else {
+			lua_settop(L, 3);
+		}
 		lua_replace(L, 1);
 		lua_settop(L, 2);
-		lua_pushlightuserdata(L, copy->msg);
-		lua_pushinteger(L, copy->sz);
+		if (delta) {
+			lua_pushlightuserdata(L, copy->delta);
+			lua_pushinteger(L, copy->deltasz);
+		} else {
+			lua_pushlightuserdata(L, copy->msg);
+			lua_pushinteger(L, copy->sz);
+		}
 		lua_pushvalue(L, 1);
 		lua_call(L, 3, LUA_MULTRET);
 		lua_pushboolean(L, 1);
@@ -234,14 +339,29 @@ lread(lua_State *L) {
 	}
 }
 
+// the version of the writer or the reader, increased by each update
+static int
+lversion(lua_State *L) {
+	// boxstm and boxreader both begin with the stm object
+	struct boxstm * box = lua_touserdata(L, 1);
+	if (box == NULL || box->obj == NULL) {
+		return luaL_error(L, "Need a stm object");
+	}
+	lua_pushinteger(L, box->obj->version);
+	return 1;
+}
+
 LUAMOD_API int
 luaopen_stm(lua_State *L) {
 	luaL_checkversion(L);
-	lua_createtable(L, 0, 3);
+	lua_createtable(L, 0, 4);
 
 	lua_pushcfunction(L, lcopy);
 	lua_setfield(L, -2, "copy");
 
+	lua_pushcfunction(L, lversion);
+	lua_setfield(L, -2, "version");
+
 	luaL_Reg writer[] = {
 		{ "new", lnewwriter },
 		{ NULL, NULL },
@@ -75,6 +75,37 @@ lnewproto(lua_State *L) {
 	return 0;
 }
 
+/*
+	The plan of a sproto_type is a table { [tag+1] = key } of the field names,
+	so that encode/decode index the lua table by the lua string key instead of the C string name.
+	Plans are cached in the table shared by encode/decode/deleteproto :
+	upvalue 3 of encode (after the buffer), upvalue 1 of decode and deleteproto.
+ */
+#define ENCODE_PLANS lua_upvalueindex(3)
+#define PLANS lua_upvalueindex(1)
+
+static void
+push_plan(lua_State *L, int plans, const struct sproto_type *st) {
+	int i, tag;
+	const char * name;
+	lua_rawgetp(L, plans, st);
+	if (lua_istable(L, -1))
+		return;
+	lua_pop(L, 1);
+	lua_newtable(L);
+	for (i=0;(name = sproto_field(st, i, &tag)) != NULL;i++) {
+		lua_pushstring(L, name);
+		lua_rawseti(L, -2, tag+1);
+	}
+	lua_pushvalue(L, -1);
+	lua_rawsetp(L, plans, st);
+}
+
+static inline void
+push_key(lua_State *L, int plan, int tag) {
+	lua_rawgeti(L, plan, tag+1);
+}
+
 static int
 ldeleteproto(lua_State *L) {
 	struct sproto * sp = lua_touserdata(L,1);
@@ -82,6 +113,14 @@ ldeleteproto(lua_State *L) {
 		return luaL_argerror(L, 1, "Need a sproto object");
 	}
 	sproto_release(sp);
+	// the addresses of the types may be reused, so drop all the plans.
+	lua_pushnil(L);
+	while (lua_next(L, PLANS) != 0) {
+		lua_pop(L, 1);
+		lua_pushvalue(L, -1);
+		lua_pushnil(L);
+		lua_rawset(L, PLANS);
+	}
 	return 0;
 }
 
@@ -106,6 +145,7 @@ struct encode_ud {
 	lua_State *L;
 	struct sproto_type *st;
 	int tbl_index;
+	int plan_index;
 	const char * array_tag;
 	int array_index;
 	int deep;
@@ -122,7 +162,8 @@ encode(const struct sproto_arg *args) {
 		if (args->tagname != self->array_tag) {
 			// a new array
 			self->array_tag = args->tagname;
-			lua_getfield(L, self->tbl_index, args->tagname);
+			push_key(L, self->plan_index, args->tagid);
+			lua_gettable(L, self->tbl_index);
 			if (lua_isnil(L, -1)) {
 				if (self->array_index) {
 					lua_replace(L, self->array_index);
@@ -157,7 +198,8 @@ encode(const struct sproto_arg *args) {
 			lua_geti(L, self->array_index, args->index);
 		}
 	} else {
-		lua_getfield(L, self->tbl_index, args->tagname);
+		push_key(L, self->plan_index, args->tagid);
+		lua_gettable(L, self->tbl_index);
 	}
 	if (lua_isnil(L, -1)) {
 		lua_pop(L,1);
@@ -230,8 +272,10 @@ encode(const struct sproto_arg *args) {
 		sub.array_tag = NULL;
 		sub.array_index = 0;
 		sub.deep = self->deep + 1;
+		push_plan(L, ENCODE_PLANS, sub.st);
+		sub.plan_index = sub.tbl_index + 1;
 		lua_pushnil(L);	// prepare an iterator slot
-		sub.iter_index = sub.tbl_index + 1;
+		sub.iter_index = sub.tbl_index + 2;
 		r = sproto_encode(args->subtype, args->value, args->length, encode, &sub);
 		lua_settop(L, top-1);	// pop the value
 		if (r < 0) 
@@ -278,7 +322,7 @@ lencode(lua_State *L) {
 		return luaL_argerror(L, 1, "Need a sproto_type object");
 	}
 	luaL_checktype(L, tbl_index, LUA_TTABLE);
-	luaL_checkstack(L, ENCODE_DEEPLEVEL*2 + 8, NULL);
+	luaL_checkstack(L, ENCODE_DEEPLEVEL*3 + 8, NULL);
 	self.L = L;
 	self.st = st;
 	self.tbl_index = tbl_index;
@@ -289,8 +333,10 @@ lencode(lua_State *L) {
 		self.deep = 0;
 
 		lua_settop(L, tbl_index);
-		lua_pushnil(L);	// for iterator (stack slot 3)
-		self.iter_index = tbl_index+1;
+		push_plan(L, ENCODE_PLANS, st);	// stack slot 3
+		self.plan_index = tbl_index+1;
+		lua_pushnil(L);	// for iterator (stack slot 4)
+		self.iter_index = tbl_index+2;
 
 		r = sproto_encode(st, buffer, sz, encode, &self);
 		if (r<0) {
@@ -308,6 +354,7 @@ struct decode_ud {
 	const char * array_tag;
 	int array_index;
 	int result_index;
+	int plan_index;
 	int deep;
 	int mainindex_tag;
 	int key_index;
@@ -324,8 +371,9 @@ decode(const struct sproto_arg *args) {
 		if (args->tagname != self->array_tag) {
 			self->array_tag = args->tagname;
 			lua_newtable(L);
-			lua_pushvalue(L, -1);
-			lua_setfield(L, self->result_index, args->tagname);
+			push_key(L, self->plan_index, args->tagid);
+			lua_pushvalue(L, -2);
+			lua_settable(L, self->result_index);
 			if (self->array_index) {
 				lua_replace(L, self->array_index);
 			} else {
@@ -363,7 +411,10 @@ decode(const struct sproto_arg *args) {
 	case SPROTO_TSTRUCT: {
 		struct decode_ud sub;
 		int r;
-		lua_newtable(L);
+		push_plan(L, PLANS, args->subtype);
+		sub.plan_index = lua_gettop(L);
+		// the number of fields is the size hint
+		lua_createtable(L, 0, (int)lua_rawlen(L, sub.plan_index));
 		sub.L = L;
 		sub.result_index = lua_gettop(L);
 		sub.deep = self->deep + 1;
@@ -386,7 +437,7 @@ decode(const struct sproto_arg *args) {
 			}
 			lua_pushvalue(L, sub.result_index);
 			lua_settable(L, self->array_index);
-			lua_settop(L, sub.result_index-1);
+			lua_settop(L, sub.plan_index-1);
 			return 0;
 		} else {
 			sub.mainindex_tag = -1;
@@ -397,6 +448,7 @@ decode(const struct sproto_arg *args) {
 			if (r != args->length)
 				return r;
 			lua_settop(L, sub.result_index);
+			lua_replace(L, sub.plan_index);
 			break;
 		}
 	}
@@ -412,7 +464,9 @@ decode(const struct sproto_arg *args) {
 			lua_pushvalue(L,-1);
 			lua_replace(L, self->key_index);
 		}
-		lua_setfield(L, self->result_index, args->tagname);
+		push_key(L, self->plan_index, args->tagid);
+		lua_insert(L, -2);
+		lua_settable(L, self->result_index);
 	}
 
 	return 0;
@@ -438,7 +492,9 @@ getbuffer(lua_State *L, int index, size_t *sz) {
 /*
 	lightuserdata sproto_type
 	string source	/  (lightuserdata , integer)
-	return table
+	table result (optional)
+	integer offset (optional)
+	return table, integer (the end of the object relative to offset)
  */
 static int
 ldecode(lua_State *L) {
@@ -447,17 +503,33 @@ ldecode(lua_State *L) {
 	struct decode_ud self;
 	size_t sz;
 	int r;
+	int tbl;
+	lua_Integer offset;
 	if (st == NULL) {
 		return luaL_argerror(L, 1, "Need a sproto_type object");
 	}
 	sz = 0;
 	buffer = getbuffer(L, 2, &sz);
-	if (!lua_istable(L, -1)) {
-		lua_newtable(L);
+	tbl = lua_type(L, 2) == LUA_TSTRING ? 3 : 4;
+	offset = luaL_optinteger(L, tbl+1, 0);
+	if (offset < 0 || offset > sz) {
+		return luaL_argerror(L, tbl+1, "Invalid offset");
+	}
+	buffer = (const char *)buffer + offset;
+	sz -= offset;
+	lua_settop(L, tbl);
+	luaL_checkstack(L, ENCODE_DEEPLEVEL*4 + 8, NULL);
+	if (!lua_istable(L, tbl)) {
+		push_plan(L, PLANS, st);
+		self.plan_index = lua_gettop(L);
+		lua_createtable(L, 0, (int)lua_rawlen(L, self.plan_index));
+		self.result_index = lua_gettop(L);
+	} else {
+		self.result_index = lua_gettop(L);
+		push_plan(L, PLANS, st);
+		self.plan_index = lua_gettop(L);
 	}
-	luaL_checkstack(L, ENCODE_DEEPLEVEL*3 + 8, NULL);
 	self.L = L;
-	self.result_index = lua_gettop(L);
 	self.array_index = 0;
 	self.array_tag = NULL;
 	self.deep = 0;
@@ -528,12 +600,42 @@ lunpack(lua_State *L) {
 	return 1;
 }
 
+// upvalue 1,2 : the buffer and its size, upvalue 3 : the plans table at the top of the stack
 static void
 pushfunction_withbuffer(lua_State *L, const char * name, lua_CFunction func) {
 	lua_newuserdata(L, ENCODE_BUFFERSIZE);
 	lua_pushinteger(L, ENCODE_BUFFERSIZE);
-	lua_pushcclosure(L, func, 2);
-	lua_setfield(L, -2, name);
+	lua_pushvalue(L, -3);
+	lua_pushcclosure(L, func, 3);
+	lua_setfield(L, -3, name);
+}
+
+// upvalue 1 : the plans table at the top of the stack
+static void
+pushfunction_withplans(lua_State *L, const char * name, lua_CFunction func) {
+	lua_pushvalue(L, -1);
+	lua_pushcclosure(L, func, 1);
+	lua_setfield(L, -3, name);
+}
+
+/*
+	lightuserdata sproto
+	return table { name = tag }
+ */
+static int
+lprotocols(lua_State *L) {
+	struct sproto * sp = lua_touserdata(L, 1);
+	const char * name;
+	int i, tag;
+	if (sp == NULL) {
+		return luaL_argerror(L, 1, "Need a sproto object");
+	}
+	lua_newtable(L);
+	for (i=0;(name = sproto_protocol(sp, i, &tag)) != NULL;i++) {
+		lua_pushinteger(L, tag);
+		lua_setfield(L, -2, name);
+	}
+	return 1;
 }
 
 static int
@@ -682,19 +784,22 @@ luaopen_sproto_core(lua_State *L) {
 #endif
 	luaL_Reg l[] = {
 		{ "newproto", lnewproto },
-		{ "deleteproto", ldeleteproto },
 		{ "dumpproto", ldumpproto },
 		{ "querytype", lquerytype },
-		{ "decode", ldecode },
 		{ "protocol", lprotocol },
+		{ "protocols", lprotocols },
 		{ "loadproto", lloadproto },
 		{ "saveproto", lsaveproto },
 		{ "default", ldefault },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L,l);
+	lua_newtable(L);	// plans
 	pushfunction_withbuffer(L, "encode", lencode);
+	pushfunction_withplans(L, "decode", ldecode);
+	pushfunction_withplans(L, "deleteproto", ldeleteproto);
 	pushfunction_withbuffer(L, "pack", lpack);
 	pushfunction_withbuffer(L, "unpack", lunpack);
+	lua_pop(L, 1);
 	return 1;
 }
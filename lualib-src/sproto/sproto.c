@@ -6,6 +6,12 @@
 
 #include "sproto.h"
 
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define SPROTO_TARRAY 0x80
 #define CHUNK_SIZE 1000
 #define SIZEOF_LENGTH 4
@@ -599,6 +605,14 @@ sproto_protoname(const struct sproto *sp, int proto) {
 	return NULL;
 }
 
+const char *
+sproto_protocol(const struct sproto *sp, int index, int *tag) {
+	if (index < 0 || index >= sp->protocol_n)
+		return NULL;
+	*tag = sp->proto[index].tag;
+	return sp->proto[index].name;
+}
+
 struct sproto_type *
 sproto_type(const struct sproto *sp, const char * type_name) {
 	int i;
@@ -615,6 +629,14 @@ sproto_name(struct sproto_type * st) {
 	return st->name;
 }
 
+const char *
+sproto_field(const struct sproto_type *st, int index, int *tag) {
+	if (index < 0 || index >= st->n)
+		return NULL;
+	*tag = st->f[index].tag;
+	return st->f[index].name;
+}
+
 static struct field *
 findtag(const struct sproto_type *st, int tag) {
 	int begin, end;
@@ -1206,6 +1228,226 @@ sproto_decode(const struct sproto_type *st, const void * data, int size, sproto_
 
 // 0 pack
 
+/*
+	The group of 8 bytes is packed as a header byte (bit i is set if byte i isn't zero) and the non-zero bytes.
+	With SSSE3, the non-zero bytes are compacted (and expanded by sproto_unpack) by one pshufb,
+	the shuffle masks are indexed by the header.
+ */
+#if defined(__SSSE3__)
+
+static const uint8_t PACK_SHUFFLE[256][8] = {
+	{128,128,128,128,128,128,128,128}, {0,128,128,128,128,128,128,128}, {1,128,128,128,128,128,128,128}, {0,1,128,128,128,128,128,128},
+	{2,128,128,128,128,128,128,128}, {0,2,128,128,128,128,128,128}, {1,2,128,128,128,128,128,128}, {0,1,2,128,128,128,128,128},
+	{3,128,128,128,128,128,128,128}, {0,3,128,128,128,128,128,128}, {1,3,128,128,128,128,128,128}, {0,1,3,128,128,128,128,128},
+	{2,3,128,128,128,128,128,128}, {0,2,3,128,128,128,128,128}, {1,2,3,128,128,128,128,128}, {0,1,2,3,128,128,128,128},
+	{4,128,128,128,128,128,128,128}, {0,4,128,128,128,128,128,128}, {1,4,128,128,128,128,128,128}, {0,1,4,128,128,128,128,128},
+	{2,4,128,128,128,128,128,128}, {0,2,4,128,128,128,128,128}, {1,2,4,128,128,128,128,128}, {0,1,2,4,128,128,128,128},
+	{3,4,128,128,128,128,128,128}, {0,3,4,128,128,128,128,128}, {1,3,4,128,128,128,128,128}, {0,1,3,4,128,128,128,128},
+	{2,3,4,128,128,128,128,128}, {0,2,3,4,128,128,128,128}, {1,2,3,4,128,128,128,128}, {0,1,2,3,4,128,128,128},
+	{5,128,128,128,128,128,128,128}, {0,5,128,128,128,128,128,128}, {1,5,128,128,128,128,128,128}, {0,1,5,128,128,128,128,128},
+	{2,5,128,128,128,128,128,128}, {0,2,5,128,128,128,128,128}, {1,2,5,128,128,128,128,128}, {0,1,2,5,128,128,128,128},
+	{3,5,128,128,128,128,128,128}, {0,3,5,128,128,128,128,128}, {1,3,5,128,128,128,128,128}, {0,1,3,5,128,128,128,128},
+	{2,3,5,128,128,128,128,128}, {0,2,3,5,128,128,128,128}, {1,2,3,5,128,128,128,128}, {0,1,2,3,5,128,128,128},
+	{4,5,128,128,128,128,128,128}, {0,4,5,128,128,128,128,128}, {1,4,5,128,128,128,128,128}, {0,1,4,5,128,128,128,128},
+	{2,4,5,128,128,128,128,128}, {0,2,4,5,128,128,128,128}, {1,2,4,5,128,128,128,128}, {0,1,2,4,5,128,128,128},
+	{3,4,5,128,128,128,128,128}, {0,3,4,5,128,128,128,128}, {1,3,4,5,128,128,128,128}, {0,1,3,4,5,128,128,128},
+	{2,3,4,5,128,128,128,128}, {0,2,3,4,5,128,128,128}, {1,2,3,4,5,128,128,128}, {0,1,2,3,4,5,128,128},
+	{6,128,128,128,128,128,128,128}, {0,6,128,128,128,128,128,128}, {1,6,128,128,128,128,128,128}, {0,1,6,128,128,128,128,128},
+	{2,6,128,128,128,128,128,128}, {0,2,6,128,128,128,128,128}, {1,2,6,128,128,128,128,128}, {0,1,2,6,128,128,128,128},
+	{3,6,128,128,128,128,128,128}, {0,3,6,128,128,128,128,128}, {1,3,6,128,128,128,128,128}, {0,1,3,6,128,128,128,128},
+	{2,3,6,128,128,128,128,128}, {0,2,3,6,128,128,128,128}, {1,2,3,6,128,128,128,128}, {0,1,2,3,6,128,128,128},
+	{4,6,128,128,128,128,128,128}, {0,4,6,128,128,128,128,128}, {1,4,6,128,128,128,128,128}, {0,1,4,6,128,128,128,128},
+	{2,4,6,128,128,128,128,128}, {0,2,4,6,128,128,128,128}, {1,2,4,6,128,128,128,128}, {0,1,2,4,6,128,128,128},
+	{3,4,6,128,128,128,128,128}, {0,3,4,6,128,128,128,128}, {1,3,4,6,128,128,128,128}, {0,1,3,4,6,128,128,128},
+	{2,3,4,6,128,128,128,128}, {0,2,3,4,6,128,128,128}, {1,2,3,4,6,128,128,128}, {0,1,2,3,4,6,128,128},
+	{5,6,128,128,128,128,128,128}, {0,5,6,128,128,128,128,128}, {1,5,6,128,128,128,128,128}, {0,1,5,6,128,128,128,128},
+	{2,5,6,128,128,128,128,128}, {0,2,5,6,128,128,128,128}, {1,2,5,6,128,128,128,128}, {0,1,2,5,6,128,128,128},
+	{3,5,6,128,128,128,128,128}, {0,3,5,6,128,128,128,128}, {1,3,5,6,128,128,128,128}, {0,1,3,5,6,128,128,128},
+	{2,3,5,6,128,128,128,128}, {0,2,3,5,6,128,128,128}, {1,2,3,5,6,128,128,128}, {0,1,2,3,5,6,128,128},
+	{4,5,6,128,128,128,128,128}, {0,4,5,6,128,128,128,128}, {1,4,5,6,128,128,128,128}, {0,1,4,5,6,128,128,128},
+	{2,4,5,6,128,128,128,128}, {0,2,4,5,6,128,128,128}, {1,2,4,5,6,128,128,128}, {0,1,2,4,5,6,128,128},
+	{3,4,5,6,128,128,128,128}, {0,3,4,5,6,128,128,128}, {1,3,4,5,6,128,128,128}, {0,1,3,4,5,6,128,128},
+	{2,3,4,5,6,128,128,128}, {0,2,3,4,5,6,128,128}, {1,2,3,4,5,6,128,128}, {0,1,2,3,4,5,6,128},
+	{7,128,128,128,128,128,128,128}, {0,7,128,128,128,128,128,128}, {1,7,128,128,128,128,128,128}, {0,1,7,128,128,128,128,128},
+	{2,7,128,128,128,128,128,128}, {0,2,7,128,128,128,128,128}, {1,2,7,128,128,128,128,128}, {0,1,2,7,128,128,128,128},
+	{3,7,128,128,128,128,128,128}, {0,3,7,128,128,128,128,128}, {1,3,7,128,128,128,128,128}, {0,1,3,7,128,128,128,128},
+	{2,3,7,128,128,128,128,128}, {0,2,3,7,128,128,128,128}, {1,2,3,7,128,128,128,128}, {0,1,2,3,7,128,128,128},
+	{4,7,128,128,128,128,128,128}, {0,4,7,128,128,128,128,128}, {1,4,7,128,128,128,128,128}, {0,1,4,7,128,128,128,128},
+	{2,4,7,128,128,128,128,128}, {0,2,4,7,128,128,128,128}, {1,2,4,7,128,128,128,128}, {0,1,2,4,7,128,128,128},
+	{3,4,7,128,128,128,128,128}, {0,3,4,7,128,128,128,128}, {1,3,4,7,128,128,128,128}, {0,1,3,4,7,128,128,128},
+	{2,3,4,7,128,128,128,128}, {0,2,3,4,7,128,128,128}, {1,2,3,4,7,128,128,128}, {0,1,2,3,4,7,128,128},
+	{5,7,128,128,128,128,128,128}, {0,5,7,128,128,128,128,128}, {1,5,7,128,128,128,128,128}, {0,1,5,7,128,128,128,128},
+	{2,5,7,128,128,128,128,128}, {0,2,5,7,128,128,128,128}, {1,2,5,7,128,128,128,128}, {0,1,2,5,7,128,128,128},
+	{3,5,7,128,128,128,128,128}, {0,3,5,7,128,128,128,128}, {1,3,5,7,128,128,128,128}, {0,1,3,5,7,128,128,128},
+	{2,3,5,7,128,128,128,128}, {0,2,3,5,7,128,128,128}, {1,2,3,5,7,128,128,128}, {0,1,2,3,5,7,128,128},
+	{4,5,7,128,128,128,128,128}, {0,4,5,7,128,128,128,128}, {1,4,5,7,128,128,128,128}, {0,1,4,5,7,128,128,128},
+	{2,4,5,7,128,128,128,128}, {0,2,4,5,7,128,128,128}, {1,2,4,5,7,128,128,128}, {0,1,2,4,5,7,128,128},
+	{3,4,5,7,128,128,128,128}, {0,3,4,5,7,128,128,128}, {1,3,4,5,7,128,128,128}, {0,1,3,4,5,7,128,128},
+	{2,3,4,5,7,128,128,128}, {0,2,3,4,5,7,128,128}, {1,2,3,4,5,7,128,128}, {0,1,2,3,4,5,7,128},
+	{6,7,128,128,128,128,128,128}, {0,6,7,128,128,128,128,128}, {1,6,7,128,128,128,128,128}, {0,1,6,7,128,128,128,128},
+	{2,6,7,128,128,128,128,128}, {0,2,6,7,128,128,128,128}, {1,2,6,7,128,128,128,128}, {0,1,2,6,7,128,128,128},
+	{3,6,7,128,128,128,128,128}, {0,3,6,7,128,128,128,128}, {1,3,6,7,128,128,128,128}, {0,1,3,6,7,128,128,128},
+	{2,3,6,7,128,128,128,128}, {0,2,3,6,7,128,128,128}, {1,2,3,6,7,128,128,128}, {0,1,2,3,6,7,128,128},
+	{4,6,7,128,128,128,128,128}, {0,4,6,7,128,128,128,128}, {1,4,6,7,128,128,128,128}, {0,1,4,6,7,128,128,128},
+	{2,4,6,7,128,128,128,128}, {0,2,4,6,7,128,128,128}, {1,2,4,6,7,128,128,128}, {0,1,2,4,6,7,128,128},
+	{3,4,6,7,128,128,128,128}, {0,3,4,6,7,128,128,128}, {1,3,4,6,7,128,128,128}, {0,1,3,4,6,7,128,128},
+	{2,3,4,6,7,128,128,128}, {0,2,3,4,6,7,128,128}, {1,2,3,4,6,7,128,128}, {0,1,2,3,4,6,7,128},
+	{5,6,7,128,128,128,128,128}, {0,5,6,7,128,128,128,128}, {1,5,6,7,128,128,128,128}, {0,1,5,6,7,128,128,128},
+	{2,5,6,7,128,128,128,128}, {0,2,5,6,7,128,128,128}, {1,2,5,6,7,128,128,128}, {0,1,2,5,6,7,128,128},
+	{3,5,6,7,128,128,128,128}, {0,3,5,6,7,128,128,128}, {1,3,5,6,7,128,128,128}, {0,1,3,5,6,7,128,128},
+	{2,3,5,6,7,128,128,128}, {0,2,3,5,6,7,128,128}, {1,2,3,5,6,7,128,128}, {0,1,2,3,5,6,7,128},
+	{4,5,6,7,128,128,128,128}, {0,4,5,6,7,128,128,128}, {1,4,5,6,7,128,128,128}, {0,1,4,5,6,7,128,128},
+	{2,4,5,6,7,128,128,128}, {0,2,4,5,6,7,128,128}, {1,2,4,5,6,7,128,128}, {0,1,2,4,5,6,7,128},
+	{3,4,5,6,7,128,128,128}, {0,3,4,5,6,7,128,128}, {1,3,4,5,6,7,128,128}, {0,1,3,4,5,6,7,128},
+	{2,3,4,5,6,7,128,128}, {0,2,3,4,5,6,7,128}, {1,2,3,4,5,6,7,128}, {0,1,2,3,4,5,6,7},
+};
+
+static const uint8_t UNPACK_SHUFFLE[256][8] = {
+	{128,128,128,128,128,128,128,128}, {0,128,128,128,128,128,128,128}, {128,0,128,128,128,128,128,128}, {0,1,128,128,128,128,128,128},
+	{128,128,0,128,128,128,128,128}, {0,128,1,128,128,128,128,128}, {128,0,1,128,128,128,128,128}, {0,1,2,128,128,128,128,128},
+	{128,128,128,0,128,128,128,128}, {0,128,128,1,128,128,128,128}, {128,0,128,1,128,128,128,128}, {0,1,128,2,128,128,128,128},
+	{128,128,0,1,128,128,128,128}, {0,128,1,2,128,128,128,128}, {128,0,1,2,128,128,128,128}, {0,1,2,3,128,128,128,128},
+	{128,128,128,128,0,128,128,128}, {0,128,128,128,1,128,128,128}, {128,0,128,128,1,128,128,128}, {0,1,128,128,2,128,128,128},
+	{128,128,0,128,1,128,128,128}, {0,128,1,128,2,128,128,128}, {128,0,1,128,2,128,128,128}, {0,1,2,128,3,128,128,128},
+	{128,128,128,0,1,128,128,128}, {0,128,128,1,2,128,128,128}, {128,0,128,1,2,128,128,128}, {0,1,128,2,3,128,128,128},
+	{128,128,0,1,2,128,128,128}, {0,128,1,2,3,128,128,128}, {128,0,1,2,3,128,128,128}, {0,1,2,3,4,128,128,128},
+	{128,128,128,128,128,0,128,128}, {0,128,128,128,128,1,128,128}, {128,0,128,128,128,1,128,128}, {0,1,128,128,128,2,128,128},
+	{128,128,0,128,128,1,128,128}, {0,128,1,128,128,2,128,128}, {128,0,1,128,128,2,128,128}, {0,1,2,128,128,3,128,128},
+	{128,128,128,0,128,1,128,128}, {0,128,128,1,128,2,128,128}, {128,0,128,1,128,2,128,128}, {0,1,128,2,128,3,128,128},
+	{128,128,0,1,128,2,128,128}, {0,128,1,2,128,3,128,128}, {128,0,1,2,128,3,128,128}, {0,1,2,3,128,4,128,128},
+	{128,128,128,128,0,1,128,128}, {0,128,128,128,1,2,128,128}, {128,0,128,128,1,2,128,128}, {0,1,128,128,2,3,128,128},
+	{128,128,0,128,1,2,128,128}, {0,128,1,128,2,3,128,128}, {128,0,1,128,2,3,128,128}, {0,1,2,128,3,4,128,128},
+	{128,128,128,0,1,2,128,128}, {0,128,128,1,2,3,128,128}, {128,0,128,1,2,3,128,128}, {0,1,128,2,3,4,128,128},
+	{128,128,0,1,2,3,128,128}, {0,128,1,2,3,4,128,128}, {128,0,1,2,3,4,128,128}, {0,1,2,3,4,5,128,128},
+	{128,128,128,128,128,128,0,128}, {0,128,128,128,128,128,1,128}, {128,0,128,128,128,128,1,128}, {0,1,128,128,128,128,2,128},
+	{128,128,0,128,128,128,1,128}, {0,128,1,128,128,128,2,128}, {128,0,1,128,128,128,2,128}, {0,1,2,128,128,128,3,128},
+	{128,128,128,0,128,128,1,128}, {0,128,128,1,128,128,2,128}, {128,0,128,1,128,128,2,128}, {0,1,128,2,128,128,3,128},
+	{128,128,0,1,128,128,2,128}, {0,128,1,2,128,128,3,128}, {128,0,1,2,128,128,3,128}, {0,1,2,3,128,128,4,128},
+	{128,128,128,128,0,128,1,128}, {0,128,128,128,1,128,2,128}, {128,0,128,128,1,128,2,128}, {0,1,128,128,2,128,3,128},
+	{128,128,0,128,1,128,2,128}, {0,128,1,128,2,128,3,128}, {128,0,1,128,2,128,3,128}, {0,1,2,128,3,128,4,128},
+	{128,128,128,0,1,128,2,128}, {0,128,128,1,2,128,3,128}, {128,0,128,1,2,128,3,128}, {0,1,128,2,3,128,4,128},
+	{128,128,0,1,2,128,3,128}, {0,128,1,2,3,128,4,128}, {128,0,1,2,3,128,4,128}, {0,1,2,3,4,128,5,128},
+	{128,128,128,128,128,0,1,128}, {0,128,128,128,128,1,2,128}, {128,0,128,128,128,1,2,128}, {0,1,128,128,128,2,3,128},
+	{128,128,0,128,128,1,2,128}, {0,128,1,128,128,2,3,128}, {128,0,1,128,128,2,3,128}, {0,1,2,128,128,3,4,128},
+	{128,128,128,0,128,1,2,128}, {0,128,128,1,128,2,3,128}, {128,0,128,1,128,2,3,128}, {0,1,128,2,128,3,4,128},
+	{128,128,0,1,128,2,3,128}, {0,128,1,2,128,3,4,128}, {128,0,1,2,128,3,4,128}, {0,1,2,3,128,4,5,128},
+	{128,128,128,128,0,1,2,128}, {0,128,128,128,1,2,3,128}, {128,0,128,128,1,2,3,128}, {0,1,128,128,2,3,4,128},
+	{128,128,0,128,1,2,3,128}, {0,128,1,128,2,3,4,128}, {128,0,1,128,2,3,4,128}, {0,1,2,128,3,4,5,128},
+	{128,128,128,0,1,2,3,128}, {0,128,128,1,2,3,4,128}, {128,0,128,1,2,3,4,128}, {0,1,128,2,3,4,5,128},
+	{128,128,0,1,2,3,4,128}, {0,128,1,2,3,4,5,128}, {128,0,1,2,3,4,5,128}, {0,1,2,3,4,5,6,128},
+	{128,128,128,128,128,128,128,0}, {0,128,128,128,128,128,128,1}, {128,0,128,128,128,128,128,1}, {0,1,128,128,128,128,128,2},
+	{128,128,0,128,128,128,128,1}, {0,128,1,128,128,128,128,2}, {128,0,1,128,128,128,128,2}, {0,1,2,128,128,128,128,3},
+	{128,128,128,0,128,128,128,1}, {0,128,128,1,128,128,128,2}, {128,0,128,1,128,128,128,2}, {0,1,128,2,128,128,128,3},
+	{128,128,0,1,128,128,128,2}, {0,128,1,2,128,128,128,3}, {128,0,1,2,128,128,128,3}, {0,1,2,3,128,128,128,4},
+	{128,128,128,128,0,128,128,1}, {0,128,128,128,1,128,128,2}, {128,0,128,128,1,128,128,2}, {0,1,128,128,2,128,128,3},
+	{128,128,0,128,1,128,128,2}, {0,128,1,128,2,128,128,3}, {128,0,1,128,2,128,128,3}, {0,1,2,128,3,128,128,4},
+	{128,128,128,0,1,128,128,2}, {0,128,128,1,2,128,128,3}, {128,0,128,1,2,128,128,3}, {0,1,128,2,3,128,128,4},
+	{128,128,0,1,2,128,128,3}, {0,128,1,2,3,128,128,4}, {128,0,1,2,3,128,128,4}, {0,1,2,3,4,128,128,5},
+	{128,128,128,128,128,0,128,1}, {0,128,128,128,128,1,128,2}, {128,0,128,128,128,1,128,2}, {0,1,128,128,128,2,128,3},
+	{128,128,0,128,128,1,128,2}, {0,128,1,128,128,2,128,3}, {128,0,1,128,128,2,128,3}, {0,1,2,128,128,3,128,4},
+	{128,128,128,0,128,1,128,2}, {0,128,128,1,128,2,128,3}, {128,0,128,1,128,2,128,3}, {0,1,128,2,128,3,128,4},
+	{128,128,0,1,128,2,128,3}, {0,128,1,2,128,3,128,4}, {128,0,1,2,128,3,128,4}, {0,1,2,3,128,4,128,5},
+	{128,128,128,128,0,1,128,2}, {0,128,128,128,1,2,128,3}, {128,0,128,128,1,2,128,3}, {0,1,128,128,2,3,128,4},
+	{128,128,0,128,1,2,128,3}, {0,128,1,128,2,3,128,4}, {128,0,1,128,2,3,128,4}, {0,1,2,128,3,4,128,5},
+	{128,128,128,0,1,2,128,3}, {0,128,128,1,2,3,128,4}, {128,0,128,1,2,3,128,4}, {0,1,128,2,3,4,128,5},
+	{128,128,0,1,2,3,128,4}, {0,128,1,2,3,4,128,5}, {128,0,1,2,3,4,128,5}, {0,1,2,3,4,5,128,6},
+	{128,128,128,128,128,128,0,1}, {0,128,128,128,128,128,1,2}, {128,0,128,128,128,128,1,2}, {0,1,128,128,128,128,2,3},
+	{128,128,0,128,128,128,1,2}, {0,128,1,128,128,128,2,3}, {128,0,1,128,128,128,2,3}, {0,1,2,128,128,128,3,4},
+	{128,128,128,0,128,128,1,2}, {0,128,128,1,128,128,2,3}, {128,0,128,1,128,128,2,3}, {0,1,128,2,128,128,3,4},
+	{128,128,0,1,128,128,2,3}, {0,128,1,2,128,128,3,4}, {128,0,1,2,128,128,3,4}, {0,1,2,3,128,128,4,5},
+	{128,128,128,128,0,128,1,2}, {0,128,128,128,1,128,2,3}, {128,0,128,128,1,128,2,3}, {0,1,128,128,2,128,3,4},
+	{128,128,0,128,1,128,2,3}, {0,128,1,128,2,128,3,4}, {128,0,1,128,2,128,3,4}, {0,1,2,128,3,128,4,5},
+	{128,128,128,0,1,128,2,3}, {0,128,128,1,2,128,3,4}, {128,0,128,1,2,128,3,4}, {0,1,128,2,3,128,4,5},
+	{128,128,0,1,2,128,3,4}, {0,128,1,2,3,128,4,5}, {128,0,1,2,3,128,4,5}, {0,1,2,3,4,128,5,6},
+	{128,128,128,128,128,0,1,2}, {0,128,128,128,128,1,2,3}, {128,0,128,128,128,1,2,3}, {0,1,128,128,128,2,3,4},
+	{128,128,0,128,128,1,2,3}, {0,128,1,128,128,2,3,4}, {128,0,1,128,128,2,3,4}, {0,1,2,128,128,3,4,5},
+	{128,128,128,0,128,1,2,3}, {0,128,128,1,128,2,3,4}, {128,0,128,1,128,2,3,4}, {0,1,128,2,128,3,4,5},
+	{128,128,0,1,128,2,3,4}, {0,128,1,2,128,3,4,5}, {128,0,1,2,128,3,4,5}, {0,1,2,3,128,4,5,6},
+	{128,128,128,128,0,1,2,3}, {0,128,128,128,1,2,3,4}, {128,0,128,128,1,2,3,4}, {0,1,128,128,2,3,4,5},
+	{128,128,0,128,1,2,3,4}, {0,128,1,128,2,3,4,5}, {128,0,1,128,2,3,4,5}, {0,1,2,128,3,4,5,6},
+	{128,128,128,0,1,2,3,4}, {0,128,128,1,2,3,4,5}, {128,0,128,1,2,3,4,5}, {0,1,128,2,3,4,5,6},
+	{128,128,0,1,2,3,4,5}, {0,128,1,2,3,4,5,6}, {128,0,1,2,3,4,5,6}, {0,1,2,3,4,5,6,7},
+};
+
+#endif
+
+static inline int
+popcount8(int x) {
+	x = x - ((x >> 1) & 0x55);
+	x = (x & 0x33) + ((x >> 2) & 0x33);
+	return (x + (x >> 4)) & 0x0f;
+}
+
+// bit i is set if src[i] != 0
+static inline int
+nonzero_mask(const uint8_t *src) {
+#if defined(__SSE2__)
+	__m128i v = _mm_loadl_epi64((const __m128i *)src);
+	int zero = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+	return ~zero & 0xff;
+#else
+	int i;
+	int mask = 0;
+	for (i=0;i<8;i++) {
+		mask |= (src[i] != 0) << i;
+	}
+	return mask;
+#endif
+}
+
+// write the non-zero bytes of src, always writes 8 bytes
+static inline void
+compact8(const uint8_t *src, uint8_t *des, int mask) {
+#if defined(__SSSE3__)
+	__m128i v = _mm_loadl_epi64((const __m128i *)src);
+	__m128i shuffle = _mm_loadl_epi64((const __m128i *)PACK_SHUFFLE[mask]);
+	_mm_storel_epi64((__m128i *)des, _mm_shuffle_epi8(v, shuffle));
+#else
+	int i;
+	for (i=0;i<8;i++) {
+		*des = src[i];
+		des += (mask >> i) & 1;
+	}
+#endif
+}
+
+// expand the non-zero bytes in src, reads 8 bytes
+static inline void
+expand8(const uint8_t *src, uint8_t *des, int mask) {
+#if defined(__SSSE3__)
+	__m128i v = _mm_loadl_epi64((const __m128i *)src);
+	__m128i shuffle = _mm_loadl_epi64((const __m128i *)UNPACK_SHUFFLE[mask]);
+	_mm_storel_epi64((__m128i *)des, _mm_shuffle_epi8(v, shuffle));
+#else
+	int i;
+	for (i=0;i<8;i++) {
+		int nz = (mask >> i) & 1;
+		des[i] = nz ? *src : 0;
+		src += nz;
+	}
+#endif
+}
+
+// the same as pack_seg, but the buffer must be larger than 10 bytes
+static inline int
+pack_seg_fast(const uint8_t *src, uint8_t * buffer, int n) {
+	int header = nonzero_mask(src);
+	int notzero = popcount8(header);
+	compact8(src, buffer+1, header);
+	if ((notzero == 7 || notzero == 6) && n > 0) {
+		notzero = 8;
+	}
+	if (notzero == 8) {
+		if (n > 0) {
+			return 8;
+		} else {
+			return 10;
+		}
+	}
+	*buffer = header;
+	return notzero + 1;
+}
+
 static int
 pack_seg(const uint8_t *src, uint8_t * buffer, int sz, int n) {
 	uint8_t header = 0;
@@ -1278,7 +1520,11 @@ sproto_pack(const void * srcv, int srcsz, void * bufferv, int bufsz) {
 			}
 			src = tmp;
 		}
-		n = pack_seg(src, buffer, bufsz, ff_n);
+		if (bufsz >= 10) {
+			n = pack_seg_fast(src, buffer, ff_n);
+		} else {
+			n = pack_seg(src, buffer, bufsz, ff_n);
+		}
 		bufsz -= n;
 		if (n == 10) {
 			// first FF
@@ -1340,6 +1586,14 @@ sproto_unpack(const void * srcv, int srcsz, void * bufferv, int bufsz) {
 			buffer += n;
 			src += n;
 			size += n;
+		} else if (srcsz >= 8 && bufsz >= 8) {
+			int n = popcount8(header);
+			expand8(src, buffer, header);
+			src += n;
+			srcsz -= n;
+			buffer += 8;
+			bufsz -= 8;
+			size += 8;
 		} else {
 			int i;
 			for (i=0;i<8;i++) {
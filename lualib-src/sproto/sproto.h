@@ -30,6 +30,8 @@ int sproto_prototag(const struct sproto *, const char * name);
 const char * sproto_protoname(const struct sproto *, int proto);
 // SPROTO_REQUEST(0) : request, SPROTO_RESPONSE(1): response
 struct sproto_type * sproto_protoquery(const struct sproto *, int proto, int what);
+// the name and tag of the protocol [index] (from 0), return NULL if index is out of range
+const char * sproto_protocol(const struct sproto *, int index, int *tag);
 
 struct sproto_type * sproto_type(const struct sproto *, const char * type_name);
 
@@ -54,6 +56,9 @@ typedef int (*sproto_callback)(const struct sproto_arg *args);
 int sproto_decode(const struct sproto_type *, const void * data, int size, sproto_callback cb, void *ud);
 int sproto_encode(const struct sproto_type *, void * buffer, int size, sproto_callback cb, void *ud);
 
+// the name and tag of the field [index] (from 0) of a type, return NULL if index is out of range
+const char * sproto_field(const struct sproto_type *, int index, int *tag);
+
 // for debug use
 void sproto_dump(struct sproto *);
 const char * sproto_name(struct sproto_type *);
@@ -48,6 +48,11 @@ function cluster.query(node, name)
 	return skynet.call(clusterd, "lua", "req", node, 0, skynet.pack(name))
 end
 
+-- return the request stat of node (or all the nodes) : { inflight, request, error, avg, max }, time in ms
+function cluster.stat(node)
+	return skynet.call(clusterd, "lua", "stat", node)
+end
+
 skynet.init(function()
 	clusterd = skynet.uniqueservice("clusterd")
 end)
@@ -2,17 +2,67 @@ local skynet = require "skynet"
 
 local datacenter = {}
 
+local shards	-- the datacenterd services, the top level keys are sharded by hash
+local cache	-- datacentercache service in this node
+
+-- the hash must be the same in all nodes, so don't use the address of lua string
+local function hash(key)
+	if math.type(key) == "integer" then
+		return key
+	end
+	key = tostring(key)
+	local h = #key
+	for i = 1, #key do
+		h = (h * 31 + key:byte(i)) & 0x7fffffff
+	end
+	return h
+end
+
+local function get_shards()
+	if shards == nil then
+		shards = skynet.call("DATACENTER", "lua", "SHARD")
+	end
+	return shards
+end
+
+-- don't cache the address of each key, the keys may be unbounded
+function datacenter.shard(key)
+	local shards = get_shards()
+	local n = #shards
+	if n == 1 then
+		return shards[1]
+	end
+	return shards[hash(key) % n + 1]
+end
+
+-- read through the cache of this node
 function datacenter.get(...)
-	return skynet.call("DATACENTER", "lua", "QUERY", ...)
+	if select("#", ...) == 0 then
+		-- the whole database (not cached), merge all the shards
+		local shards = get_shards()
+		if #shards == 1 then
+			return skynet.call(shards[1], "lua", "QUERY")
+		end
+		local db = {}
+		for _, address in ipairs(shards) do
+			for k, v in pairs(skynet.call(address, "lua", "QUERY")) do
+				db[k] = v
+			end
+		end
+		return db
+	end
+	if cache == nil then
+		cache = skynet.uniqueservice "datacentercache"
+	end
+	return skynet.call(cache, "lua", "GET", ...)
 end
 
-function datacenter.set(...)
-	return skynet.call("DATACENTER", "lua", "UPDATE", ...)
+function datacenter.set(key, ...)
+	return skynet.call(datacenter.shard(key), "lua", "UPDATE", key, ...)
 end
 
-function datacenter.wait(...)
-	return skynet.call("DATACENTER", "lua", "WAIT", ...)
+function datacenter.wait(key, ...)
+	return skynet.call(datacenter.shard(key), "lua", "WAIT", key, ...)
 end
 
 return datacenter
-
@@ -68,8 +68,9 @@ local collection_meta =	{
 local function dispatch_reply(so)
 	local len_reply	= so:read(4)
 	local reply	= so:read(driver.length(len_reply))
-	local result = { result	= {} }
-	local succ,	reply_id, document,	cursor_id, startfrom = driver.reply(reply, result.result)
+	local result = {}
+	-- the documents are walked by driver.next lazily, don't decode them here
+	local succ,	reply_id, document,	cursor_id, startfrom = driver.reply(reply)
 	result.document	= document
 	result.cursor_id = cursor_id
 	result.startfrom = startfrom
@@ -569,9 +570,10 @@ function mongo_cursor:hasNext()
 
 		if ok then
 			if doc then
-				self.__document	= result.result
+				-- __document is the first document, and __ptr is the current one in __data
+				self.__document	= doc
 				self.__data	= result.data
-				self.__ptr = 1
+				self.__ptr = doc
 				self.__cursor =	cursor
 				return true
 			else
@@ -596,19 +598,28 @@ function mongo_cursor:hasNext()
 	return true
 end
 
-function mongo_cursor:next()
-	if self.__ptr == nil then
+-- fields { key = true } (optional) : only decode these keys of the document
+function mongo_cursor:next(fields)
+	local ptr = self.__ptr
+	if ptr == nil then
 		error "Call	hasNext	first"
 	end
-	local r	= bson_decode(self.__document[self.__ptr])
-	self.__ptr = self.__ptr	+ 1
-	if self.__ptr >	#self.__document then
-		self.__ptr = nil
-	end
+	local r	= bson_decode(ptr, fields)
+	self.__ptr = driver.next(self.__data, ptr)
 
 	return r
 end
 
+-- for doc in cursor:documents(fields) do ... end
+-- Iterate all the documents, only one batch of raw reply is hold.
+function mongo_cursor:documents(fields)
+	return function()
+		if self:hasNext() then
+			return self:next(fields)
+		end
+	end
+end
+
 function mongo_cursor:close()
 	-- todo: warning hasNext after close
 	if self.__cursor then
@@ -51,6 +51,13 @@ function chan:publish(...)
 	skynet.call(multicastd, "lua", "PUB", c, mc.pack(self.__pack(...)))
 end
 
+-- return the delivery stat of the channel in this node
+-- { message, bytes, delivered, transfer, subscribers, nodes }
+function chan:stat()
+	local c = assert(self.channel)
+	return skynet.call(multicastd, "lua", "STAT", c)
+end
+
 function chan:subscribe()
 	local c = assert(self.channel)
 	if self.__subscribe then
@@ -44,6 +44,17 @@ function sharedata.update(name, v, ...)
 	skynet.call(service, "lua", "update", name, v, ...)
 end
 
+-- changes : { { path, value }, ... } , path is a key or a list of keys, a nil value deletes the key.
+-- Only the changed sub tables are rebuilt, the others are shared with the old version.
+function sharedata.patch(name, changes)
+	skynet.call(service, "lua", "patch", name, changes)
+end
+
+-- Map a snapshot file (see examples/snapshot.lua) as the new version of name.
+function sharedata.map(name, filename)
+	skynet.call(service, "lua", "map", name, filename)
+end
+
 function sharedata.delete(name)
 	skynet.call(service, "lua", "delete", name)
 end
@@ -55,6 +66,11 @@ function sharedata.flush()
 	collectgarbage()
 end
 
+-- Bulk accessors of the array part of a shared object (obj is returned by query), see sharedata.corelib
+sharedata.slice = sd.slice
+sharedata.sum = sd.sum
+sharedata.bsearch = sd.bsearch
+
 function sharedata.deepcopy(name, ...)
 	if cache[name] then
 		local cobj = cache[name].__obj
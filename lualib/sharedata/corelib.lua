@@ -7,6 +7,9 @@ local conf = {}
 
 conf.host = {
 	new = core.new,
+	patch = core.patch,
+	save = core.save,
+	map = core.map,
 	delete = core.delete,
 	getref = core.getref,
 	markdirty = core.markdirty,
@@ -56,13 +59,15 @@ end
 
 local function getcobj(self)
 	local obj = self.__obj
-	if isdirty(obj) then
+	-- check the root version, because the sub table may be shared with an older version
+	if isdirty(self.__gcobj) then
 		local newobj, newtbl = needupdate(self.__gcobj)
 		if newobj then
 			local newgcobj = newtbl.__gcobj
 			local root = findroot(self)
 			update(root, newobj, newgcobj)
-			if obj == self.__obj then
+			-- the unchanged sub table keeps the same pointer, so check if it is still in the tree
+			if self.__gcobj ~= newgcobj then
 				error ("The key [" .. genkey(self) .. "] doesn't exist after update")
 			end
 			obj = self.__obj
@@ -129,6 +134,28 @@ function conf.update(self, pointer)
 	core.update(self.__gcobj, pointer, { __gcobj = core.box(pointer) })
 end
 
+-- bulk accessors of the array part, a packed number column is read without one call per element
+
+function conf.slice(obj, i, j)
+	local r = core.slice(getcobj(obj), i, j)
+	local from = math.max(i or 1, 1) - 1
+	for k, v in ipairs(r) do
+		if type(v) == "userdata" then
+			r[k] = obj[from + k]
+		end
+	end
+	return r
+end
+
+function conf.sum(obj, i, j)
+	return core.sum(getcobj(obj), i, j)
+end
+
+-- the last index k with obj[k] <= v in a sorted array, 0 if v < obj[1]
+function conf.bsearch(obj, v)
+	return core.bsearch(getcobj(obj), v)
+end
+
 function conf.flush(obj)
 	getcobj(obj)
 end
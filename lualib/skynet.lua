@@ -377,6 +377,13 @@ end
 skynet.pack = assert(c.pack)
 skynet.packstring = assert(c.packstring)
 skynet.unpack = assert(c.unpack)
+-- lazyunpack returns the tables as lazy (read only) views, which are decoded on demand.
+-- skynet.pack forwards a view as its raw bytes, and skynet.viewtable unpacks a view fully.
+skynet.lazyunpack = assert(c.lazyunpack)
+skynet.viewtable = assert(c.viewtable)
+-- skynet.stringref(true) lets skynet.pack of this service write the repeated strings as back references (off by default).
+-- Enable it only if all the receivers can unpack them; skynet.lazyunpack can't make views of such messages, it unpacks them fully.
+skynet.stringref = assert(c.stringref)
 skynet.tostring = assert(c.tostring)
 skynet.trash = assert(c.trash)
 
@@ -23,4 +23,9 @@ function harbor.linkmaster()
 	skynet.call(".cslave", "lua", "LINKMASTER")
 end
 
+-- throughput of each connected harbor : { [id] = { send_msg, send_bytes, send_write, recv_msg, recv_bytes, status } }
+function harbor.stat()
+	return skynet.call(".cslave", "lua", "STAT")
+end
+
 return harbor
@@ -38,7 +38,7 @@ function gateserver.start(handler)
 		maxclient = conf.maxclient or 1024
 		nodelay = conf.nodelay
 		skynet.error(string.format("Listen on %s:%d", address, port))
-		socket = socketdriver.listen(address, port)
+		socket = socketdriver.listen(address, port, conf.backlog, conf.reuseport)
 		socketdriver.start(socket)
 		if handler.open then
 			return handler.open(source, conf)
@@ -4,13 +4,12 @@ local skynet_core = require "skynet.core"
 local assert = assert
 
 local socket = {}	-- api
-local buffer_pool = {}	-- store all message buffer object
 local socket_pool = setmetatable( -- store all socket object
 	{},
 	{ __gc = function(p)
 		for id,v in pairs(p) do
 			driver.close(id)
-			-- don't need clear v.buffer, because buffer pool will be free at the end
+			-- don't need clear v.buffer, because the buffer object frees itself in __gc
 			p[id] = nil
 		end
 	end
@@ -48,7 +47,7 @@ socket_message[1] = function(id, size, data)
 		return
 	end
 
-	local sz = driver.push(s.buffer, buffer_pool, data, size)
+	local sz = driver.push(s.buffer, data, size)
 	local rr = s.read_required
 	local rrt = type(rr)
 	if rrt == "number" then
@@ -60,13 +59,13 @@ socket_message[1] = function(id, size, data)
 	else
 		if s.buffer_limit and sz > s.buffer_limit then
 			skynet.error(string.format("socket buffer overflow: fd=%d size=%d", id , sz))
-			driver.clear(s.buffer,buffer_pool)
+			driver.clear(s.buffer)
 			driver.close(id)
 			return
 		end
 		if rrt == "string" then
 			-- read line
-			if driver.readline(s.buffer,nil,rr) then
+			if driver.readline(s.buffer,rr,true) then
 				s.read_required = nil
 				wakeup(s)
 			end
@@ -215,7 +214,7 @@ local function close_fd(id, func)
 	local s = socket_pool[id]
 	if s then
 		if s.buffer then
-			driver.clear(s.buffer,buffer_pool)
+			driver.clear(s.buffer)
 		end
 		if s.connected then
 			func(id)
@@ -262,7 +261,7 @@ function socket.read(id, sz)
 	assert(s)
 	if sz == nil then
 		-- read some bytes
-		local ret = driver.readall(s.buffer, buffer_pool)
+		local ret = driver.readall(s.buffer)
 		if ret ~= "" then
 			return ret
 		end
@@ -273,7 +272,7 @@ function socket.read(id, sz)
 		assert(not s.read_required)
 		s.read_required = 0
 		suspend(s)
-		ret = driver.readall(s.buffer, buffer_pool)
+		ret = driver.readall(s.buffer)
 		if ret ~= "" then
 			return ret
 		else
@@ -281,57 +280,89 @@ function socket.read(id, sz)
 		end
 	end
 
-	local ret = driver.pop(s.buffer, buffer_pool, sz)
+	local ret = driver.pop(s.buffer, sz)
 	if ret then
 		return ret
 	end
 	if not s.connected then
-		return false, driver.readall(s.buffer, buffer_pool)
+		return false, driver.readall(s.buffer)
 	end
 
 	assert(not s.read_required)
 	s.read_required = sz
 	suspend(s)
-	ret = driver.pop(s.buffer, buffer_pool, sz)
+	ret = driver.pop(s.buffer, sz)
 	if ret then
 		return ret
 	else
-		return false, driver.readall(s.buffer, buffer_pool)
+		return false, driver.readall(s.buffer)
 	end
 end
 
+-- peek sz bytes (at offset) without copying them out of the buffer.
+-- It returns a lightuserdata pointer and sz, which is valid until the next operation on this socket.
+-- Use socket.skip to discard the bytes after handling them.
+function socket.peek(id, sz, offset)
+	local s = socket_pool[id]
+	assert(s)
+	offset = offset or 0
+	local ptr = driver.peek(s.buffer, sz, offset)
+	if ptr then
+		return ptr, sz
+	end
+	if not s.connected then
+		return false
+	end
+
+	assert(not s.read_required)
+	s.read_required = sz + offset
+	suspend(s)
+	ptr = driver.peek(s.buffer, sz, offset)
+	if ptr then
+		return ptr, sz
+	else
+		return false
+	end
+end
+
+function socket.skip(id, sz)
+	local s = socket_pool[id]
+	assert(s)
+	return driver.skip(s.buffer, sz)
+end
+
 function socket.readall(id)
 	local s = socket_pool[id]
 	assert(s)
 	if not s.connected then
-		local r = driver.readall(s.buffer, buffer_pool)
+		local r = driver.readall(s.buffer)
 		return r ~= "" and r
 	end
 	assert(not s.read_required)
 	s.read_required = true
 	suspend(s)
 	assert(s.connected == false)
-	return driver.readall(s.buffer, buffer_pool)
+	return driver.readall(s.buffer)
 end
 
 function socket.readline(id, sep)
 	sep = sep or "\n"
 	local s = socket_pool[id]
 	assert(s)
-	local ret = driver.readline(s.buffer, buffer_pool, sep)
+	local ret = driver.readline(s.buffer, sep)
 	if ret then
 		return ret
 	end
 	if not s.connected then
-		return false, driver.readall(s.buffer, buffer_pool)
+		return false, driver.readall(s.buffer)
 	end
 	assert(not s.read_required)
 	s.read_required = sep
 	suspend(s)
 	if s.connected then
-		return driver.readline(s.buffer, buffer_pool, sep)
+		return driver.readline(s.buffer, sep)
 	else
-		return false, driver.readall(s.buffer, buffer_pool)
+		return false, driver.readall(s.buffer)
 	end
 end
 
@@ -349,6 +380,8 @@ end
 socket.write = assert(driver.send)
 socket.lwrite = assert(driver.lsend)
 socket.header = assert(driver.header)
+-- return accept, wakeup, fail (see socketdriver.accept_stat)
+socket.accept_stat = assert(driver.accept_stat)
 
 function socket.invalid(id)
 	return socket_pool[id] == nil
@@ -395,7 +428,7 @@ end
 function socket.abandon(id)
 	local s = socket_pool[id]
 	if s and s.buffer then
-		driver.clear(s.buffer,buffer_pool)
+		driver.clear(s.buffer)
 	end
 	socket_pool[id] = nil
 end
@@ -404,6 +404,20 @@ function channel:request(request, response, padding)
 	return wait_for_response(self, response)
 end
 
+-- write the request (a string) only, and wait for the response by channel:response later.
+-- It never connects, return false if the channel is not connected.
+function channel:write(request)
+	if check_connection(self) ~= true then
+		return false
+	end
+	if not socket_write(self.__sock[1], request) then
+		close_channel_socket(self)
+		wakeup_all(self)
+		return false
+	end
+	return true
+end
+
 function channel:response(response)
 	assert(block_connect(self))
 
@@ -38,16 +38,6 @@ function sproto.parse(ptext)
 	return sproto.new(pbin)
 end
 
-function sproto:host( packagename )
-	packagename = packagename or  "package"
-	local obj = {
-		__proto = self,
-		__package = assert(core.querytype(self.__cobj, packagename), "type package not found"),
-		__session = {},
-	}
-	return setmetatable(obj, host_mt)
-end
-
 local function querytype(self, typename)
 	local v = self.__tcache[typename]
 	if not v then
@@ -108,6 +98,32 @@ local function queryproto(self, pname)
 	return v
 end
 
+-- the array of all the protocols indexed by tag, compiled once
+local function protocols(self)
+	local tags = self.__tags
+	if not tags then
+		tags = {}
+		for name in pairs(core.protocols(self.__cobj)) do
+			local p = queryproto(self, name)
+			tags[p.tag] = p
+		end
+		self.__tags = tags
+	end
+	return tags
+end
+
+function sproto:host( packagename )
+	packagename = packagename or  "package"
+	local obj = {
+		__proto = self,
+		__package = assert(core.querytype(self.__cobj, packagename), "type package not found"),
+		__session = {},
+		__tags = protocols(self),
+		__handler = {},
+	}
+	return setmetatable(obj, host_mt)
+end
+
 function sproto:exist_proto(pname)
 	local v = self.__pcache[pname]
 	if not v then
@@ -194,35 +210,86 @@ local function gen_response(self, response, session)
 	end
 end
 
-function host:dispatch(...)
+-- decode the header into header_tmp, return the content offset
+local function decode_header(self, ...)
 	local bin = core.unpack(...)
 	header_tmp.type = nil
 	header_tmp.session = nil
 	header_tmp.ud = nil
-	local header, size = core.decode(self.__package, bin, header_tmp)
-	local content = bin:sub(size + 1)
-	if header.type then
+	local _, size = core.decode(self.__package, bin, header_tmp)
+	return bin, size
+end
+
+local function dispatch_response(self, bin, size)
+	local session = assert(header_tmp.session, "session not found")
+	local response = assert(self.__session[session], "Unknown session")
+	self.__session[session] = nil
+	if response == true then
+		return "RESPONSE", session, nil, header_tmp.ud
+	else
+		local result = core.decode(response, bin, nil, size)
+		return "RESPONSE", session, result, header_tmp.ud
+	end
+end
+
+function host:dispatch(...)
+	local bin, size = decode_header(self, ...)
+	local tag = header_tmp.type
+	if tag then
 		-- request
-		local proto = queryproto(self.__proto, header.type)
+		local proto = self.__tags[tag] or error("Unknown protocol " .. tag)
 		local result
 		if proto.request then
-			result = core.decode(proto.request, content)
+			result = core.decode(proto.request, bin, nil, size)
 		end
 		if header_tmp.session then
-			return "REQUEST", proto.name, result, gen_response(self, proto.response, header_tmp.session), header.ud
+			return "REQUEST", proto.name, result, gen_response(self, proto.response, header_tmp.session), header_tmp.ud
 		else
-			return "REQUEST", proto.name, result, nil, header.ud
+			return "REQUEST", proto.name, result, nil, header_tmp.ud
 		end
 	else
-		-- response
-		local session = assert(header_tmp.session, "session not found")
-		local response = assert(self.__session[session], "Unknown session")
-		self.__session[session] = nil
-		if response == true then
-			return "RESPONSE", session, nil, header.ud
+		return dispatch_response(self, bin, size)
+	end
+end
+
+-- handlers : { [protoname] = function(args, ud) return response end }
+function host:register(handlers)
+	for name, f in pairs(handlers) do
+		local proto = queryproto(self.__proto, name)
+		self.__handler[proto.tag] = f
+	end
+end
+
+-- Call the registered handler of the request directly.
+-- Returns the packed response if the request has a session (the handler returns the response table),
+-- or "RESPONSE", session, result, ud for a response package (like host:dispatch).
+function host:handle(...)
+	local bin, size = decode_header(self, ...)
+	local tag = header_tmp.type
+	if not tag then
+		return dispatch_response(self, bin, size)
+	end
+	local f = self.__handler[tag]
+	if not f then
+		error("No handler for protocol " .. tag)
+	end
+	local proto = self.__tags[tag]
+	local session = header_tmp.session
+	local args
+	if proto.request then
+		args = core.decode(proto.request, bin, nil, size)
+	end
+	-- the handler may yield and reenter, don't use header_tmp after it
+	local r = f(args, header_tmp.ud)
+	if session then
+		header_tmp.type = nil
+		header_tmp.session = session
+		header_tmp.ud = nil
+		local header = core.encode(self.__package, header_tmp)
+		if proto.response then
+			return core.pack(header .. core.encode(proto.response, r))
 		else
-			local result = core.decode(response, content)
-			return "RESPONSE", session, result, header.ud
+			return core.pack(header)
 		end
 	end
 end
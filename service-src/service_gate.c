@@ -1,6 +1,5 @@
 #include "skynet.h"
 #include "skynet_socket.h"
-#include "databuffer.h"
 #include "hashid.h"
 
 #include <stdlib.h>
@@ -14,6 +13,8 @@
 // gate服务用与skynet对外的TCP通信 它将外部的消息格式转化成skynet内部的消息
 
 #define BACKLOG 32
+// Free the pending buffer of a connection when it's drained and larger than this
+#define PENDING_SHRINK (64 * 1024)
 
 // 1.watchdog 模式，由 gate 加上包头，同时处理控制信息和数据信息的所有数据；
 // 2.agent    模式，让每个 agent 处理独立连接；
@@ -27,7 +28,25 @@ struct connection {
 	uint32_t agent;
 	uint32_t client;
 	char remote_name[32];
-	struct databuffer buffer;
+	// bytes of the incomplete package (header included) from the last socket read
+	char * pending;
+	int pending_cap;
+	int pending_size;
+};
+
+/*
+	In batch mode, all the complete packages from one socket read are forwarded
+	to the agent (or broker) in one PTYPE_CLIENT message :
+
+	uint32_t n;
+	struct { uint32_t offset; uint32_t size; } package[n];	// offset from the beginning of the message
+	package data ...
+
+	Use netpack.batch to read it in lua.
+ */
+struct batch_item {
+	uint32_t offset;
+	uint32_t size;
 };
 
 // 对外的 tcp连接
@@ -39,10 +58,14 @@ struct gate {
 	int client_tag;
 	int header_size;
 	int max_connection;
+	int batch;
+	int reuseport;
+	int backlog;
 	struct hashid hash;
 	struct connection *conn;   // 客户端连接fd的保存
-	// todo: save message pool ptr for release
-	struct messagepool mp;
+	// packages parsed from one socket read (batch mode)
+	struct batch_item *item;
+	int item_cap;
 };
 
 struct gate *
@@ -66,9 +89,12 @@ gate_release(struct gate *g) {
 	if (g->listen_id >= 0) {
 		skynet_socket_close(ctx, g->listen_id);
 	}
-	messagepool_free(&g->mp);
+	for (i=0;i<g->max_connection;i++) {
+		skynet_free(g->conn[i].pending);
+	}
 	hashid_clear(&g->hash);
 	skynet_free(g->conn);
+	skynet_free(g->item);
 	skynet_free(g);
 }
 
@@ -177,46 +203,159 @@ _report(struct gate * g, const char * data, ...) {
 	skynet_send(ctx, 0, g->watchdog, PTYPE_TEXT,  0, tmp, n);
 }
 
-static void
-_forward(struct gate *g, struct connection * c, int size) {
-	struct skynet_context * ctx = g->ctx;
+static uint32_t
+_destination(struct gate *g, struct connection * c, uint32_t *source) {
 	if (g->broker) {
-		void * temp = skynet_malloc(size);
-		databuffer_read(&c->buffer,&g->mp,temp, size);
-		skynet_send(ctx, 0, g->broker, g->client_tag | PTYPE_TAG_DONTCOPY, 1, temp, size);
-		return;
+		*source = 0;
+		return g->broker;
 	}
-	if (c->agent) {
+	*source = c->client;
+	return c->agent;
+}
+
+static void
+_forward(struct gate *g, struct connection * c, const char * data, int size) {
+	struct skynet_context * ctx = g->ctx;
+	uint32_t source;
+	uint32_t dest = _destination(g, c, &source);
+	if (dest) {
 		void * temp = skynet_malloc(size);
-		databuffer_read(&c->buffer,&g->mp,temp, size);
-		skynet_send(ctx, c->client, c->agent, g->client_tag | PTYPE_TAG_DONTCOPY, 1 , temp, size);
+		memcpy(temp, data, size);
+		skynet_send(ctx, source, dest, g->client_tag | PTYPE_TAG_DONTCOPY, 1, temp, size);
 	} else if (g->watchdog) {
 		char * tmp = skynet_malloc(size + 32);
 		int n = snprintf(tmp,32,"%d data ",c->id);
-		databuffer_read(&c->buffer,&g->mp,tmp+n,size);
+		memcpy(tmp+n,data,size);
 		skynet_send(ctx, 0, g->watchdog, PTYPE_TEXT | PTYPE_TAG_DONTCOPY, 1, tmp, size + n);
 	}
 }
+
+static void
+_forward_batch(struct gate *g, struct connection * c, const char * data, int n, int total) {
+	uint32_t source;
+	uint32_t dest = _destination(g, c, &source);
+	if (dest == 0) {
+		int i;
+		for (i=0;i<n;i++) {
+			_forward(g, c, data + g->item[i].offset, g->item[i].size);
+		}
+		return;
+	}
+	size_t header = sizeof(uint32_t) + n * sizeof(struct batch_item);
+	char * msg = skynet_malloc(header + total);
+	char * ptr = msg + header;
+	struct batch_item * item = (struct batch_item *)(msg + sizeof(uint32_t));
+	*(uint32_t *)msg = n;
+	int i;
+	for (i=0;i<n;i++) {
+		int size = g->item[i].size;
+		item[i].offset = ptr - msg;
+		item[i].size = size;
+		memcpy(ptr, data + g->item[i].offset, size);
+		ptr += size;
+	}
+	skynet_send(g->ctx, source, dest, g->client_tag | PTYPE_TAG_DONTCOPY, 1, msg, header + total);
+}
+
+static void
+_pending_reserve(struct connection *c, int sz) {
+	if (sz <= c->pending_cap)
+		return;
+	int cap = c->pending_cap * 2;
+	if (cap < sz) {
+		cap = sz;
+	}
+	c->pending = skynet_realloc(c->pending, cap);
+	c->pending_cap = cap;
+}
+
+static void
+_pending_clear(struct connection *c) {
+	skynet_free(c->pending);
+	c->pending = NULL;
+	c->pending_cap = 0;
+	c->pending_size = 0;
+}
+
+static uint32_t
+_read_header(const uint8_t * ptr, int header_size) {
+	// big-endian, unsigned : a client may send any 4 bytes
+	if (header_size == 2) {
+		return (uint32_t)ptr[0] << 8 | ptr[1];
+	} else {
+		return (uint32_t)ptr[0] << 24 | (uint32_t)ptr[1] << 16 | (uint32_t)ptr[2] << 8 | ptr[3];
+	}
+}
+
 // 分发消息
+// Parse all the complete packages in one pass. Only the bytes of the last incomplete package are kept in c->pending.
 static void
 dispatch_message(struct gate *g, struct connection *c, int id, void * data, int sz) {
-	databuffer_push(&c->buffer,&g->mp, data, sz);
-	for (;;) {
-		int size = databuffer_readheader(&c->buffer, &g->mp, g->header_size);
-		if (size < 0) {
+	const char * ptr;
+	int len;
+	if (c->pending_size == 0) {
+		ptr = data;
+		len = sz;
+	} else {
+		_pending_reserve(c, c->pending_size + sz);
+		memcpy(c->pending + c->pending_size, data, sz);
+		c->pending_size += sz;
+		skynet_free(data);
+		data = NULL;
+		ptr = c->pending;
+		len = c->pending_size;
+	}
+	int header_size = g->header_size;
+	int offset = 0;
+	int n = 0;
+	int total = 0;
+	while (len - offset >= header_size) {
+		uint32_t header = _read_header((const uint8_t *)ptr + offset, header_size);
+		if (header >= 0x1000000) {
+			struct skynet_context * ctx = g->ctx;
+			skynet_free(data);
+			_pending_clear(c);
+			skynet_socket_close(ctx, id);
+			skynet_error(ctx, "Recv socket message > 16M");
 			return;
-		} else if (size > 0) {
-			if (size >= 0x1000000) {
-				struct skynet_context * ctx = g->ctx;
-				databuffer_clear(&c->buffer,&g->mp);
-				skynet_socket_close(ctx, id);
-				skynet_error(ctx, "Recv socket message > 16M");
-				return;
+		}
+		int size = (int)header;
+		if (len - offset - header_size < size)
+			break;
+		offset += header_size;
+		if (size > 0) {
+			if (g->batch) {
+				if (n >= g->item_cap) {
+					g->item_cap = g->item_cap ? g->item_cap * 2 : 16;
+					g->item = skynet_realloc(g->item, g->item_cap * sizeof(struct batch_item));
+				}
+				g->item[n].offset = offset;
+				g->item[n].size = size;
+				++n;
+				total += size;
 			} else {
-				_forward(g, c, size);
-				databuffer_reset(&c->buffer);
+				_forward(g, c, ptr + offset, size);
 			}
 		}
+		offset += size;
+	}
+	if (n > 0) {
+		_forward_batch(g, c, ptr, n, total);
+	}
+	int left = len - offset;
+	if (data) {
+		// parse from the socket buffer directly
+		if (left > 0) {
+			_pending_reserve(c, left);
+			memcpy(c->pending, ptr + offset, left);
+		}
+		skynet_free(data);
+	} else if (left > 0 && offset > 0) {
+		memmove(c->pending, c->pending + offset, left);
+	}
+	c->pending_size = left;
+	if (left == 0 && c->pending_cap > PENDING_SHRINK) {
+		_pending_clear(c);
 	}
 }
 
@@ -254,7 +393,7 @@ dispatch_socket_message(struct gate *g, const struct skynet_socket_message * mes
 		int id = hashid_remove(&g->hash, message->id);
 		if (id>=0) {
 			struct connection *c = &g->conn[id];
-			databuffer_clear(&c->buffer,&g->mp);
+			_pending_clear(c);
 			memset(c, 0, sizeof(*c));
 			c->id = -1;
 			_report(g, "%d close", message->id);
@@ -340,7 +479,11 @@ start_listen(struct gate *g, char * listen_addr) {
 		portstr[0] = '\0';
 		host = listen_addr;
 	}
-	g->listen_id = skynet_socket_listen(ctx, host, port, BACKLOG);
+	if (g->reuseport) {
+		g->listen_id = skynet_socket_listen_reuseport(ctx, host, port, g->backlog);
+	} else {
+		g->listen_id = skynet_socket_listen(ctx, host, port, g->backlog);
+	}
 	if (g->listen_id < 0) {
 		return 1;
 	}
@@ -348,6 +491,15 @@ start_listen(struct gate *g, char * listen_addr) {
 	return 0;
 }
 
+/*
+	parm : header watchdog address client_tag max_connection [batch] [reuseport] [backlog]
+
+	header is 'S' (2 bytes) or 'L' (4 bytes) big-endian package size.
+	Set batch to 1 to forward the packages from one socket read in one message.
+	Set reuseport to 1 to listen with SO_REUSEPORT, so several gates can share one port.
+	Each gate keeps its own connection table.
+	backlog is the listen backlog (BACKLOG by default).
+ */
 int
 gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 	if (parm == NULL)
@@ -358,7 +510,10 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 	char binding[sz];
 	int client_tag = 0;
 	char header;
-	int n = sscanf(parm, "%c %s %s %d %d", &header, watchdog, binding, &client_tag, &max); //按照指定格式取字符串中的数据
+	int batch = 0;
+	int reuseport = 0;
+	int backlog = 0;
+	int n = sscanf(parm, "%c %s %s %d %d %d %d %d", &header, watchdog, binding, &client_tag, &max, &batch, &reuseport, &backlog); //按照指定格式取字符串中的数据
 	if (n<4) {
 		skynet_error(ctx, "Invalid gate parm %s",parm);
 		return 1;
@@ -398,6 +553,9 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 	
 	g->client_tag = client_tag;
 	g->header_size = header=='S' ? 2 : 4;
+	g->batch = batch;
+	g->reuseport = reuseport;
+	g->backlog = backlog > 0 ? backlog : BACKLOG;
 
 	skynet_callback(ctx,g,_cb);
 
@@ -8,9 +8,14 @@
 	N name : update the global name
 	S fd id: connect to new harbor , we should send self_id to fd first , and then recv a id (check it), and at last send queue.
 	A fd id: accept new harbor , we should send self_id to fd , and then send queue.
+	D id: the harbor is down, drop the queue.
+	T : report the throughput of slaves.
 
 	If the fd is disconnected, send message to slave in PTYPE_TEXT.  D id
 	If we don't known a globalname, send message to slave in PTYPE_TEXT. Q name
+	If we send the first message to a harbor not connected, send message to slave in PTYPE_TEXT. L id
+
+	The id in handshake is 1 byte, or 2 bytes (big endian) if harbor_bits > 8.
  */
 
 #include <stdio.h>
@@ -19,12 +24,18 @@
 #include <string.h>
 #include <assert.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <unistd.h>
 
 //节点服务，与其他节点互通 harbor.so // harbor主要用于skynet集群 不同节点间的通信 是skynet集群的通信模块
 
 #define HASH_SIZE 4096
-#define DEFAULT_QUEUE_SIZE 1024
+#define DEFAULT_QUEUE_SIZE 64
+
+// output of a slave is batched into one buffer and sent once per dispatch round
+#define BATCH_SIZE 4096
+// flush at once if the batch buffer is larger than it
+#define BATCH_LIMIT (64 * 1024)
 
 // 12 is sizeof(struct remote_message_header)
 #define HEADER_COOKIE_LENGTH 12
@@ -65,8 +76,11 @@ struct keyvalue {
 };
 
 // map map的每一个节点都有一个消息队列
+// size is power of 2, and it grows when count > size
 struct hashmap {
-	struct keyvalue *node[HASH_SIZE];
+	int size;
+	int count;
+	struct keyvalue **node;
 };
 
 #define STATUS_WAIT 0
@@ -74,6 +88,20 @@ struct hashmap {
 #define STATUS_HEADER 2
 #define STATUS_CONTENT 3
 #define STATUS_DOWN 4
+#define STATUS_LINK 5	// wait for the connection requested by L
+
+struct fdslot {
+	int fd;
+	int id;
+};
+
+struct slave_stat {
+	uint64_t send_msg;
+	uint64_t send_bytes;
+	uint64_t send_write;	// times of skynet_socket_send
+	uint64_t recv_msg;
+	uint64_t recv_bytes;
+};
 
 struct slave {
 	int fd;
@@ -83,15 +111,27 @@ struct slave {
 	int read;
 	uint8_t size[4];
 	char * recv_buffer;
+	bool pending;	// in harbor.pending list
+	int wsize;
+	int wcap;
+	uint8_t * wbuffer;
+	struct slave_stat stat;
 };
 
 // harbor的结构 harbor保存了本集群所有节点的通信地址 skynet集群内部会简历 n*n个节点 相当于每个节点间都建立了tcp连接
 struct harbor {
 	struct skynet_context *ctx; //harbor节点服务的 skynet_ctx
 	int id;
+	uint32_t handle;	// self
 	uint32_t slave;
 	struct hashmap * map;   //hashmap存储keyvalue
-	struct slave s[REMOTE_MAX];
+	bool flush;	// a flush message is in the message queue of harbor
+	int npending;
+	int * pending;	// slaves with output in batch buffer
+	int idbytes;	// bytes of id in handshake
+	int fdsize;
+	struct fdslot * fdmap;	// fd -> slave id
+	struct slave * s;	// REMOTE_MAX slaves
 };
 
 // hash table
@@ -159,11 +199,21 @@ release_queue(struct harbor_msg_queue *queue) {
 	skynet_free(queue);
 }
 
+static inline uint32_t
+hash_name(const char name[GLOBALNAME_LENGTH]) {
+	const uint32_t *ptr = (const uint32_t*) name;
+	uint32_t h = ((ptr[0] * 31 + ptr[1]) * 31 + ptr[2]) * 31 + ptr[3];
+	// mix the bits, because the slot is the low bits of hash
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	return h;
+}
+
 static struct keyvalue *
 hash_search(struct hashmap * hash, const char name[GLOBALNAME_LENGTH]) {
-	uint32_t *ptr = (uint32_t*) name;
-	uint32_t h = ptr[0] ^ ptr[1] ^ ptr[2] ^ ptr[3];
-	struct keyvalue * node = hash->node[h % HASH_SIZE];
+	uint32_t h = hash_name(name);
+	struct keyvalue * node = hash->node[h & (hash->size - 1)];
 	while (node) {
 		if (node->hash == h && strncmp(node->key, name, GLOBALNAME_LENGTH) == 0) {
 			return node;
@@ -173,33 +223,36 @@ hash_search(struct hashmap * hash, const char name[GLOBALNAME_LENGTH]) {
 	return NULL;
 }
 
-/*
-
 // Don't support erase name yet
 
-static struct void
-hash_erase(struct hashmap * hash, char name[GLOBALNAME_LENGTH) {
-	uint32_t *ptr = name;
-	uint32_t h = ptr[0] ^ ptr[1] ^ ptr[2] ^ ptr[3];
-	struct keyvalue ** ptr = &hash->node[h % HASH_SIZE];
-	while (*ptr) {
-		struct keyvalue * node = *ptr;
-		if (node->hash == h && strncmp(node->key, name, GLOBALNAME_LENGTH) == 0) {
-			_release_queue(node->queue);
-			*ptr->next = node->next;
-			skynet_free(node);
-			return;
+static void
+hash_expand(struct hashmap * hash) {
+	int size = hash->size * 2;
+	struct keyvalue ** node = skynet_malloc(size * sizeof(struct keyvalue *));
+	memset(node, 0, size * sizeof(struct keyvalue *));
+	int i;
+	for (i=0;i<hash->size;i++) {
+		struct keyvalue * kv = hash->node[i];
+		while (kv) {
+			struct keyvalue * next = kv->next;
+			struct keyvalue ** pkv = &node[kv->hash & (size - 1)];
+			kv->next = *pkv;
+			*pkv = kv;
+			kv = next;
 		}
-		*ptr = &(node->next);
 	}
+	skynet_free(hash->node);
+	hash->node = node;
+	hash->size = size;
 }
-*/
 
 static struct keyvalue *
 hash_insert(struct hashmap * hash, const char name[GLOBALNAME_LENGTH]) {
-	uint32_t *ptr = (uint32_t *)name;
-	uint32_t h = ptr[0] ^ ptr[1] ^ ptr[2] ^ ptr[3];
-	struct keyvalue ** pkv = &hash->node[h % HASH_SIZE];
+	if (hash->count >= hash->size) {
+		hash_expand(hash);
+	}
+	uint32_t h = hash_name(name);
+	struct keyvalue ** pkv = &hash->node[h & (hash->size - 1)];
 	struct keyvalue * node = skynet_malloc(sizeof(*node));
 	memcpy(node->key, name, GLOBALNAME_LENGTH);
 	node->next = *pkv;
@@ -207,6 +260,7 @@ hash_insert(struct hashmap * hash, const char name[GLOBALNAME_LENGTH]) {
 	node->hash = h;
 	node->value = 0;
 	*pkv = node;
+	++hash->count;
 
 	return node;
 }
@@ -214,14 +268,17 @@ hash_insert(struct hashmap * hash, const char name[GLOBALNAME_LENGTH]) {
 static struct hashmap * 
 hash_new() {
 	struct hashmap * h = skynet_malloc(sizeof(struct hashmap));
-	memset(h,0,sizeof(*h));
+	h->size = HASH_SIZE;
+	h->count = 0;
+	h->node = skynet_malloc(HASH_SIZE * sizeof(struct keyvalue *));
+	memset(h->node, 0, HASH_SIZE * sizeof(struct keyvalue *));
 	return h;
 }
 
 static void
 hash_delete(struct hashmap *hash) {
 	int i;
-	for (i=0;i<HASH_SIZE;i++) {
+	for (i=0;i<hash->size;i++) {
 		struct keyvalue * node = hash->node[i];
 		while (node) {
 			struct keyvalue * next = node->next;
@@ -230,11 +287,34 @@ hash_delete(struct hashmap *hash) {
 			node = next;
 		}
 	}
+	skynet_free(hash->node);
 	skynet_free(hash);
 }
 
 ///////////////
 
+static void
+insert_fd(struct harbor *h, int fd, int id) {
+	int i = fd & (h->fdsize - 1);
+	while (h->fdmap[i].fd != 0) {
+		i = (i + 1) & (h->fdsize - 1);
+	}
+	h->fdmap[i].fd = fd;
+	h->fdmap[i].id = id;
+}
+
+static int
+harbor_id(struct harbor *h, int fd) {
+	int i = fd & (h->fdsize - 1);
+	while (h->fdmap[i].fd != 0) {
+		if (h->fdmap[i].fd == fd) {
+			return h->fdmap[i].id;
+		}
+		i = (i + 1) & (h->fdsize - 1);
+	}
+	return 0;
+}
+
 static void
 close_harbor(struct harbor *h, int id) {
 	struct slave *s = &h->s[id];
@@ -246,6 +326,10 @@ close_harbor(struct harbor *h, int id) {
 		release_queue(s->queue);
 		s->queue = NULL;
 	}
+	skynet_free(s->wbuffer);
+	s->wbuffer = NULL;
+	s->wsize = 0;
+	s->wcap = 0;
 }
 
 static void
@@ -256,11 +340,52 @@ report_harbor_down(struct harbor *h, int id) {
 	skynet_send(h->ctx, 0, h->slave, PTYPE_TEXT, 0, down, n);
 }
 
+// ask slave to connect the harbor on demand
+static void
+link_harbor(struct harbor *h, int id) {
+	struct slave *s = &h->s[id];
+	if (s->status != STATUS_WAIT)
+		return;
+	s->status = STATUS_LINK;
+	char link[64];
+	int n = sprintf(link, "L %d",id);
+
+	skynet_send(h->ctx, 0, h->slave, PTYPE_TEXT, 0, link, n);
+}
+
+// the harbor is down before connected, report error to the sources of the queued messages
+static void
+drop_harbor(struct harbor *h, int id) {
+	struct slave *s = &h->s[id];
+	if (s->status == STATUS_DOWN)
+		return;
+	if (s->queue) {
+		struct harbor_msg * m;
+		while ((m = pop_queue(s->queue)) != NULL) {
+			int type = m->header.destination >> HANDLE_REMOTE_SHIFT;
+			if (type != PTYPE_ERROR) {
+				uint32_t destination = (m->header.destination & HANDLE_MASK) | ((uint32_t)id << HANDLE_REMOTE_SHIFT);
+				skynet_send(h->ctx, destination, m->header.source, PTYPE_ERROR, (int)m->header.session, NULL, 0);
+			}
+			skynet_free(m->buffer);
+		}
+	}
+	close_harbor(h, id);
+}
+
 struct harbor *
 harbor_create(void) {
 	struct harbor * h = skynet_malloc(sizeof(*h));
 	memset(h,0,sizeof(*h));
 	h->map = hash_new();
+	h->s = skynet_malloc(REMOTE_MAX * sizeof(struct slave));
+	memset(h->s, 0, REMOTE_MAX * sizeof(struct slave));
+	h->pending = skynet_malloc(REMOTE_MAX * sizeof(int));
+	h->idbytes = REMOTE_MAX > 256 ? 2 : 1;
+	// fds are never removed, so the load factor is less than 1/2
+	h->fdsize = REMOTE_MAX * 2;
+	h->fdmap = skynet_malloc(h->fdsize * sizeof(struct fdslot));
+	memset(h->fdmap, 0, h->fdsize * sizeof(struct fdslot));
 	return h;
 }
 
@@ -274,8 +399,12 @@ harbor_release(struct harbor *h) {
 			// don't call report_harbor_down.
 			// never call skynet_send during module exit, because of dead lock
 		}
+		skynet_free(s->wbuffer);
 	}
 	hash_delete(h->map);
+	skynet_free(h->s);
+	skynet_free(h->pending);
+	skynet_free(h->fdmap);
 	skynet_free(h);
 }
 
@@ -334,19 +463,77 @@ forward_local_messsage(struct harbor *h, void *msg, int sz) {
 }
 
 static void
-send_remote(struct skynet_context * ctx, int fd, const char * buffer, size_t sz, struct remote_message_header * cookie) {
+flush_slave(struct harbor *h, struct slave *s) {
+	if (s->wsize == 0)
+		return;
+	++s->stat.send_write;
+	// ignore send error, because if the connection is broken, the mainloop will recv a message.
+	skynet_socket_send(h->ctx, s->fd, s->wbuffer, s->wsize);
+	// the buffer is owned by socket server now
+	s->wbuffer = NULL;
+	s->wsize = 0;
+	s->wcap = 0;
+}
+
+// send all the batch buffers, called by the flush message at the end of a dispatch round
+static void
+flush_harbor(struct harbor *h) {
+	int i;
+	h->flush = false;
+	for (i=0;i<h->npending;i++) {
+		struct slave *s = &h->s[h->pending[i]];
+		s->pending = false;
+		if (s->fd && s->status != STATUS_DOWN) {
+			flush_slave(h, s);
+		}
+	}
+	h->npending = 0;
+}
+
+static uint8_t *
+reserve_buffer(struct slave *s, size_t sz) {
+	size_t need = s->wsize + sz;
+	if (need > (size_t)s->wcap) {
+		size_t cap = s->wcap ? s->wcap : BATCH_SIZE;
+		while (cap < need) {
+			cap *= 2;
+		}
+		s->wbuffer = skynet_realloc(s->wbuffer, cap);
+		s->wcap = (int)cap;
+	}
+	uint8_t * ptr = s->wbuffer + s->wsize;
+	s->wsize = (int)need;
+	return ptr;
+}
+
+static void
+send_remote(struct harbor *h, int id, const char * buffer, size_t sz, struct remote_message_header * cookie) {
 	size_t sz_header = sz+sizeof(*cookie);
-	if (sz_header > UINT32_MAX) {
-		skynet_error(ctx, "remote message from :%08x to :%08x is too large.", cookie->source, cookie->destination);
+	if (sz_header > UINT32_MAX || sz_header + 4 > INT32_MAX - BATCH_LIMIT) {
+		skynet_error(h->ctx, "remote message from :%08x to :%08x is too large.", cookie->source, cookie->destination);
 		return;
 	}
-	uint8_t * sendbuf = skynet_malloc(sz_header+4);
+	struct slave *s = &h->s[id];
+	uint8_t * sendbuf = reserve_buffer(s, sz_header+4);
 	to_bigendian(sendbuf, (uint32_t)sz_header);
 	memcpy(sendbuf+4, buffer, sz);
 	header_to_message(cookie, sendbuf+4+sz);
+	++s->stat.send_msg;
+	s->stat.send_bytes += sz_header+4;
 
-	// ignore send error, because if the connection is broken, the mainloop will recv a message.
-	skynet_socket_send(ctx, fd, sendbuf, sz_header+4);
+	if (s->wsize >= BATCH_LIMIT) {
+		flush_slave(h, s);
+		return;
+	}
+	if (!s->pending) {
+		s->pending = true;
+		h->pending[h->npending++] = id;
+		if (!h->flush) {
+			// the flush message is behind all the messages already in the queue
+			h->flush = true;
+			skynet_send(h->ctx, 0, h->handle, PTYPE_HARBOR | PTYPE_TAG_DONTCOPY, 0, NULL, 0);
+		}
+	}
 }
 
 static void
@@ -356,8 +543,7 @@ dispatch_name_queue(struct harbor *h, struct keyvalue * node) {
 	int harbor_id = handle >> HANDLE_REMOTE_SHIFT;
 	struct skynet_context * context = h->ctx;
 	struct slave *s = &h->s[harbor_id];
-	int fd = s->fd;
-	if (fd == 0) {
+	if (s->fd == 0) {
 		if (s->status == STATUS_DOWN) {
 			char tmp [GLOBALNAME_LENGTH+1];
 			memcpy(tmp, node->key, GLOBALNAME_LENGTH);
@@ -365,13 +551,12 @@ dispatch_name_queue(struct harbor *h, struct keyvalue * node) {
 			skynet_error(context, "Drop message to %s (in harbor %d)",tmp,harbor_id);
 		} else {
 			if (s->queue == NULL) {
-				s->queue = node->queue;
-				node->queue = NULL;
-			} else {
-				struct harbor_msg * m;
-				while ((m = pop_queue(queue))!=NULL) {
-					push_queue_msg(s->queue, m);
-				}
+				s->queue = new_queue();
+			}
+			struct harbor_msg * m;
+			while ((m = pop_queue(queue))!=NULL) {
+				m->header.destination |= (handle & HANDLE_MASK);
+				push_queue_msg(s->queue, m);
 			}
 			if (harbor_id == (h->slave >> HANDLE_REMOTE_SHIFT)) {
 				// the harbor_id is local
@@ -382,6 +567,8 @@ dispatch_name_queue(struct harbor *h, struct keyvalue * node) {
 				}
 				release_queue(s->queue);
 				s->queue = NULL;
+			} else {
+				link_harbor(h, harbor_id);
 			}
 		}
 		return;
@@ -389,7 +576,7 @@ dispatch_name_queue(struct harbor *h, struct keyvalue * node) {
 	struct harbor_msg * m;
 	while ((m = pop_queue(queue)) != NULL) {
 		m->header.destination |= (handle & HANDLE_MASK);
-		send_remote(context, fd, m->buffer, m->size, &m->header);
+		send_remote(h, harbor_id, m->buffer, m->size, &m->header);
 		skynet_free(m->buffer);
 	}
 }
@@ -397,8 +584,7 @@ dispatch_name_queue(struct harbor *h, struct keyvalue * node) {
 static void
 dispatch_queue(struct harbor *h, int id) {
 	struct slave *s = &h->s[id];
-	int fd = s->fd;
-	assert(fd != 0);
+	assert(s->fd != 0);
 
 	struct harbor_msg_queue *queue = s->queue;
 	if (queue == NULL)
@@ -406,7 +592,7 @@ dispatch_queue(struct harbor *h, int id) {
 
 	struct harbor_msg * m;
 	while ((m = pop_queue(queue)) != NULL) {
-		send_remote(h->ctx, fd, m->buffer, m->size, &m->header);
+		send_remote(h, id, m->buffer, m->size, &m->header);
 		skynet_free(m->buffer);
 	}
 	release_queue(queue);
@@ -417,16 +603,8 @@ static void
 push_socket_data(struct harbor *h, const struct skynet_socket_message * message) {
 	assert(message->type == SKYNET_SOCKET_TYPE_DATA);
 	int fd = message->id;
-	int i;
-	int id = 0;
-	struct slave * s = NULL;
-	for (i=1;i<REMOTE_MAX;i++) {
-		if (h->s[i].fd == fd) {
-			s = &h->s[i];
-			id = i;
-			break;
-		}
-	}
+	int id = harbor_id(h, fd);
+	struct slave * s = id ? &h->s[id] : NULL;
 	if (s == NULL) {
 		skynet_free(message->buffer);
 		skynet_error(h->ctx, "Invalid socket fd (%d) data", fd);
@@ -434,19 +612,31 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 	}
 	uint8_t * buffer = (uint8_t *)message->buffer;
 	int size = message->ud;
+	s->stat.recv_bytes += size;
 
 	for (;;) {
 		switch(s->status) {
 		case STATUS_HANDSHAKE: {
 			// check id
-			uint8_t remote_id = buffer[0];
+			int need = h->idbytes - s->read;
+			if (size < need) {
+				memcpy(s->size + s->read, buffer, size);
+				s->read += size;
+				return;
+			}
+			memcpy(s->size + s->read, buffer, need);
+			buffer += need;
+			size -= need;
+			s->read = 0;
+			int remote_id = s->size[0];
+			if (h->idbytes == 2) {
+				remote_id = remote_id << 8 | s->size[1];
+			}
 			if (remote_id != id) {
 				skynet_error(h->ctx, "Invalid shakehand id (%d) from fd = %d , harbor = %d", id, fd, remote_id);
 				close_harbor(h,id);
 				return;
 			}
-			++buffer;
-			--size;
 			s->status = STATUS_HEADER;
 
 			dispatch_queue(h, id);
@@ -491,6 +681,7 @@ push_socket_data(struct harbor *h, const struct skynet_socket_message * message)
 				return;
 			}
 			memcpy(s->recv_buffer + s->read, buffer, need);
+			++s->stat.recv_msg;
 			forward_local_messsage(h, s->recv_buffer, s->length);
 			s->length = 0;
 			s->read = 0;
@@ -548,6 +739,7 @@ remote_send_handle(struct harbor *h, uint32_t source, uint32_t destination, int
 			header.destination = (type << HANDLE_REMOTE_SHIFT) | (destination & HANDLE_MASK);
 			header.session = (uint32_t)session;
 			push_queue(s->queue, (void *)msg, sz, &header);
+			link_harbor(h, harbor_id);
 			return 1;
 		}
 	} else {
@@ -555,7 +747,7 @@ remote_send_handle(struct harbor *h, uint32_t source, uint32_t destination, int
 		cookie.source = source;
 		cookie.destination = (destination & HANDLE_MASK) | ((uint32_t)type << HANDLE_REMOTE_SHIFT);
 		cookie.session = (uint32_t)session;
-		send_remote(context, s->fd, msg,sz,&cookie);
+		send_remote(h, harbor_id, msg,sz,&cookie);
 	}
 
 	return 0;
@@ -589,9 +781,36 @@ remote_send_name(struct harbor *h, uint32_t source, const char name[GLOBALNAME_L
 static void
 handshake(struct harbor *h, int id) {
 	struct slave *s = &h->s[id];
-	uint8_t * handshake = skynet_malloc(1);
-	handshake[0] = (uint8_t)h->id;
-	skynet_socket_send(h->ctx, s->fd, handshake, 1);
+	uint8_t * handshake = skynet_malloc(h->idbytes);
+	if (h->idbytes == 2) {
+		handshake[0] = (uint8_t)(h->id >> 8);
+		handshake[1] = (uint8_t)h->id;
+	} else {
+		handshake[0] = (uint8_t)h->id;
+	}
+	skynet_socket_send(h->ctx, s->fd, handshake, h->idbytes);
+}
+
+// T : the throughput of each slave, one line per slave : id status send_msg send_bytes send_write recv_msg recv_bytes
+static void
+report_stat(struct harbor *h, int session, uint32_t source) {
+	int sz = 0;
+	int cap = 256;
+	char * result = skynet_malloc(cap);
+	int i;
+	for (i=1;i<REMOTE_MAX;i++) {
+		struct slave *s = &h->s[i];
+		if (s->fd == 0)
+			continue;
+		if (cap - sz < 256) {
+			cap *= 2;
+			result = skynet_realloc(result, cap);
+		}
+		struct slave_stat *st = &s->stat;
+		sz += sprintf(result + sz, "%d %d %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+			i, s->status, st->send_msg, st->send_bytes, st->send_write, st->recv_msg, st->recv_bytes);
+	}
+	skynet_send(h->ctx, 0, source, PTYPE_RESPONSE | PTYPE_TAG_DONTCOPY, session, result, sz);
 }
 
 static void
@@ -629,6 +848,7 @@ harbor_command(struct harbor * h, const char * msg, size_t sz, int session, uint
 			return;
 		}
 		slave->fd = fd;
+		insert_fd(h, fd, id);
 
 		skynet_socket_start(h->ctx, fd);
 		handshake(h, id);
@@ -640,24 +860,27 @@ harbor_command(struct harbor * h, const char * msg, size_t sz, int session, uint
 		}
 		break;
 	}
+	case 'D' : {
+		char buffer[s+1];
+		memcpy(buffer, name, s);
+		buffer[s] = 0;
+		int id = strtol(buffer, NULL, 10);
+		if (id <= 0 || id >= REMOTE_MAX) {
+			skynet_error(h->ctx, "Invalid command D %s", buffer);
+			return;
+		}
+		drop_harbor(h, id);
+		break;
+	}
+	case 'T' :
+		report_stat(h, session, source);
+		break;
 	default:
 		skynet_error(h->ctx, "Unknown command %s", msg);
 		return;
 	}
 }
 
-static int
-harbor_id(struct harbor *h, int fd) {
-	int i;
-	for (i=1;i<REMOTE_MAX;i++) {
-		struct slave *s = &h->s[i];
-		if (s->fd == fd) {
-			return i;
-		}
-	}
-	return 0;
-}
-
 //harbor的消息回调
 static int
 mainloop(struct skynet_context * context, void * ud, int type, int session, uint32_t source, const void * msg, size_t sz) {
@@ -697,6 +920,11 @@ mainloop(struct skynet_context * context, void * ud, int type, int session, uint
 		return 0;
 	}
 	case PTYPE_HARBOR: { // harbor type 即远程消息 发给某个 远程主机
+		if (sz == 0) {
+			// the flush message sent by send_remote
+			flush_harbor(h);
+			return 0;
+		}
 		harbor_command(h, msg,sz,session,source);
 		return 0;
 	}
@@ -730,6 +958,8 @@ harbor_init(struct harbor *h, struct skynet_context *ctx, const char * args) {
 	}
 	h->id = harbor_id;
 	h->slave = slave;
+	const char * self = skynet_command(ctx, "REG", NULL);
+	h->handle = strtoul(self+1, NULL, 16);
 	skynet_callback(ctx, h, mainloop); //设置harbor服务的回调函数 同时保存harbor结构
 	skynet_harbor_start(ctx); // 增加引用计数
 	return 0;
@@ -39,8 +39,13 @@ skynet.start(function()
 	end
 
 	if standalone then
-		local datacenter = skynet.newservice "datacenterd"
-		skynet.name("DATACENTER", datacenter)
+		-- the top level keys of datacenter are sharded into datacenter_shard services
+		local shards = {}
+		for i = 1, tonumber(skynet.getenv "datacenter_shard" or 1) do
+			shards[i] = skynet.newservice "datacenterd"
+		end
+		skynet.call(shards[1], "lua", "SHARD", shards)
+		skynet.name("DATACENTER", shards[1])
 	end
 	skynet.newservice "service_mgr"
 	pcall(skynet.newservice,skynet.getenv "start" or "main")
@@ -6,22 +6,83 @@ local cluster = require "cluster.core"
 local config_name = skynet.getenv "cluster"
 local node_address = {}
 local node_session = {}
+local node_state = {}	-- node -> { version = 1 or 2, handshake = session, connection = serial of connection, ... }
+local node_stat = {}	-- node -> { inflight, request, error, time, max }
 local command = {}
 
-local function read_response(sock)
-	local sz = socket.header(sock:read(2))
-	local msg = sock:read(sz)
-	return cluster.unpackresponse(msg)	-- session, ok, data, padding
+-- requests to the same node are queued and written in one package,
+-- the queue is flushed after the messages already in the message queue of clusterd
+local FLUSH_WINDOW = tonumber(skynet.getenv "cluster_window") or 0
+
+-- the size limit of a request package in version 2 (DWORD size), the connection is closed if it's larger
+local MAX_PACKAGE = tonumber(skynet.getenv "cluster_maxpackage") or 0x1000000
+
+-- The name query of the handshake. The old version of clusterd answers "name not found",
+-- so both sides keep the version 1 (WORD size and 32K multi part).
+-- Otherwise the connection switches to version 2 (DWORD size, no multi part) after the response.
+local HANDSHAKE = "\0cluster.v2"
+local HANDSHAKE_REQUEST = skynet.packstring(HANDSHAKE)
+
+local function read_response(sock, state)
+	local result = state.result
+	local i = state.index
+	if i > state.n then
+		-- unpack all the responses already received
+		local n, rest, need = cluster.unpackresponses(state.rest .. sock:read(), state.version, result)
+		while n == 0 do
+			-- read the whole uncomplete package
+			n, rest, need = cluster.unpackresponses(rest .. sock:read(need), state.version, result)
+		end
+		state.rest = rest
+		state.n = n * 4
+		i = 1
+	end
+	state.index = i + 4
+	local session, ok, data, padding = result[i], result[i+1], result[i+2], result[i+3]
+	result[i+2] = nil
+	if session == state.handshake then
+		-- switch before reading the next response
+		state.handshake = nil
+		if ok then
+			state.version = 2
+		end
+	end
+	return session, ok, data, padding
+end
+
+local function handshake(c, node, state)
+	state.version = 1
+	state.connection = state.connection + 1
+	state.result = {}
+	state.index = 1
+	state.n = 0
+	state.rest = ""
+	state.queue = nil
+	local session = node_session[node] or 1
+	local request, new_session = cluster.packrequest(0, session, skynet.pack(HANDSHAKE))
+	node_session[node] = new_session
+	state.handshake = session
+	local ok, err = pcall(c.request, c, request, session)
+	if not ok and err == sc.error then
+		error(err)
+	end
 end
 
 local function open_channel(t, key)
 	local host, port = string.match(node_address[key], "([^:]+):(.*)$")
+	local state = { version = 1, connection = 0, result = {}, index = 1, n = 0, rest = "" }
 	local c = sc.channel {
 		host = host,
 		port = tonumber(port),
-		response = read_response,
+		response = function(sock)
+			return read_response(sock, state)
+		end,
+		auth = function(c)
+			handshake(c, key, state)
+		end,
 		nodelay = true,
 	}
+	node_state[key] = state
 	assert(c:connect(true))
 	t[key] = c
 	return c
@@ -56,29 +117,86 @@ function command.reload(source, config)
 	skynet.ret(skynet.pack(nil))
 end
 
+local accept_connection
+
 function command.listen(source, addr, port)
-	local gate = skynet.newservice("gate")
 	if port == nil then
 		addr, port = string.match(node_address[addr], "([^:]+):(.*)$")
 	end
-	skynet.call(gate, "lua", "open", { address = addr, port = port })
+	local id = socket.listen(addr, tonumber(port))
+	socket.start(id, function(fd, from)
+		skynet.fork(accept_connection, fd, from)
+	end)
 	skynet.ret(skynet.pack(nil))
 end
 
+local function flush_request(c, state, queue)
+	if state.queue == queue then
+		state.queue = nil
+	end
+	if state.connection ~= queue.connection then
+		-- reconnected, the sessions waiting for response are already waked up by error
+		return
+	end
+	c:write(#queue == 1 and queue[1] or table.concat(queue))
+end
+
+local function queue_request(c, node, request)
+	local state = node_state[node]
+	local queue = state.queue
+	if queue == nil then
+		queue = { connection = state.connection }
+		state.queue = queue
+		skynet.timeout(FLUSH_WINDOW, function()
+			flush_request(c, state, queue)
+		end)
+	end
+	queue[#queue+1] = request
+end
+
+-- connect to the node, the version of protocol is known after connected
+local function connect_node(node)
+	-- node_channel[node] may yield or throw error
+	local c = node_channel[node]
+	c:connect(true)
+	return c
+end
+
 local function send_request(source, node, addr, msg, sz)
+	local ok, c = pcall(connect_node, node)
+	if not ok then
+		skynet.trash(msg, sz)
+		error(c)
+	end
 	local session = node_session[node] or 1
 	-- msg is a local pointer, cluster.packrequest will free it
-	local request, new_session, padding = cluster.packrequest(addr, session, msg, sz)
+	local request, new_session, padding = cluster.packrequest(addr, session, msg, sz, node_state[node].version)
 	node_session[node] = new_session
 
-	-- node_channel[node] may yield or throw error
-	local c = node_channel[node]
-
-	return c:request(request, session, padding)
+	if padding then
+		-- multi part request is written at once
+		return c:request(request, session, padding)
+	end
+	queue_request(c, node, request)
+	return c:response(session)
 end
 
-function command.req(...)
-	local ok, msg, sz = pcall(send_request, ...)
+function command.req(source, node, ...)
+	local stat = node_stat[node]
+	if stat == nil then
+		stat = { inflight = 0, request = 0, error = 0, time = 0, max = 0 }
+		node_stat[node] = stat
+	end
+	stat.inflight = stat.inflight + 1
+	stat.request = stat.request + 1
+	local start = skynet.now()
+	local ok, msg, sz = pcall(send_request, source, node, ...)
+	local ti = skynet.now() - start
+	stat.inflight = stat.inflight - 1
+	stat.time = stat.time + ti
+	if ti > stat.max then
+		stat.max = ti
+	end
 	if ok then
 		if type(msg) == "table" then
 			skynet.ret(cluster.concat(msg))
@@ -86,23 +204,45 @@ function command.req(...)
 			skynet.ret(msg)
 		end
 	else
+		stat.error = stat.error + 1
 		skynet.error(msg)
 		skynet.response()(false)
 	end
 end
 
+-- return node -> { inflight, request, error, avg (ms), max (ms) }, or the stat of one node
+function command.stat(source, node)
+	local result = {}
+	for name, stat in pairs(node_stat) do
+		if node == nil or node == name then
+			result[name] = {
+				inflight = stat.inflight,
+				request = stat.request,
+				error = stat.error,
+				avg = stat.request > stat.inflight and stat.time * 10 / (stat.request - stat.inflight) or 0,
+				max = stat.max * 10,
+			}
+		end
+	end
+	skynet.ret(skynet.pack(node and result[node] or result))
+end
+
 function command.push(source, node, addr, msg, sz)
+	local ok, c = pcall(connect_node, node)
+	if not ok then
+		skynet.trash(msg, sz)
+		error(c)
+	end
+
 	local session = node_session[node] or 1
-	local request, new_session, padding = cluster.packpush(addr, session, msg, sz)
+	local request, new_session, padding = cluster.packpush(addr, session, msg, sz, node_state[node].version)
 	if padding then	-- is multi push
 		node_session[node] = new_session
+		c:request(request, nil, padding)
+	else
+		queue_request(c, node, request)
 	end
 
-	-- node_channel[node] may yield or throw error
-	local c = node_channel[node]
-
-	c:request(request, nil, padding)
-
 	-- notice: push may fail where the channel is disconnected or broken.
 end
 
@@ -131,17 +271,89 @@ function command.register(source, name, addr)
 	skynet.error(string.format("Register [%s] :%08x", name, addr))
 end
 
-local large_request = {}
+-- the responses of the same connection are written together too
+local function flush_response(conn)
+	local queue = conn.queue
+	conn.queue = nil
+	socket.write(conn.fd, #queue == 1 and queue[1] or table.concat(queue))
+end
 
-function command.socket(source, subcmd, fd, msg)
-	if subcmd == "data" then
+local function write_response(conn, response)
+	local queue = conn.queue
+	if queue == nil then
+		queue = {}
+		conn.queue = queue
+		skynet.timeout(FLUSH_WINDOW, function()
+			flush_response(conn)
+		end)
+	end
+	queue[#queue+1] = response
+end
+
+local function dispatch_request(conn, version, addr, session, msg, sz, is_push)
+	local ok, response
+	if addr == 0 then
+		local name = skynet.unpack(msg, sz)
+		local addr = register_name[name]
+		if addr then
+			ok = true
+			msg, sz = skynet.pack(addr)
+		else
+			ok = false
+			msg = "name not found"
+		end
+	elseif is_push then
+		skynet.rawsend(addr, "lua", msg, sz)
+		return	-- no response
+	else
+		ok , msg, sz = pcall(skynet.rawcall, addr, "lua", msg, sz)
+	end
+	if ok then
+		response = cluster.packresponse(session, true, msg, sz, version)
+		if type(response) == "table" then
+			for _, v in ipairs(response) do
+				socket.lwrite(conn.fd, v)
+			end
+		else
+			write_response(conn, response)
+		end
+	else
+		response = cluster.packresponse(session, false, msg, nil, version)
+		write_response(conn, response)
+	end
+end
+
+function accept_connection(fd, from)
+	skynet.error(string.format("socket accept from %s", from))
+	socket.start(fd)
+	local version = 1
+	local large_request = {}
+	local conn = { fd = fd }
+	while true do
+		-- the whole package is assembled in the socket buffer
+		local header = socket.read(fd, version == 2 and 4 or 2)
+		if not header then
+			break
+		end
+		local size = socket.header(header)
+		if size > MAX_PACKAGE then
+			skynet.error(string.format("package from %s is too large (%d bytes)", from, size))
+			break
+		end
+		local msg = socket.read(fd, size)
+		if not msg then
+			break
+		end
 		local sz
-		local addr, session, msg, padding, is_push = cluster.unpackrequest(msg)
+		local ok, addr, session, msg, padding, is_push = pcall(cluster.unpackrequest, msg)
+		if not ok then
+			skynet.error(string.format("invalid request from %s : %s", from, addr))
+			break
+		end
 		if padding then
 			local req = large_request[session] or { addr = addr , is_push = is_push }
 			large_request[session] = req
 			table.insert(req, msg)
-			return
 		else
 			local req = large_request[session]
 			if req then
@@ -154,46 +366,17 @@ function command.socket(source, subcmd, fd, msg)
 			if not msg then
 				local response = cluster.packresponse(session, false, "Invalid large req")
 				socket.write(fd, response)
-				return
-			end
-		end
-		local ok, response
-		if addr == 0 then
-			local name = skynet.unpack(msg, sz)
-			local addr = register_name[name]
-			if addr then
-				ok = true
-				msg, sz = skynet.pack(addr)
+			elseif addr == 0 and version == 1 and msg == HANDSHAKE_REQUEST then
+				-- answer in version 1, and switch to version 2 for the following packages
+				socket.write(fd, cluster.packresponse(session, true, skynet.pack(2)))
+				version = 2
 			else
-				ok = false
-				msg = "name not found"
+				skynet.fork(dispatch_request, conn, version, addr, session, msg, sz, is_push)
 			end
-		elseif is_push then
-			skynet.rawsend(addr, "lua", msg, sz)
-			return	-- no response
-		else
-			ok , msg, sz = pcall(skynet.rawcall, addr, "lua", msg, sz)
 		end
-		if ok then
-			response = cluster.packresponse(session, true, msg, sz)
-			if type(response) == "table" then
-				for _, v in ipairs(response) do
-					socket.lwrite(fd, v)
-				end
-			else
-				socket.write(fd, response)
-			end
-		else
-			response = cluster.packresponse(session, false, msg)
-			socket.write(fd, response)
-		end
-	elseif subcmd == "open" then
-		skynet.error(string.format("socket accept from %s", msg))
-		skynet.call(source, "lua", "accept", fd)
-	else
-		large_request = {}
-		skynet.error(string.format("socket %s %d : %s", subcmd, fd, msg))
 	end
+	socket.close(fd)
+	skynet.error(string.format("socket close %d (%s)", fd, from))
 end
 
 skynet.start(function()
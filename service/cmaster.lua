@@ -8,12 +8,17 @@ local socket = require "socket"
 
 	master hold connections from slaves .
 
+	slaves connect each other on demand : when a slave need a harbor not connected,
+	it sends LINK to master, and master asks the slave with smaller id to connect the other one.
+	So there is no full mesh, and the connections never cross.
+
 	protocol slave->master :
 		package size 1 byte
 		type 1 byte :
-			'H' : HANDSHAKE, report slave id, and address.
+			'H' : HANDSHAKE, report slave id, address and harbor_bits.
 			'R' : REGISTER name address
 			'Q' : QUERY name
+			'L' : LINK slave_id
 
 
 	protocol master->slave:
@@ -27,6 +32,8 @@ local socket = require "socket"
 
 local slave_node = {}
 local global_name = {}
+local pending_link = {}	-- slave id -> { slave ids link to it }, the slave is not registered yet
+local harbor_bits = tonumber(skynet.getenv "harbor_bits")
 
 local function read_package(fd)
 	local sz = socket.read(fd, 1)
@@ -43,35 +50,49 @@ local function pack_package(...)
 	return string.char(size) .. message
 end
 
-local function report_slave(fd, slave_id, slave_addr)
-	local message = pack_package("C", slave_id, slave_addr)
-	local n = 0
-	for k,v in pairs(slave_node) do
-		if v.fd ~= 0 then
-			socket.write(v.fd, message)
-			n = n + 1
+-- the slave with smaller id connects the other one
+local function link_slave(a, b)
+	if a > b then
+		a, b = b, a
+	end
+	local node = slave_node[b]
+	socket.write(slave_node[a].fd, pack_package("C", b, node.addr))
+end
+
+local function report_slave(fd, slave_id)
+	-- don't wait for any harbor, the connections are created on demand
+	socket.write(fd, pack_package("W", 0))
+	local link = pending_link[slave_id]
+	if link then
+		pending_link[slave_id] = nil
+		for _, id in ipairs(link) do
+			if slave_node[id].fd ~= 0 then
+				link_slave(id, slave_id)
+			end
 		end
 	end
-	socket.write(fd, pack_package("W", n))
 end
 
 local function handshake(fd)
-	local t, slave_id, slave_addr = read_package(fd)
+	local t, slave_id, slave_addr, bits = read_package(fd)
 	assert(t=='H', "Invalid handshake type " .. t)
 	assert(slave_id ~= 0 , "Invalid slave id 0")
+	if (bits or 8) ~= harbor_bits then
+		error(string.format("Slave %d harbor_bits %d mismatch %d", slave_id, bits or 8, harbor_bits))
+	end
 	if slave_node[slave_id] then
 		error(string.format("Slave %d already register on %s", slave_id, slave_node[slave_id].addr))
 	end
-	report_slave(fd, slave_id, slave_addr)
 	slave_node[slave_id] = {
 		fd = fd,
 		id = slave_id,
 		addr = slave_addr,
 	}
+	report_slave(fd, slave_id)
 	return slave_id , slave_addr
 end
 
-local function dispatch_slave(fd)
+local function dispatch_slave(fd, slave_id)
 	local t, name, address = read_package(fd)
 	if t == 'R' then
 		-- register name
@@ -89,6 +110,21 @@ local function dispatch_slave(fd)
 		if address then
 			socket.write(fd, pack_package("N", name, address))
 		end
+	elseif t == 'L' then
+		-- link slave (name is the slave id)
+		local node = slave_node[name]
+		if node == nil then
+			local link = pending_link[name]
+			if link == nil then
+				link = {}
+				pending_link[name] = link
+			end
+			table.insert(link, slave_id)
+		elseif node.fd == 0 then
+			socket.write(fd, pack_package("D", name))
+		elseif name ~= slave_id then
+			link_slave(slave_id, name)
+		end
 	else
 		skynet.error("Invalid slave message type " .. t)
 	end
@@ -97,12 +133,14 @@ end
 local function monitor_slave(slave_id, slave_address)
 	local fd = slave_node[slave_id].fd
 	skynet.error(string.format("Harbor %d (fd=%d) report %s", slave_id, fd, slave_address))
-	while pcall(dispatch_slave, fd) do end
+	while pcall(dispatch_slave, fd, slave_id) do end
 	skynet.error("slave " ..slave_id .. " is down")
 	local message = pack_package("D", slave_id)
 	slave_node[slave_id].fd = 0
 	for k,v in pairs(slave_node) do
-		socket.write(v.fd, message)
+		if v.fd ~= 0 then
+			socket.write(v.fd, message)
+		end
 	end
 	socket.close(fd)
 end
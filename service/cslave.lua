@@ -4,6 +4,9 @@ require "skynet.manager"	-- import skynet.launch, ...
 local table = table
 
 local slaves = {}
+local connecting = {}	-- slave id -> true, socket.open is not returned
+local linking = {}	-- slave id -> true, LINK is sent to master
+local link_wait = {}	-- slave id -> { response }, harbor.link before connected
 local connect_queue = {}
 local globalname = {}
 local queryname = {}
@@ -11,6 +14,8 @@ local harbor = {}
 local harbor_service
 local monitor = {}
 local monitor_master_set = {}
+local harbor_bits = tonumber(skynet.getenv "harbor_bits")
+local id_format = harbor_bits > 8 and ">I2" or ">I1"	-- the harbor id in handshake
 
 local function read_package(fd)
 	local sz = socket.read(fd, 1)
@@ -37,13 +42,47 @@ local function monitor_clear(id)
 	end
 end
 
+-- the slave is connected, harbor.link before it begins to monitor the connection
+local function slave_connected(id)
+	linking[id] = nil
+	monitor_clear(id)
+	local v = link_wait[id]
+	if v then
+		link_wait[id] = nil
+		monitor[id] = v
+	end
+end
+
+-- the slave is down before connected
+local function slave_down(id)
+	linking[id] = nil
+	local v = link_wait[id]
+	if v then
+		link_wait[id] = nil
+		for _, resp in ipairs(v) do
+			resp(true)
+		end
+	end
+	skynet.send(harbor_service, "harbor", "D " .. id)
+end
+
+local function request_link(master_fd, id)
+	if slaves[id] == nil and not linking[id] then
+		linking[id] = true
+		socket.write(master_fd, pack_package("L", id))
+	end
+end
+
 local function connect_slave(slave_id, address)
 	local ok, err = pcall(function()
-		if slaves[slave_id] == nil then
-			local fd = assert(socket.open(address), "Can't connect to "..address)
+		if slaves[slave_id] == nil and not connecting[slave_id] then
+			connecting[slave_id] = true
+			local fd = socket.open(address)
+			connecting[slave_id] = nil
+			assert(fd, "Can't connect to "..address)
 			skynet.error(string.format("Connect to harbor %d (fd=%d), %s", slave_id, fd, address))
 			slaves[slave_id] = fd
-			monitor_clear(slave_id)
+			slave_connected(slave_id)
 			socket.abandon(fd)
 			skynet.send(harbor_service, "harbor", string.format("S %d %d",fd,slave_id))
 		end
@@ -97,6 +136,8 @@ local function monitor_master(master_fd)
 				if fd then
 					monitor_clear(id_name)
 					socket.close(fd)
+				else
+					slave_down(id_name)
 				end
 			end
 		else
@@ -112,20 +153,20 @@ end
 
 local function accept_slave(fd)
 	socket.start(fd)
-	local id = socket.read(fd, 1)
+	local id = socket.read(fd, string.packsize(id_format))
 	if not id then
 		skynet.error(string.format("Connection (fd =%d) closed", fd))
 		socket.close(fd)
 		return
 	end
-	id = string.byte(id)
+	id = string.unpack(id_format, id)
 	if slaves[id] ~= nil then
 		skynet.error(string.format("Slave %d exist (fd =%d)", id, fd))
 		socket.close(fd)
 		return
 	end
 	slaves[id] = fd
-	monitor_clear(id)
+	slave_connected(id)
 	socket.abandon(fd)
 	skynet.error(string.format("Harbor %d connected (fd = %d)", id, fd))
 	skynet.send(harbor_service, "harbor", string.format("A %d %d", fd, id))
@@ -163,6 +204,9 @@ local function monitor_harbor(master_fd)
 				monitor_clear(id)
 			end
 			slaves[id] = false
+		elseif t == 'L' then
+			-- connect harbor on demand
+			request_link(master_fd, tonumber(arg))
 		else
 			skynet.error("Unknown command ", command)
 		end
@@ -183,6 +227,13 @@ function harbor.LINK(fd, id)
 			monitor[id] = {}
 		end
 		table.insert(monitor[id], skynet.response())
+	elseif slaves[id] == nil then
+		-- not connected yet, connect it and then monitor it
+		if link_wait[id] == nil then
+			link_wait[id] = {}
+		end
+		table.insert(link_wait[id], skynet.response())
+		request_link(fd, id)
 	else
 		skynet.ret()
 	end
@@ -198,11 +249,28 @@ function harbor.CONNECT(fd, id)
 			monitor[id] = {}
 		end
 		table.insert(monitor[id], skynet.response())
+		request_link(fd, id)
 	else
 		skynet.ret()
 	end
 end
 
+function harbor.STAT()
+	local result = {}
+	local stat = skynet.call(harbor_service, "harbor", "T")
+	for id, status, send_msg, send_bytes, send_write, recv_msg, recv_bytes in stat:gmatch "(%d+) (%d+) (%d+) (%d+) (%d+) (%d+) (%d+)\n" do
+		result[tonumber(id)] = {
+			status = tonumber(status),
+			send_msg = tonumber(send_msg),
+			send_bytes = tonumber(send_bytes),
+			send_write = tonumber(send_write),
+			recv_msg = tonumber(recv_msg),
+			recv_bytes = tonumber(recv_bytes),
+		}
+	end
+	skynet.ret(skynet.pack(result))
+end
+
 function harbor.QUERYNAME(fd, name)
 	if name:byte() == 46 then	-- "." , local name
 		skynet.ret(skynet.pack(skynet.localname(name)))
@@ -239,29 +307,30 @@ skynet.start(function()
 
 	harbor_service = assert(skynet.launch("harbor", harbor_id, skynet.self()))
 
-	local hs_message = pack_package("H", harbor_id, slave_address)
+	local hs_message = pack_package("H", harbor_id, slave_address, harbor_bits)
 	socket.write(master_fd, hs_message)
 	local t, n = read_package(master_fd)
 	assert(t == "W" and type(n) == "number", "slave shakehand failed")
 	skynet.error(string.format("Waiting for %d harbors", n))
 	skynet.fork(monitor_master, master_fd)
-	if n > 0 then
-		local co = coroutine.running()
-		socket.start(slave_fd, function(fd, addr)
-			skynet.error(string.format("New connection (fd = %d, %s)",fd, addr))
-			if pcall(accept_slave,fd) then
-				local s = 0
-				for k,v in pairs(slaves) do
-					s = s + 1
-				end
-				if s >= n then
-					skynet.wakeup(co)
-				end
+	-- keep listening, because the harbors connect on demand
+	local co = n > 0 and coroutine.running()
+	socket.start(slave_fd, function(fd, addr)
+		skynet.error(string.format("New connection (fd = %d, %s)",fd, addr))
+		if pcall(accept_slave,fd) and co then
+			local s = 0
+			for k,v in pairs(slaves) do
+				s = s + 1
 			end
-		end)
+			if s >= n then
+				skynet.wakeup(co)
+				co = nil
+			end
+		end
+	end)
+	if co then
 		skynet.wait()
 	end
-	socket.close(slave_fd)
 	skynet.error("Shakehand ready")
 	skynet.fork(ready)
 end)
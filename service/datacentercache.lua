@@ -0,0 +1,64 @@
+local skynet = require "skynet"
+local datacenter = require "datacenter"
+
+--[[
+	The read through cache of datacenter in each node.
+	The query results are cached by the key path, and all the results of a top level key
+	are dropped when datacenterd sends INVALIDATE (the key is updated).
+	The misses (nil) are not cached, so probing the keys doesn't grow the cache.
+]]
+
+local command = {}
+local cache = {}	-- key -> { [VALUE] = result, [subkey] = { ... } }
+local VALUE = {}
+
+local function lookup(node, key, ...)
+	if node == nil then
+		return
+	end
+	if key == nil then
+		return node[VALUE]
+	end
+	return lookup(node[key], ...)
+end
+
+local function store(node, value, key, ...)
+	if key == nil then
+		node[VALUE] = value
+		return
+	end
+	local child = node[key]
+	if child == nil then
+		child = {}
+		node[key] = child
+	end
+	return store(child, value, ...)
+end
+
+function command.GET(key, ...)
+	local v = lookup(cache[key], ...)
+	if v == nil then
+		-- the responses and INVALIDATE from the shard are in order, so the result is never older than the last INVALIDATE
+		v = skynet.call(datacenter.shard(key), "lua", "CQUERY", key, ...)
+		if v ~= nil then
+			local node = cache[key]
+			if node == nil then
+				node = {}
+				cache[key] = node
+			end
+			store(node, v, ...)
+		end
+	end
+	return v
+end
+
+function command.INVALIDATE(key)
+	cache[key] = nil
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function (_, _, cmd, ...)
+		local f = assert(command[cmd])
+		skynet.ret(skynet.pack(f(...)))
+	end)
+end)
@@ -4,6 +4,8 @@ local command = {}
 local database = {}
 local wait_queue = {}
 local mode = {}
+local shards	-- all the shards, only in the first one (named DATACENTER)
+local subscriber = {}	-- key -> { datacentercache address -> true }
 
 local function query(db, key, ...)
 	if key == nil then
@@ -14,12 +16,78 @@ local function query(db, key, ...)
 end
 
 function command.QUERY(key, ...)
+	if key == nil then
+		-- the whole database of this shard
+		return database
+	end
 	local d = database[key]
 	if d then
 		return query(d, ...)
 	end
 end
 
+-- query from datacentercache, the cache will be invalidated when the key is updated.
+-- The cache doesn't keep the misses, so only subscribe it when the result isn't nil.
+function command.CQUERY(source, key, ...)
+	local ret = command.QUERY(key, ...)
+	if ret ~= nil then
+		local s = subscriber[key]
+		if s == nil then
+			s = {}
+			subscriber[key] = s
+		end
+		s[source] = true
+	end
+	return ret
+end
+
+local INVALIDATE_TIMEOUT = 300	-- 3s
+
+-- wait for all the caches of the key invalidated, so the readers in any node never get the old value after UPDATE returns.
+-- Don't wait more than INVALIDATE_TIMEOUT for the caches which don't answer (the node may be down),
+-- they are dropped from the subscribers, and the INVALIDATE is still delivered in order if the cache is alive.
+local function invalidate(key)
+	local s = subscriber[key]
+	if s == nil then
+		return
+	end
+	subscriber[key] = nil
+	local co = coroutine.running()
+	local n = 0
+	local done = false
+	local function wakeup()
+		if not done then
+			done = true
+			skynet.wakeup(co)
+		end
+	end
+	for address in pairs(s) do
+		n = n + 1
+		skynet.fork(function()
+			-- ignore error, the cache (or the node) may be dead
+			pcall(skynet.call, address, "lua", "INVALIDATE", key)
+			n = n - 1
+			if n == 0 then
+				wakeup()
+			end
+		end)
+	end
+	skynet.timeout(INVALIDATE_TIMEOUT, function()
+		if not done then
+			skynet.error(string.format("datacenter invalidate %s timeout, %d caches not answered", tostring(key), n))
+			wakeup()
+		end
+	end)
+	skynet.wait()
+end
+
+function command.SHARD(list)
+	if list then
+		shards = list
+	end
+	return shards
+end
+
 local function update(db, key, value, ...)
 	if select("#",...) == 0 then
 		local ret = db[key]
@@ -59,6 +127,7 @@ end
 
 function command.UPDATE(...)
 	local ret, value = update(database, ...)
+	invalidate((...))
 	if ret or value == nil then
 		return ret
 	end
@@ -94,8 +163,10 @@ local function waitfor(db, key1, key2, ...)
 end
 
 skynet.start(function()
-	skynet.dispatch("lua", function (_, _, cmd, ...)
-		if cmd == "WAIT" then
+	skynet.dispatch("lua", function (_, source, cmd, ...)
+		if cmd == "CQUERY" then
+			skynet.ret(skynet.pack(command.CQUERY(source, ...)))
+		elseif cmd == "WAIT" then
 			local ret = command.QUERY(...)
 			if ret then
 				skynet.ret(skynet.pack(ret))
@@ -156,6 +156,7 @@ function COMMAND.help()
 		signal = "signal address sig",
 		cmem = "Show C memory info",
 		shrtbl = "Show shared short string table info",
+		netstat = "Show accept stat of listen sockets",
 		ping = "ping address",
 		call = "call address ...",
 	}
@@ -207,7 +208,7 @@ end
 
 local function adjust_address(address)
 	if address:sub(1,1) ~= ":" then
-		address = assert(tonumber("0x" .. address), "Need an address") | (skynet.harbor(skynet.self()) << 24)
+		address = assert(tonumber("0x" .. address), "Need an address") | (skynet.harbor(skynet.self()) << (32 - tonumber(skynet.getenv "harbor_bits")))
 	end
 	return address
 end
@@ -329,6 +330,25 @@ function COMMAND.shrtbl()
 	return { n = n, total = total, longest = longest, space = space }
 end
 
+local last_accept = { accept = 0, ti = 0 }
+
+function COMMAND.netstat()
+	local accept, wakeup, fail = socket.accept_stat()
+	local ti = skynet.now()
+	local result = {
+		accept = accept,
+		wakeup = wakeup,
+		fail = fail,
+		batch = wakeup > 0 and string.format("%.2f", accept / wakeup) or "0",
+	}
+	if last_accept.ti > 0 and ti > last_accept.ti then
+		result.rate = string.format("%.1f/s", (accept - last_accept.accept) * 100 / (ti - last_accept.ti))
+	end
+	last_accept.accept = accept
+	last_accept.ti = ti
+	return result
+end
+
 function COMMAND.ping(address)
 	address = adjust_address(address)
 	local ti = skynet.now()
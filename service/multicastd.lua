@@ -3,11 +3,13 @@ local mc = require "multicast.core"
 local datacenter = require "datacenter"
 
 local harbor_id = skynet.harbor(skynet.self())
+local REMOTE_MAX = 1 << tonumber(skynet.getenv "harbor_bits")	-- the low bits of channel id is harbor_id
 
 local command = {}
-local channel = {}
-local channel_n = {}
-local channel_remote = {}
+local channel = {}	-- channel id -> subscriber group (See mc.newgroup)
+local channel_remote = {}	-- channel id -> { node -> true }, only in the owner node
+local remote_address = {}	-- channel id -> { multicastd address of the remote nodes }
+local channel_stat = {}	-- channel id -> { message, bytes, delivered, transfer }
 local channel_id = harbor_id
 local NORET = {}
 
@@ -19,37 +21,46 @@ end
 
 local node_address = setmetatable({}, { __index = get_address })
 
--- new LOCAL channel , The low 8bit is the same with harbor_id
+-- new LOCAL channel , The low bits (harbor_bits) is the same with harbor_id
 function command.NEW()
 	while channel[channel_id] do
 		channel_id = mc.nextid(channel_id)
 	end
-	channel[channel_id] = {}
-	channel_n[channel_id] = 0
+	channel[channel_id] = mc.newgroup()
 	local ret = channel_id
 	channel_id = mc.nextid(channel_id)
 	return ret
 end
 
+local function get_stat(c)
+	local stat = channel_stat[c]
+	if stat == nil then
+		stat = { message = 0, bytes = 0, delivered = 0, transfer = 0 }
+		channel_stat[c] = stat
+	end
+	return stat
+end
+
 -- MUST call by the owner node of channel, delete a remote channel
 function command.DELR(source, c)
 	channel[c] = nil
-	channel_n[c] = nil
+	channel_stat[c] = nil
 	return NORET
 end
 
 -- delete a channel, if the channel is remote, forward the command to the owner node
 -- otherwise, delete the channel, and call all the remote node, DELR
 function command.DEL(source, c)
-	local node = c % 256
+	local node = c % REMOTE_MAX
 	if node ~= harbor_id then
 		skynet.send(node_address[node], "lua", "DEL", c)
 		return NORET
 	end
 	local remote = channel_remote[c]
 	channel[c] = nil
-	channel_n[c] = nil
 	channel_remote[c] = nil
+	remote_address[c] = nil
+	channel_stat[c] = nil
 	if remote then
 		for node in pairs(remote) do
 			skynet.send(node_address[node], "lua", "DELR", c)
@@ -58,37 +69,49 @@ function command.DEL(source, c)
 	return NORET
 end
 
+-- the address list of remote nodes for mc.forward
+local function update_remote(c)
+	local group = channel_remote[c]
+	local address = {}
+	if group then
+		for node in pairs(group) do
+			table.insert(address, node_address[node])
+		end
+	end
+	remote_address[c] = #address > 0 and address or nil
+end
+
 -- forward multicast message to a node (channel id use the session field)
 local function remote_publish(node, channel, source, ...)
 	skynet.redirect(node_address[node], source, "multicast", channel, ...)
 end
 
--- publish a message, for local node, use the message pointer (call mc.bind to add the reference)
--- for remote node, call remote_publish. (call mc.unpack and skynet.tostring to convert message pointer to string)
-local function publish(c , source, pack, size)
-	local remote = channel_remote[c]
-	if remote then
-		-- remote publish should unpack the pack, because we should not publish the pointer out.
-		local _, msg, sz = mc.unpack(pack, size)
-		local msg = skynet.tostring(msg,sz)
-		for node in pairs(remote) do
-			remote_publish(node, c, source, msg)
-		end
-	end
-
+-- publish a message to the local subscribers, use the message pointer (mc.publish adds the reference and sends it to the group)
+local function publish_local(c, source, pack, size, stat)
 	local group = channel[c]
-	if group == nil or next(group) == nil then
+	if group == nil then
 		-- dead channel, delete the pack. mc.bind returns the pointer in pack and free the pack (struct mc_package **)
 		local pack = mc.bind(pack, 1)
 		mc.close(pack)
 		return
 	end
-	local msg = skynet.tostring(pack, size)	-- copy (pack,size) to a string
-	mc.bind(pack, channel_n[c])	-- mc.bind will free the pack(struct mc_package **)
-	for k in pairs(group) do
-		-- the msg is a pointer to the real message, publish pointer in local is ok.
-		skynet.redirect(k, source, "multicast", c , msg)
+	-- the pointer of the package is sent to the subscribers, publish pointer in local is ok.
+	-- the package is freed if there is no subscriber
+	stat.delivered = stat.delivered + mc.publish(group, pack, size, source, c)
+end
+
+-- publish a message, for remote nodes, mc.forward sends one copy of the message (not the pointer) to each node,
+-- except the node of the publisher, which publishes to its subscribers itself. (See command.PUB)
+local function publish(c , source, pack, size)
+	local stat = get_stat(c)
+	local _, _, sz = mc.unpack(pack, size)
+	stat.message = stat.message + 1
+	stat.bytes = stat.bytes + sz
+	local remote = remote_address[c]
+	if remote then
+		stat.transfer = stat.transfer + mc.forward(pack, size, source, c, remote, skynet.harbor(source))
 	end
+	publish_local(c, source, pack, size, stat)
 end
 
 skynet.register_protocol {
@@ -104,15 +127,41 @@ skynet.register_protocol {
 -- If the caller is local, call publish
 function command.PUB(source, c, pack, size)
 	assert(skynet.harbor(source) == harbor_id)
-	local node = c % 256
+	local node = c % REMOTE_MAX
 	if node ~= harbor_id then
-		-- remote publish
-		remote_publish(node, c, source, mc.remote(pack))
+		-- remote publish, the owner node forwards it to the other nodes
+		local group = channel[c]
+		if group and mc.count(group) > 0 then
+			-- send a copy to the owner, and publish to the subscribers in this node directly
+			local stat = get_stat(c)
+			local _, _, sz = mc.unpack(pack, size)
+			stat.message = stat.message + 1
+			stat.bytes = stat.bytes + sz
+			stat.transfer = stat.transfer + mc.forward(pack, size, source, c, { node_address[node] })
+			publish_local(c, source, pack, size, stat)
+		else
+			remote_publish(node, c, source, mc.remote(pack))
+		end
 	else
 		publish(c, source, pack,size)
 	end
 end
 
+-- return the delivery stat of the channel in this node
+function command.STAT(source, c)
+	local stat = channel_stat[c] or { message = 0, bytes = 0, delivered = 0, transfer = 0 }
+	local group = channel[c]
+	local remote = remote_address[c]
+	return {
+		message = stat.message,	-- messages published
+		bytes = stat.bytes,	-- bytes of the messages published
+		delivered = stat.delivered,	-- messages delivered to the local subscribers
+		transfer = stat.transfer,	-- copies sent to other nodes
+		subscribers = group and mc.count(group) or 0,	-- local subscribers
+		nodes = remote and #remote or 0,	-- remote nodes subscribed (in the owner node)
+	}
+end
+
 -- the node (source) subscribe a channel
 -- MUST call by channel owner node (assert source is not local and channel is create by self)
 -- If channel is not exist, return true
@@ -123,19 +172,22 @@ function command.SUBR(source, c)
 		-- channel none exist
 		return true
 	end
-	assert(node ~= harbor_id and c % 256 == harbor_id)
+	assert(node ~= harbor_id and c % REMOTE_MAX == harbor_id)
 	local group = channel_remote[c]
 	if group == nil then
 		group = {}
 		channel_remote[c] = group
 	end
-	group[node] = true
+	if not group[node] then
+		group[node] = true
+		update_remote(c)
+	end
 end
 
 -- the service (source) subscribe a channel
 -- If the channel is remote, node subscribe it by send a SUBR to the owner .
 function command.SUB(source, c)
-	local node = c % 256
+	local node = c % REMOTE_MAX
 	if node ~= harbor_id then
 		-- remote group
 		if channel[c] == nil then
@@ -144,15 +196,13 @@ function command.SUB(source, c)
 			end
 			if channel[c] == nil then
 				-- double check, because skynet.call whould yield, other SUB may occur.
-				channel[c] = {}
-				channel_n[c] = 0
+				channel[c] = mc.newgroup()
 			end
 		end
 	end
 	local group = channel[c]
-	if group and not group[source] then
-		channel_n[c] = channel_n[c] + 1
-		group[source] = true
+	if group then
+		mc.subscribe(group, source)
 	end
 end
 
@@ -162,23 +212,20 @@ function command.USUBR(source, c)
 	assert(node ~= harbor_id)
 	local group = assert(channel_remote[c])
 	group[node] = nil
+	update_remote(c)
 	return NORET
 end
 
 -- Unsubscribe a channel, if the subscriber is empty and the channel is remote, send USUBR to the channel owner
 function command.USUB(source, c)
 	local group = assert(channel[c])
-	if group[source] then
-		group[source] = nil
-		channel_n[c] = channel_n[c] - 1
-		if channel_n[c] == 0 then
-			local node = c % 256
-			if node ~= harbor_id then
-				-- remote group
-				channel[c] = nil
-				channel_n[c] = nil
-				skynet.send(node_address[node], "lua", "USUBR", c)
-			end
+	if mc.unsubscribe(group, source) and mc.count(group) == 0 then
+		local node = c % REMOTE_MAX
+		if node ~= harbor_id then
+			-- remote group
+			channel[c] = nil
+			channel_stat[c] = nil
+			skynet.send(node_address[node], "lua", "USUBR", c)
 		end
 	end
 	return NORET
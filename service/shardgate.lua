@@ -0,0 +1,55 @@
+local skynet = require "skynet"
+
+--[[
+	Start N gate services listening on the same port with SO_REUSEPORT,
+	the kernel spreads the incoming connections over them.
+
+	skynet.call(shardgate, "lua", "open", { port = 8888, shard = 4, watchdog = watchdog, ... })
+
+	The conf is the same as gate, and every shard reports to the same watchdog
+	(conf.watchdog, or the caller of open). Each shard keeps its own connection table,
+	so the watchdog (and agents) should send forward/accept/kick to the shard which reported
+	the connection (the source of the socket messages), not to shardgate.
+]]
+
+local gate = ...
+gate = gate or "gate"
+
+local shards = {}
+
+local CMD = {}
+
+function CMD.open(source, conf)
+	assert(#shards == 0)
+	local n = conf.shard or tonumber(skynet.getenv "thread") or 1
+	local shard_conf = {}
+	for k,v in pairs(conf) do
+		shard_conf[k] = v
+	end
+	shard_conf.watchdog = conf.watchdog or source
+	shard_conf.reuseport = true
+	for i = 1, n do
+		shards[i] = skynet.newservice(gate)
+	end
+	for i = 1, n do
+		skynet.call(shards[i], "lua", "open", shard_conf)
+	end
+	return shards
+end
+
+function CMD.close()
+	for _, s in ipairs(shards) do
+		skynet.call(s, "lua", "close")
+	end
+end
+
+function CMD.shards()
+	return shards
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_, source, cmd, ...)
+		local f = assert(CMD[cmd])
+		skynet.ret(skynet.pack(f(source, ...)))
+	end)
+end)
@@ -10,9 +10,9 @@ local pool_count = {}
 local objmap = {}
 local collect_tick = 600
 
-local function newobj(name, tbl)
+local function newobj(name, tbl, cobj)
 	assert(pool[name] == nil)
-	local cobj = sharedata.host.new(tbl)
+	cobj = cobj or sharedata.host.new(tbl)
 	sharedata.host.incref(cobj)
 	local v = { value = tbl , obj = cobj, watch = {} }
 	objmap[cobj] = v
@@ -102,7 +102,7 @@ function CMD.confirm(cobj)
 	return NORET
 end
 
-function CMD.update(name, t, ...)
+local function replace(name, newfunc, ...)
 	local v = pool[name]
 	local watch, oldcobj
 	if v then
@@ -113,7 +113,7 @@ function CMD.update(name, t, ...)
 		pool[name] = nil
 		pool_count[name] = nil
 	end
-	CMD.new(name, t, ...)
+	newfunc(name, ...)
 	local newobj = pool[name].obj
 	if watch then
 		sharedata.host.markdirty(oldcobj)
@@ -124,6 +124,74 @@ function CMD.update(name, t, ...)
 	collect10sec()	-- collect in 10 sec
 end
 
+function CMD.update(name, t, ...)
+	replace(name, CMD.new, t, ...)
+end
+
+-- new or update with a snapshot file saved by sharedata.host.save
+function CMD.map(name, filename)
+	replace(name, newobj, nil, sharedata.host.map(filename))
+end
+
+local function clone(t)
+	local r = {}
+	for k,v in pairs(t) do
+		r[k] = v
+	end
+	return r
+end
+
+-- Set value at path in the copy of the tables along the path, and mark the changed keys :
+-- true for a replaced sub table, a table for a patched one
+local function setpath(value, marks, path, v)
+	if type(path) ~= "table" then
+		path = { path }
+	end
+	local n = #path
+	assert(n > 0, "Empty patch path")
+	for i = 1, n-1 do
+		local k = path[i]
+		local child = value[k]
+		if marks ~= true then
+			local m = marks[k]
+			if m == nil then
+				if type(child) == "table" then
+					child = clone(child)
+					value[k] = child
+					m = {}
+				else
+					m = true
+				end
+				marks[k] = m
+			end
+			marks = m
+		end
+		if type(child) ~= "table" then
+			-- a new sub table
+			child = {}
+			value[k] = child
+		end
+		value = child
+	end
+	value[path[n]] = v
+	if marks ~= true then
+		marks[path[n]] = true
+	end
+end
+
+-- changes : { { path, value }, ... } , path is a key or a list of keys
+function CMD.patch(name, changes)
+	local v = assert(pool[name])
+	-- the object mapped from a snapshot has no lua value
+	local value = v.value and clone(v.value) or sharedata.copy(v.obj)
+	local marks = {}
+	for _, change in ipairs(changes) do
+		setpath(value, marks, change[1], change[2])
+	end
+	local cobj = sharedata.host.patch(value, v.obj, marks)
+	replace(name, newobj, value, cobj)
+end
+
 local function check_watch(queue)
 	local n = 0
 	for k,response in pairs(queue) do
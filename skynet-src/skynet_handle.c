@@ -38,6 +38,9 @@ struct handle_storage {
 
 static struct handle_storage *H = NULL;
 
+uint32_t HANDLE_MASK = 0xffffff;
+int HANDLE_REMOTE_SHIFT = 24;
+
 // 注册ctx，将 ctx 存到 handle_storage 哈希表中，并得到一个handle
 uint32_t
 skynet_handle_register(struct skynet_context *ctx) {
@@ -155,7 +158,7 @@ skynet_handle_grab(uint32_t handle) {
 	struct skynet_context * ctx = s->slot[hash];
 	if (ctx && skynet_context_handle(ctx) == handle) {
 		result = ctx;
-		skynet_context_grab(result);__sync_add_and_fetch(&ctx->ref,1);	skynet_context引用计数加1
+		skynet_context_grab(result);
 	}
 
 	rwlock_runlock(&s->lock);
@@ -260,8 +263,11 @@ skynet_handle_namehandle(uint32_t handle, const char *name) {
 
 // 初始化一个 handle 就是初始化 handle_storage
 void 
-skynet_handle_init(int harbor) {
+skynet_handle_init(int harbor, int bits) {
 	assert(H==NULL);
+	assert(bits >= HANDLE_REMOTE_BITS && bits <= HANDLE_REMOTE_BITS_MAX);
+	HANDLE_REMOTE_SHIFT = 32 - bits;
+	HANDLE_MASK = (1u << HANDLE_REMOTE_SHIFT) - 1;
 	struct handle_storage * s = skynet_malloc(sizeof(*H));
 	s->slot_size = DEFAULT_SLOT_SIZE;
 	s->slot = skynet_malloc(s->slot_size * sizeof(struct skynet_context *));// 为 skynet_ctx 分配空间
@@ -269,7 +275,7 @@ skynet_handle_init(int harbor) {
 
 	rwlock_init(&s->lock);
 	// reserve 0 for system
-	s->harbor = (uint32_t) (harbor & 0xff) << HANDLE_REMOTE_SHIFT;
+	s->harbor = (uint32_t) (harbor & (~HANDLE_MASK >> HANDLE_REMOTE_SHIFT)) << HANDLE_REMOTE_SHIFT;
 	s->handle_index = 1;// handle句柄从1开始,0保留
 	s->name_cap = 2;     // 名字容量初始为2
 	s->name_count = 0;
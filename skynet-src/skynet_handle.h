@@ -3,9 +3,14 @@
 
 #include <stdint.h>
 
-// reserve high 8 bits for remote id
-#define HANDLE_MASK 0xffffff
-#define HANDLE_REMOTE_SHIFT 24
+// reserve high bits for remote id, 8 bits by default (harbor_bits in config)
+// It can't be less than 8, because harbor sends the message type (8 bits) in the same place.
+#define HANDLE_REMOTE_BITS 8
+#define HANDLE_REMOTE_BITS_MAX 16
+
+// set by skynet_handle_init , 0xffffff and 24 for 8 bits of remote id
+extern uint32_t HANDLE_MASK;
+extern int HANDLE_REMOTE_SHIFT;
 
 struct skynet_context;
 
@@ -17,6 +22,6 @@ void skynet_handle_retireall();
 uint32_t skynet_handle_findname(const char * name);
 const char * skynet_handle_namehandle(uint32_t handle, const char *name);
 
-void skynet_handle_init(int harbor);
+void skynet_handle_init(int harbor, int bits);
 
 #endif
@@ -5,7 +5,8 @@
 #include <stdlib.h>
 
 #define GLOBALNAME_LENGTH 16 // 全局名字的长度
-#define REMOTE_MAX 256
+// the number of harbor id, 256 for 8 bits (HANDLE_REMOTE_SHIFT is in skynet_handle.h)
+#define REMOTE_MAX (1 << (32 - HANDLE_REMOTE_SHIFT))
 
 // 远程服务名和对应的handle
 struct remote_name {
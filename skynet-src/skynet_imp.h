@@ -5,6 +5,7 @@
 struct skynet_config {
 	int thread;    //线程数
 	int harbor;    //harbor id
+	int harbor_bits;    //bits of harbor id in handle
 	int profile; 
 	const char * daemon; //后台模式启动 "./skynet.pid" 
 	const char * module_path; //模块 服务路径 .so文件路径
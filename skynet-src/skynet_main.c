@@ -3,6 +3,7 @@
 #include "skynet_imp.h"
 #include "skynet_env.h"
 #include "skynet_server.h"
+#include "skynet_handle.h"
 #include "luashrtbl.h"
 
 #include <stdio.h>
@@ -154,6 +155,7 @@ main(int argc, char *argv[]) {
 	config.thread =  optint("thread",8); //工作线程数量
 	config.module_path = optstring("cpath","./cservice/?.so"); //C 编写的服务模块的位置，通常指 cservice 下那些 .so
 	config.harbor = optint("harbor", 1);                     //节点编号 可以是 1-255 间的任意整数
+	config.harbor_bits = optint("harbor_bits", HANDLE_REMOTE_BITS); //handle 高位中节点编号的位数 8-16 默认 8 , 12 可以支持 4095 个节点
 	config.bootstrap = optstring("bootstrap","snlua bootstrap"); //启动的第一个服务以及其启动参数
 	config.daemon = optstring("daemon", NULL);             //后台模式启动
 	config.logger = optstring("logger", NULL);             //日志文件
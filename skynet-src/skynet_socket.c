@@ -143,6 +143,17 @@ skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int
 	return socket_server_listen(SOCKET_SERVER, source, host, port, backlog);
 }
 
+void
+skynet_socket_accept_stat(struct socket_accept_stat *stat) {
+	socket_server_accept_stat(SOCKET_SERVER, stat);
+}
+
+int 
+skynet_socket_listen_reuseport(struct skynet_context *ctx, const char *host, int port, int backlog) {
+	uint32_t source = skynet_context_handle(ctx);
+	return socket_server_listen_reuseport(SOCKET_SERVER, source, host, port, backlog);
+}
+
 int 
 skynet_socket_connect(struct skynet_context *ctx, const char *host, int port) {
 	uint32_t source = skynet_context_handle(ctx);
@@ -2,6 +2,7 @@
 #define skynet_socket_h
 
 struct skynet_context;
+struct socket_accept_stat;
 
 #define SKYNET_SOCKET_TYPE_DATA 1
 #define SKYNET_SOCKET_TYPE_CONNECT 2
@@ -26,12 +27,14 @@ int skynet_socket_poll();  //事件循环
 int skynet_socket_send(struct skynet_context *ctx, int id, void *buffer, int sz);// 发送数据
 void skynet_socket_send_lowpriority(struct skynet_context *ctx, int id, void *buffer, int sz);// 低优先级发送数据
 int skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog);// 监听 Socket
+int skynet_socket_listen_reuseport(struct skynet_context *ctx, const char *host, int port, int backlog);// 监听 Socket (SO_REUSEPORT)
 int skynet_socket_connect(struct skynet_context *ctx, const char *host, int port);// Socket 连接
 int skynet_socket_bind(struct skynet_context *ctx, int fd);// 绑定事件
 void skynet_socket_close(struct skynet_context *ctx, int id);// 关闭 Socket
 void skynet_socket_shutdown(struct skynet_context *ctx, int id);
 void skynet_socket_start(struct skynet_context *ctx, int id);// 启动 Socket 加入事件循环
 void skynet_socket_nodelay(struct skynet_context *ctx, int id);
+void skynet_socket_accept_stat(struct socket_accept_stat *stat);
 
 int skynet_socket_udp(struct skynet_context *ctx, const char * addr, int port);
 int skynet_socket_udp_connect(struct skynet_context *ctx, int id, const char * addr, int port);
@@ -266,8 +266,13 @@ skynet_start(struct skynet_config * config) {
 			exit(1);
 		}
 	}
-	skynet_harbor_init(config->harbor); //初始化节点 编号
-	skynet_handle_init(config->harbor); //初始化句柄 编号和skynet_context 初始化一个 handle 就是初始化 handle_storage H
+	if (config->harbor_bits < HANDLE_REMOTE_BITS || config->harbor_bits > HANDLE_REMOTE_BITS_MAX
+		|| config->harbor < 0 || config->harbor >= (1 << config->harbor_bits)) {
+		fprintf(stderr, "Invalid harbor %d (harbor_bits = %d)\n", config->harbor, config->harbor_bits);
+		exit(1);
+	}
+	skynet_handle_init(config->harbor, config->harbor_bits); //初始化句柄 编号和skynet_context 初始化一个 handle 就是初始化 handle_storage H
+	skynet_harbor_init(config->harbor); //初始化节点 编号 (HANDLE_REMOTE_SHIFT 由 skynet_handle_init 设置)
 	skynet_mq_init();                   //初始化全局队列 Q
 	skynet_module_init(config->module_path);  //初始化模块管理
 	skynet_timer_init(); //初始化定时器
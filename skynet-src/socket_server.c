@@ -1,3 +1,7 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	// for accept4
+#endif
+
 #include "skynet.h"
 
 #include "socket_server.h"
@@ -21,6 +25,7 @@
 #define MAX_SOCKET_P 16
 #define MAX_EVENT 64    // 用于epoll_wait的第三个参数 每次返回事件的多少
 #define MIN_READ_BUFFER 64 // 最小分配的读缓冲大小 为了减少read的调用 尽可能分配大的读缓冲区
+#define MAX_ACCEPT 64	// max connections accepted from one listen socket event before polling others
 #define SOCKET_TYPE_INVALID 0   // 无效的sock fe
 #define SOCKET_TYPE_RESERVE 1   // 预留已经被申请 即将被使用
 #define SOCKET_TYPE_PLISTEN 2   // listen fd但是未加入epoll管理
@@ -95,6 +100,8 @@ struct socket_server {
 	int alloc_id;        // 应用层分配id 用的
 	int event_n;         // epoll_wait 返回的事件数
 	int event_index;     // 当前处理的事件序号
+	int accept_n;        // connections accepted from the current listen event
+	struct socket_accept_stat accept_stat;
 	struct socket_object_interface soi;
 	struct event ev[MAX_EVENT];      // epoll_wait返回的事件集
 	struct socket slot[MAX_SOCKET];  // 应用层预先分配的socket
@@ -315,6 +322,8 @@ socket_server_create() {
 	ss->alloc_id = 0;
 	ss->event_n = 0;
 	ss->event_index = 0;
+	ss->accept_n = 0;
+	memset(&ss->accept_stat, 0, sizeof(ss->accept_stat));
 	memset(&ss->soi, 0, sizeof(ss->soi));
 	FD_ZERO(&ss->rfds);
 	assert(ss->recvctrl_fd < FD_SETSIZE);
@@ -1145,9 +1154,14 @@ static int
 report_accept(struct socket_server *ss, struct socket *s, struct socket_message *result) {
 	union sockaddr_all u;
 	socklen_t len = sizeof(u);
+#ifdef __linux__
+	int client_fd = accept4(s->fd, &u.s, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
 	int client_fd = accept(s->fd, &u.s, &len);
+#endif
 	if (client_fd < 0) {
 		if (errno == EMFILE || errno == ENFILE) {
+			++ss->accept_stat.fail;
 			result->opaque = s->opaque;
 			result->id = s->id;
 			result->ud = 0;
@@ -1159,16 +1173,21 @@ report_accept(struct socket_server *ss, struct socket *s, struct socket_message
 	}
 	int id = reserve_id(ss);
 	if (id < 0) {
+		++ss->accept_stat.fail;
 		close(client_fd);
 		return 0;
 	}
 	socket_keepalive(client_fd);
+#ifndef __linux__
 	sp_nonblocking(client_fd);
+#endif
 	struct socket *ns = new_fd(ss, id, client_fd, PROTOCOL_TCP, s->opaque, false);
 	if (ns == NULL) {
+		++ss->accept_stat.fail;
 		close(client_fd);
 		return 0;
 	}
+	++ss->accept_stat.accept;
 	ns->type = SOCKET_TYPE_PACCEPT;
 	result->opaque = s->opaque;
 	result->id = s->id;
@@ -1223,6 +1242,7 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 		if (ss->event_index == ss->event_n) {
 			ss->event_n = sp_wait(ss->event_fd, ss->ev, MAX_EVENT);
 			ss->checkctrl = 1;
+			ss->accept_n = 0;
 			if (more) {
 				*more = 0;
 			}
@@ -1244,8 +1264,19 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 		case SOCKET_TYPE_LISTEN: {
 			int ok = report_accept(ss, s, result);
 			if (ok > 0) {
+				if (ss->accept_n++ == 0) {
+					++ss->accept_stat.wakeup;
+				}
+				if (ss->accept_n < MAX_ACCEPT) {
+					// accept again on the same listen socket, until EAGAIN or MAX_ACCEPT
+					--ss->event_index;
+				} else {
+					ss->accept_n = 0;
+				}
 				return SOCKET_ACCEPT;
-			} if (ok < 0 ) {
+			}
+			ss->accept_n = 0;
+			if (ok < 0 ) {
 				return SOCKET_ERROR;
 			}
 			// when ok == 0, retry
@@ -1402,7 +1433,7 @@ socket_server_shutdown(struct socket_server *ss, uintptr_t opaque, int id) {
 // return -1 means failed
 // or return AF_INET or AF_INET6
 static int
-do_bind(const char *host, int port, int protocol, int *family) {
+do_bind(const char *host, int port, int protocol, int *family, bool reuseport) {
 	int fd;
 	int status;
 	int reuse = 1;
@@ -1435,6 +1466,16 @@ do_bind(const char *host, int port, int protocol, int *family) {
 	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void *)&reuse, sizeof(int))==-1) {
 		goto _failed;
 	}
+	if (reuseport) {
+#ifdef SO_REUSEPORT
+		// Let the kernel spread the connections over all the sockets bound to the same port
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (void *)&reuse, sizeof(int))==-1) {
+			goto _failed;
+		}
+#else
+		goto _failed;
+#endif
+	}
 	status = bind(fd, (struct sockaddr *)ai_list->ai_addr, ai_list->ai_addrlen);
 	if (status != 0)
 		goto _failed;
@@ -1449,9 +1490,9 @@ _failed_fd:
 }
 
 static int
-do_listen(const char * host, int port, int backlog) {
+do_listen(const char * host, int port, int backlog, bool reuseport) {
 	int family = 0;
-	int listen_fd = do_bind(host, port, IPPROTO_TCP, &family);
+	int listen_fd = do_bind(host, port, IPPROTO_TCP, &family, reuseport);
 	if (listen_fd < 0) {
 		return -1;
 	}
@@ -1459,12 +1500,14 @@ do_listen(const char * host, int port, int backlog) {
 		close(listen_fd);
 		return -1;
 	}
+	// report_accept is called again until EAGAIN, so the listen socket must not block
+	sp_nonblocking(listen_fd);
 	return listen_fd;
 }
 
-int 
-socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog) {
-	int fd = do_listen(addr, port, backlog);
+static int
+listen_request(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog, bool reuseport) {
+	int fd = do_listen(addr, port, backlog, reuseport);
 	if (fd < 0) {
 		return -1;
 	}
@@ -1481,6 +1524,21 @@ socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * ad
 	return id;
 }
 
+int 
+socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog) {
+	return listen_request(ss, opaque, addr, port, backlog, false);
+}
+
+void
+socket_server_accept_stat(struct socket_server *ss, struct socket_accept_stat *stat) {
+	*stat = ss->accept_stat;
+}
+
+int 
+socket_server_listen_reuseport(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog) {
+	return listen_request(ss, opaque, addr, port, backlog, true);
+}
+
 int
 socket_server_bind(struct socket_server *ss, uintptr_t opaque, int fd) {
 	struct request_package request;
@@ -1524,7 +1582,7 @@ socket_server_udp(struct socket_server *ss, uintptr_t opaque, const char * addr,
 	int family;
 	if (port != 0 || addr != NULL) {
 		// bind
-		fd = do_bind(addr, port, IPPROTO_UDP, &family);
+		fd = do_bind(addr, port, IPPROTO_UDP, &family, false);
 		if (fd < 0) {
 			return -1;
 		}
@@ -20,6 +20,13 @@ struct socket_message {
 	char * data;
 };
 
+// counters of accepted connections, updated by the socket thread
+struct socket_accept_stat {
+	uint64_t accept;	// connections accepted
+	uint64_t wakeup;	// listen socket events which accept at least one connection
+	uint64_t fail;		// accept failed (EMFILE, ENFILE, or no free socket slot)
+};
+
 struct socket_server * socket_server_create();
 void socket_server_release(struct socket_server *);
 int socket_server_poll(struct socket_server *, struct socket_message *result, int *more);
@@ -35,6 +42,10 @@ void socket_server_send_lowpriority(struct socket_server *, int id, const void *
 
 // ctrl command below returns id
 int socket_server_listen(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog);
+// listen with SO_REUSEPORT, so that several listen sockets can share one port
+int socket_server_listen_reuseport(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog);
+// the result may be a little stale, it's read without lock
+void socket_server_accept_stat(struct socket_server *, struct socket_accept_stat *stat);
 int socket_server_connect(struct socket_server *, uintptr_t opaque, const char * addr, int port);
 int socket_server_bind(struct socket_server *, uintptr_t opaque, int fd);
 
@@ -93,3 +93,82 @@ print "\n[after replace]"
 t = b:decode()
 
 print("o.hello", bson.type(t.o.hello))
+
+print "\n[projection]"
+t = bson.decode(b, { a = true, d = true, o = true })
+assert(t.a == 2 and #t.d == 4 and bson.type(t.o.hello) == "number" and t.b == nil and t.q == nil)
+for k in pairs(t) do
+	print(k)
+end
+
+print "\n[reply]"
+local driver = require "mongo.driver"
+local docs = {}
+for i = 1, 3 do
+	docs[i] = tostring(bson.encode { id = i, name = "doc" .. i })
+end
+-- request_id, response_id, opcode, flags, cursor_id, starting, number
+local reply = string.pack("<i4i4i4i4i8i4i4", 0, 1, 1, 0, 0, 0, #docs) .. table.concat(docs)
+local ok, id, doc = driver.reply(reply)
+assert(ok and id == 1)
+local n = 0
+while doc do
+	n = n + 1
+	local d = bson.decode(doc, { id = true })
+	assert(d.id == n and d.name == nil)
+	doc = driver.next(reply, doc)
+end
+assert(n == #docs)
+
+print "\n[array]"
+local arr = {}
+for i = 1, 2000 do
+	arr[i] = i % 3 == 0 and i * 0.5 or (i % 3 == 1 and i or i * 2^40)
+end
+arr[1500] = "mixed"
+t = bson.decode(bson.encode { arr = arr })
+assert(#t.arr == #arr)
+for i = 1, #arr do
+	assert(t.arr[i] == arr[i] and math.type(t.arr[i]) == math.type(arr[i]))
+end
+-- the encoder buffer is reused, nested encoding (in __pairs) uses another one
+local nested = setmetatable({}, { __pairs = function()
+	local sub = bson.encode { x = 1 }
+	return next, { sub = sub }, nil
+end })
+t = bson.decode(bson.encode { a = 1, n = nested, arr = { 1, 2, 3 } })
+assert(t.a == 1 and t.n.sub.x == 1 and t.arr[3] == 3)
+-- an error in the middle of encoding gives back the buffer, the next encoding works
+local big = {}
+for i = 1, 10000 do
+	big[i] = "item" .. i
+end
+for i = 1, 100 do
+	assert(not pcall(bson.encode, { list = big, bad = { [true] = 1 } }))
+	assert(not pcall(bson.encode_order, "list", big, "odd"))
+	t = bson.decode(bson.encode { list = big, n = i })
+	assert(#t.list == #big and t.list[10000] == "item10000" and t.n == i)
+	t = bson.decode(bson.encode_order("n", i, "list", big))
+	assert(t.n == i and t.list[1] == "item1")
+end
+
+print "\n[encode benchmark]"
+local N = 100000
+local function bench(name, doc)
+	local start = os.clock()
+	for i = 1, N do
+		bson.encode(doc)
+	end
+	local t = os.clock() - start
+	print(string.format("bson.encode %-12s : %.3f s for %d, %.2f M/s", name, t, N, N / t / 1000000))
+end
+local numbers = {}
+for i = 1, 100 do
+	numbers[i] = i * 1.5
+end
+bench("small", { id = 1, name = "player", level = 30, online = true })
+bench("numbers", { numbers = numbers })
+bench("document", {
+	id = 10001, name = "player", exp = 123456789012, pos = { x = 1, y = 2, z = 3 },
+	skills = { 1, 2, 3, 4, 5, 6, 7, 8 }, items = { { id = 1, count = 10 }, { id = 2, count = 20 } },
+})
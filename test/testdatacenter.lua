@@ -15,9 +15,54 @@ local function f2()
 	datacenter.set("key", "foobar", "bingo")
 end
 
+-- the reads are cached in this node, and the cache is invalidated by set
+local function cache()
+	datacenter.set("cache", "a", 1)
+	assert(datacenter.get("cache", "a") == 1)
+	assert(datacenter.get("cache").a == 1)
+	assert(datacenter.get("cache", "b") == nil)
+	datacenter.set("cache", "b", 2)
+	assert(datacenter.get("cache", "b") == 2 and datacenter.get("cache").b == 2)
+	datacenter.set("cache", "a", nil)
+	assert(datacenter.get("cache", "a") == nil and datacenter.get("cache").b == 2)
+	for i = 1, 100 do
+		datacenter.set("shard" .. i, i)
+	end
+	for i = 1, 100 do
+		assert(datacenter.get("shard" .. i) == i)
+	end
+	-- the whole database (from all the shards)
+	local db = datacenter.get()
+	assert(db.hello == "world" and db.cache.b == 2 and db.shard1 == 1 and db.shard100 == 100)
+	-- the misses are not cached
+	assert(datacenter.get("missing") == nil)
+	datacenter.set("missing", 1)
+	assert(datacenter.get("missing") == 1)
+	print("datacenter cache ok")
+end
+
+-- UPDATE doesn't wait for the cache which doesn't answer INVALIDATE
+local function invalidate_timeout()
+	skynet.dispatch("lua", function(_, _, cmd)
+		assert(cmd == "INVALIDATE")
+		skynet.sleep(1000)
+		skynet.ret()
+	end)
+	datacenter.set("stuck", 1)
+	skynet.call(datacenter.shard "stuck", "lua", "CQUERY", "stuck")
+	local start = skynet.now()
+	datacenter.set("stuck", 2)
+	local t = skynet.now() - start
+	assert(t >= 300 and t < 1000, t)
+	assert(datacenter.get("stuck") == 2)
+	print("datacenter invalidate timeout ok")
+end
+
 skynet.start(function()
 	datacenter.set("hello", "world")
 	print(datacenter.get "hello")
+	cache()
+	invalidate_timeout()
 	skynet.fork(f1)
 	skynet.fork(f2)
 end)
@@ -0,0 +1,128 @@
+local skynet = require "skynet"
+local socket = require "socket"
+require "skynet.manager"	-- import skynet.launch, ...
+
+-- the C gate closes the connection when the 4 bytes header of a package is >= 16M,
+-- even if the top bit is set (it was a negative size)
+
+local netpack = require "netpack"
+
+local gate
+local events = {}
+local waiting
+local agent_mode	-- forward the packages to this service
+local packages = {}	-- forwarded to this service (as agent) in batch mode
+local batches = {}	-- the number of packages in each batch message
+
+skynet.register_protocol {
+	name = "text",
+	id = skynet.PTYPE_TEXT,
+	pack = function(...) return ... end,
+	unpack = skynet.tostring,
+	dispatch = function(_, _, msg)
+		local id, cmd, arg = msg:match "^(%d+) (%S+) ?(.*)"
+		id = tonumber(id)
+		if cmd == "open" then
+			if agent_mode then
+				local self = skynet.address(skynet.self())
+				skynet.send(gate, "text", string.format("forward %d %s %s", id, self, self))
+			end
+			skynet.send(gate, "text", "start " .. id)
+		end
+		table.insert(events, cmd .. " " .. arg)
+		if waiting then
+			skynet.wakeup(waiting)
+		end
+	end
+}
+
+skynet.register_protocol {
+	name = "client",
+	id = skynet.PTYPE_CLIENT,
+	unpack = function(msg, sz) return msg, sz end,
+	dispatch = function(_, _, msg, sz)
+		local n = netpack.batch(msg, sz)
+		for i = 1, n do
+			table.insert(packages, skynet.tostring(netpack.batch(msg, sz, i)))
+		end
+		assert(netpack.batch(msg, sz, n + 1) == nil)
+		table.insert(batches, n)
+		if waiting then
+			skynet.wakeup(waiting)
+		end
+	end
+}
+
+local function wait_event(expect)
+	while #events == 0 do
+		waiting = coroutine.running()
+		skynet.wait()
+		waiting = nil
+	end
+	local ev = table.remove(events, 1)
+	assert(ev:find(expect, 1, true) == 1, ev)
+	return ev
+end
+
+local function test(batch)
+	local port = 8765 + batch
+	gate = skynet.launch("gate", "L", skynet.address(skynet.self()), "127.0.0.1:" .. port, 0, 8, batch)
+	for _, header in ipairs { "\xff\xff\xff\xfc", "\x80\x00\x00\x00", "\x01\x00\x00\x00" } do
+		local fd = socket.open("127.0.0.1", port)
+		wait_event "open"
+		socket.write(fd, string.pack(">s4", "hello"))
+		if batch == 0 then
+			wait_event "data hello"
+		else
+			wait_event "data"	-- the batch message to watchdog is forwarded one by one
+		end
+		socket.write(fd, header .. "xxxxxxxx" .. string.pack(">s4", "world"))
+		wait_event "close"
+		assert(socket.read(fd) == false)
+		socket.close(fd)
+	end
+	skynet.kill(gate)
+end
+
+-- the packages from one socket read are forwarded to the agent in one message, read by netpack.batch
+local function test_batch()
+	local port = 8767
+	agent_mode = true
+	gate = skynet.launch("gate", "L", skynet.address(skynet.self()), "127.0.0.1:" .. port, 0, 8, 1)
+	local fd = socket.open("127.0.0.1", port)
+	wait_event "open"
+	local expect = {}
+	local stream = {}
+	for i = 1, 20 do
+		expect[i] = string.rep(string.char(64 + i), i * 10)
+		stream[i] = string.pack(">s4", expect[i])
+	end
+	-- the last package is split into two writes, the gate keeps the incomplete part for the next read
+	local last = string.pack(">s4", "last")
+	socket.write(fd, table.concat(stream) .. last:sub(1, 5))
+	skynet.sleep(10)
+	socket.write(fd, last:sub(6))
+	expect[21] = "last"
+	while #packages < #expect do
+		waiting = coroutine.running()
+		skynet.wait()
+		waiting = nil
+	end
+	assert(#packages == #expect and #batches < #expect)
+	for i = 1, #expect do
+		assert(packages[i] == expect[i], i)
+	end
+	socket.close(fd)
+	wait_event "close"
+	skynet.kill(gate)
+	agent_mode = nil
+	print(string.format("gate batch : %d packages in %d messages", #packages, #batches))
+end
+
+skynet.start(function()
+	test(0)
+	test(1)
+	test_batch()
+	print("gate header test ok")
+	skynet.exit()
+end)
@@ -0,0 +1,64 @@
+local skynet = require "skynet"
+local harbor = require "skynet.harbor"
+
+-- The messages to a remote harbor are batched and written after each round of dispatch.
+-- Run testharborbatch in the console of examples/config (harbor 1, the receiver),
+-- and start harbor 2 (the sender) with examples/config.hb
+
+local N = 100000
+
+-- the payload of the i-th message, some of them are larger than the batch limit of the harbor service
+local function payload(i)
+	if i % 10000 == 0 then
+		return string.rep(string.char(i // 10000 % 26 + 65), 100 * 1024)
+	end
+	return string.rep(string.char(i % 26 + 97), i % 100)
+end
+
+local function receiver()
+	local expect = 1
+	local errors = 0
+	skynet.dispatch("lua", function(_, _, cmd, i, data)
+		if cmd == "ping" then
+			if i ~= expect or data ~= payload(i) then
+				errors = errors + 1
+			end
+			expect = i + 1
+		else
+			assert(cmd == "check")
+			skynet.ret(skynet.pack(expect - 1, errors))
+		end
+	end)
+	harbor.globalname "HARBORBATCH"
+	print("harbor batch receiver is ready")
+end
+
+local function sender()
+	local addr = harbor.queryname "HARBORBATCH"
+	local remote = skynet.harbor(addr)
+	local before = harbor.stat()[remote]
+	for i = 1, N do
+		skynet.send(addr, "lua", "ping", i, payload(i))
+		if i % 1000 == 0 then
+			-- the batch is flushed at the end of each round
+			skynet.yield()
+		end
+	end
+	local n, errors = skynet.call(addr, "lua", "check")
+	local after = harbor.stat()[remote]
+	local msg = after.send_msg - before.send_msg
+	local writes = after.send_write - before.send_write
+	print(string.format("harbor batch : %d messages in %d writes, %d received, %d errors", msg, writes, n, errors))
+	assert(n == N and errors == 0)
+	assert(msg >= N and writes < msg // 10)
+	print("harbor batch ok")
+end
+
+skynet.start(function()
+	if skynet.getenv "harbor" == "1" then
+		receiver()
+	else
+		sender()
+		skynet.exit()
+	end
+end)
@@ -7,6 +7,8 @@ skynet.start(function()
 	harbor.connect(2)
 	print("harbor 2 connected")
 	print("LOG =", skynet.address(harbor.queryname "LOG"))
+	local stat = harbor.stat()[2]
+	print("harbor 2 send", stat.send_msg, "messages in", stat.send_write, "writes")
 	harbor.link(2)
 	print("disconnected")
 end)
@@ -0,0 +1,65 @@
+local skynet = require "skynet"
+
+local function pack(...)
+	return skynet.packstring(...)
+end
+
+skynet.start(function()
+	local args = {
+		id = 10001,
+		name = "player",
+		items = { { id = 1, count = 2 }, { id = 2, count = 5 }, nil, { id = 4 } },
+		pos = { x = 1.5, y = -2 },
+		[100] = "hundred",
+		[true] = "yes",
+	}
+	local msg = pack("route", 42, args, "tail")
+	local cmd, n, view, tail = skynet.lazyunpack(msg)
+	assert(cmd == "route" and n == 42 and tail == "tail")
+	assert(type(view) == "userdata")
+	assert(view.id == 10001 and view.name == "player" and view.missing == nil)
+	assert(view[100] == "hundred" and view[true] == "yes")
+	assert(#view.items == 4 and view.items[2].count == 5 and view.items[3] == nil)
+	assert(view.pos.x == 1.5 and view.pos.y == -2)
+
+	local keys = {}
+	for k, v in pairs(view) do
+		keys[k] = v
+	end
+	assert(keys.id == 10001 and keys[100] == "hundred" and type(keys.items) == "userdata")
+	local ids = {}
+	for i, v in pairs(view.items) do
+		ids[#ids + 1] = i
+	end
+	assert(#ids == 3 and ids[3] == 4)
+
+	-- forward the view without re-serialization
+	local forward = pack("forward", view.items, view)
+	local _, items, t = skynet.unpack(forward)
+	assert(items[4].id == 4 and t.pos.y == -2 and t.items[1].count == 2)
+	assert(skynet.viewtable(view.pos).x == 1.5)
+
+	-- only read the command name and forward the rest
+	local N = 20000
+	local big = {}
+	for i = 1, 100 do
+		big[i] = { id = i, name = "item" .. i, level = i % 10 }
+	end
+	msg = pack("cmd", big)
+	local start = os.clock()
+	for i = 1, N do
+		local c, t = skynet.unpack(msg)
+		local m, sz = skynet.pack(c, t)
+		skynet.trash(m, sz)
+	end
+	local t1 = os.clock() - start
+	start = os.clock()
+	for i = 1, N do
+		local c, t = skynet.lazyunpack(msg)
+		local m, sz = skynet.pack(c, t)
+		skynet.trash(m, sz)
+	end
+	local t2 = os.clock() - start
+	print(string.format("unpack+pack %d bytes x %d : eager %.3f s, lazy %.3f s", #msg, N, t1, t2))
+	skynet.exit()
+end)
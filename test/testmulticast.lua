@@ -7,15 +7,25 @@ local mode = ...
 if mode == "sub" then
 
 skynet.start(function()
-	skynet.dispatch("lua", function (_,_, cmd, channel)
+	local count = 0
+	skynet.dispatch("lua", function (_,_, cmd, channel, quiet)
+		if cmd == "count" then
+			skynet.ret(skynet.pack(count))
+			return
+		end
 		assert(cmd == "init")
 		local c = mc.new {
 			channel = channel ,
 			dispatch = function (channel, source, ...)
-				print(string.format("%s <=== %s %s",skynet.address(skynet.self()),skynet.address(source), channel), ...)
+				count = count + 1
+				if not quiet then
+					print(string.format("%s <=== %s %s",skynet.address(skynet.self()),skynet.address(source), channel), ...)
+				end
 			end
 		}
-		print(skynet.address(skynet.self()), "sub", c)
+		if not quiet then
+			print(skynet.address(skynet.self()), "sub", c)
+		end
 		c:subscribe()
 		skynet.ret(skynet.pack())
 	end)
@@ -35,6 +45,41 @@ skynet.start(function()
 
 	print(skynet.address(skynet.self()), "===>", channel)
 	channel:publish("Hello World")
+
+	if mode == "bench" then
+		-- fan-out to many subscribers
+		local N, M = 500, 1000
+		local bench = mc.new()
+		local subs = {}
+		for i=1,N do
+			subs[i] = skynet.newservice(SERVICE_NAME, "sub")
+			skynet.call(subs[i], "lua", "init", bench.channel, true)
+		end
+		local multicastd = skynet.uniqueservice "multicastd"
+		local cpu = skynet.call(multicastd, "debug", "STAT").cpu
+		local start = skynet.now()
+		local co = coroutine.running()
+		local n = 0
+		for i=1,M do
+			skynet.fork(function()
+				bench:publish(i)
+				n = n + 1
+				if n == M then
+					skynet.wakeup(co)
+				end
+			end)
+		end
+		skynet.wait(co)
+		local pub = skynet.now() - start
+		for i=1,N do
+			while skynet.call(subs[i], "lua", "count") < M do
+				skynet.sleep(1)
+			end
+		end
+		cpu = skynet.call(multicastd, "debug", "STAT").cpu - cpu
+		print(string.format("publish %d messages to %d subscribers : publish %.2f s, delivered %.2f s, multicastd cpu %.3f s",
+			M, N, pub / 100, (skynet.now() - start) / 100, cpu))
+	end
 end)
 
 end
\ No newline at end of file
@@ -23,6 +23,9 @@ skynet.start(function()
 	c:publish("Remote message")
 	c:unsubscribe()
 	c:publish("Remote message2")
+	for k,v in pairs(c:stat()) do
+		print("stat", k, v)
+	end
 	c:delete()
 	skynet.exit()
 end)
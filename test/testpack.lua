@@ -0,0 +1,108 @@
+local skynet = require "skynet"
+
+local N = 200000
+
+local blob = string.rep("x", 1024)
+local item = { id = 10001, name = "sword", level = 12, count = 1, attrs = { 10, 20, 30 } }
+local items = {}
+for i = 1, 50 do
+	items[i] = { id = i, name = "item" .. i, level = i % 10, count = i }
+end
+
+-- typical rpc argument shapes
+local cases = {
+	{ "command", function() return skynet.pack("get", "player", 10001) end },
+	{ "response", function() return skynet.pack(true, 12345) end },
+	{ "record", function() return skynet.pack("update", item) end },
+	{ "string 1K", function() return skynet.pack("set", "key", blob) end },
+	{ "list of 50", function() return skynet.pack("items", items) end },
+}
+
+local function check()
+	local msg, sz = skynet.pack("update", item, nil, 1.5, { [1] = "a", [3] = "c", x = { y = { z = true } } })
+	local cmd, t, n, r, o = skynet.unpack(msg, sz)
+	skynet.trash(msg, sz)
+	assert(cmd == "update" and t.name == "sword" and t.attrs[3] == 30 and n == nil and r == 1.5)
+	assert(o[1] == "a" and o[3] == "c" and o.x.y.z == true)
+end
+
+local function check_stringref()
+	-- more than 30 strings to use the long index, and the long strings
+	local long = string.rep("y", 100)
+	local list = {}
+	for i = 1, 40 do
+		list[i] = { name = "name" .. i, tag = "tag", text = long }
+	end
+	list[41] = list[1].name
+	-- off by default
+	local plain = skynet.packstring(list)
+	local old = skynet.packstring("update", item)
+	skynet.stringref(true)
+	local msg, sz = skynet.pack(list, "tag", long, "x", "x")
+	local msg2, sz2 = skynet.pack("", list, "tag", long, "x", "x")
+	assert(sz2 == sz + 1)
+	local t, tag, l, x1, x2 = skynet.unpack(msg, sz)
+	for i = 1, 40 do
+		local v = t[i]
+		assert(v.name == "name" .. i and v.tag == "tag" and v.text == long)
+	end
+	assert(t[41] == "name1" and tag == "tag" and l == long and x1 == "x" and x2 == "x")
+	-- lazyunpack unpacks the stream with string references
+	local _, lt = skynet.lazyunpack(msg2, sz2)
+	assert(lt[40].name == "name40")
+	skynet.trash(msg, sz)
+	skynet.trash(msg2, sz2)
+	-- the same as the old format when there are no repeated strings
+	assert(skynet.packstring("update", item) == old)
+	assert(#skynet.packstring(list) < #plain)
+	skynet.stringref(false)
+	assert(skynet.packstring(list) == plain)
+end
+
+-- compare the size and the speed of the records with and without string references
+local function stringref_bench()
+	local records = {}
+	for i = 1, 100 do
+		records[i] = { id = i, name = "player", level = i, guild = "skynet", status = "online" }
+	end
+	local n = N // 20
+	for _, enable in ipairs { false, true } do
+		skynet.stringref(enable)
+		local msg, sz
+		local start = os.clock()
+		for i = 1, n do
+			msg, sz = skynet.pack("records", records)
+			skynet.trash(msg, sz)
+		end
+		local tpack = os.clock() - start
+		msg, sz = skynet.pack("records", records)
+		start = os.clock()
+		for i = 1, n do
+			skynet.unpack(msg, sz)
+		end
+		local tunpack = os.clock() - start
+		skynet.trash(msg, sz)
+		print(string.format("stringref %-5s 100 records %5d bytes : pack %.3f s, unpack %.3f s for %d",
+			enable, sz, tpack, tunpack, n))
+	end
+	skynet.stringref(false)
+end
+
+skynet.start(function()
+	check()
+	check_stringref()
+	for _, c in ipairs(cases) do
+		local name, f = c[1], c[2]
+		local start = os.clock()
+		local size
+		for i = 1, N do
+			local msg, sz = f()
+			size = sz
+			skynet.trash(msg, sz)
+		end
+		local t = os.clock() - start
+		print(string.format("pack %-12s %5d bytes : %.3f s for %d, %.2f M/s", name, size, t, N, N / t / 1000000))
+	end
+	stringref_bench()
+	skynet.exit()
+end)
@@ -0,0 +1,59 @@
+local skynet = require "skynet"
+local driver = require "socketdriver"
+
+local LINES = 1000000
+local CHUNK = 4096	-- bytes per simulated socket read
+
+local function check_memfind()
+	local samples = {
+		"", "\r", "\n", "\r\n", "abc\r\n", "\r\r\r\n", string.rep("x", 100) .. "\r\n",
+		string.rep("\r", 63) .. "\n", string.rep("ab", 40) .. "abc", "$5\r\nhello\r\n",
+	}
+	local seps = { "\n", "\r\n", "abc", "\r\n\r\n", "hello\r\n" }
+	for _, s in ipairs(samples) do
+		for _, sep in ipairs(seps) do
+			for init = 1, #s + 1 do
+				local a, b = string.find(s, sep, init, true)
+				local c, d = driver.memfind(s, sep, init)
+				assert(a == c and b == d, string.format("memfind %q %q %d", s, sep, init))
+			end
+		end
+	end
+	print("memfind ok")
+end
+
+-- Redis-style replies, as a pipeline of 1M commands would produce
+local function gen_pipeline()
+	local replies = { "+OK\r\n", ":12345\r\n", "$5\r\nhello\r\n", "$11\r\nhello world\r\n", "-ERR unknown command\r\n" }
+	local tmp = {}
+	local n = 0
+	for i = 1, LINES do
+		local r = replies[i % #replies + 1]
+		tmp[i] = r
+		n = n + select(2, r:gsub("\r\n", ""))
+	end
+	return table.concat(tmp), n
+end
+
+local function bench(data, lines)
+	local buffer = driver.buffer()
+	local count = 0
+	local start = os.clock()
+	for i = 1, #data, CHUNK do
+		local msg, sz = driver.str2p(data:sub(i, i + CHUNK - 1))
+		driver.push(buffer, msg, sz)
+		while driver.readline(buffer, "\r\n") do
+			count = count + 1
+		end
+	end
+	local t = os.clock() - start
+	assert(count == lines, count)
+	print(string.format("readline: %d lines (%d bytes) in %.3f s, %.1f Mlines/s", count, #data, t, count / t / 1000000))
+end
+
+skynet.start(function()
+	check_memfind()
+	local data, lines = gen_pipeline()
+	bench(data, lines)
+	skynet.exit()
+end)
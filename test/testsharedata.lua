@@ -0,0 +1,239 @@
+local skynet = require "skynet"
+local sharedata = require "sharedata"
+local sd = require "sharedata.corelib"
+
+local N = 2000
+
+local function gen()
+	local t = { version = 1, item = {}, list = {} }
+	for i = 1, N do
+		t.item[i] = { id = i, name = "item" .. i, price = i * 10, attr = { hp = i, mp = i * 2 } }
+		t.list[i] = "list" .. i
+	end
+	return t
+end
+
+-- map the snapshot with each byte changed, it should be rejected or readable
+local function check_broken_snapshot()
+	local core = require "sharedata.core"
+	local filename = os.tmpname()
+	local cobj = sd.host.new { name = "snapshot", list = { "a", "b", 3, { x = 1.5 } }, [10] = { y = true } }
+	sd.host.save(cobj, filename)
+	sd.host.delete(cobj)
+	local f = io.open(filename, "rb")
+	local image = f:read "a"
+	f:close()
+	local function walk(obj, depth)
+		if depth > 4 then
+			return
+		end
+		local k = core.nextkey(obj)
+		for i = 1, 16 do
+			if k == nil then
+				break
+			end
+			local v = core.index(obj, k)
+			if type(v) == "userdata" then
+				walk(v, depth + 1)
+			end
+			k = core.nextkey(obj, k)
+		end
+	end
+	local rejected = 0
+	for i = 1, #image do
+		f = io.open(filename, "wb")
+		f:write(image:sub(1, i - 1), string.char(image:byte(i) ~ 0xff), image:sub(i + 1))
+		f:close()
+		local ok, obj = pcall(sd.host.map, filename)
+		if ok then
+			walk(obj, 1)
+			sd.host.delete(obj)
+		else
+			rejected = rejected + 1
+		end
+	end
+	-- the huge offsets of the arraytype, array, hash and disp of the root table (wrap if added to the size)
+	for _, pos in ipairs { 48, 56, 64, 72 } do
+		f = io.open(filename, "wb")
+		f:write(image:sub(1, pos), string.pack("=I8", 0xFFFFFFFFFFFFFFF8), image:sub(pos + 9))
+		f:close()
+		assert(not pcall(sd.host.map, filename))
+	end
+	-- the hash part of the root table is far before the mapping, hash + sizehash * sizeof(node) wraps to 8
+	local sizehash = 0x7ffffff8
+	local nodesize = string.unpack("=I4", image, 5)
+	f = io.open(filename, "wb")
+	f:write(image:sub(1, 36), string.pack("=i4", sizehash), image:sub(41, 64),
+		string.pack("=i8", 8 - sizehash * nodesize), image:sub(73))
+	f:close()
+	assert(not pcall(sd.host.map, filename))
+	os.remove(filename)
+	print(string.format("sharedata broken snapshot : %d of %d rejected", rejected, #image))
+end
+
+skynet.start(function()
+	sharedata.new("data", gen())
+	local obj = sharedata.query "data"
+	skynet.sleep(1)	-- wait for the monitor
+	local item1 = obj.item[1]
+	local attr2 = obj.item[2].attr
+	local list = obj.list
+	assert(item1.price == 10 and attr2.mp == 4 and list[3] == "list3")
+
+	sharedata.patch("data", {
+		{ "version", 2 },
+		{ { "item", 1, "price" }, 11 },
+		{ { "item", 3 }, { id = 3, name = "new3" } },
+		{ { "item", 4, "attr", "sp" }, 8 },
+		{ { "extra", "a", "b" }, "c" },
+		{ { "item", 5 } },	-- delete
+	})
+	sharedata.flush()
+	assert(obj.version == 2 and item1.price == 11 and item1.name == "item1")
+	assert(attr2.mp == 4 and list[N] == "list" .. N)
+	assert(obj.item[3].name == "new3" and obj.item[3].price == nil)
+	assert(obj.item[4].attr.sp == 8 and obj.item[4].attr.hp == 4)
+	assert(obj.extra.a.b == "c" and obj.item[5] == nil and obj.item[6].attr.hp == 6)
+
+	-- the key removed by patch
+	local item6 = obj.item[6]
+	sharedata.patch("data", { { { "item", 6 }, 0 } })
+	sharedata.flush()
+	assert(obj.item[6] == 0)
+	assert(not pcall(function() return item6.id end))
+
+	-- a full update after patch
+	sharedata.update("data", { version = 3 })
+	sharedata.flush()
+	assert(obj.version == 3 and obj.item == nil)
+	sharedata.update("data", gen())
+
+	local n = 100
+	local start = skynet.now()
+	for i = 1, n do
+		sharedata.update("data", gen())
+	end
+	local t1 = skynet.now() - start
+	start = skynet.now()
+	for i = 1, n do
+		sharedata.patch("data", { { { "item", i, "price" }, i } })
+	end
+	local t2 = skynet.now() - start
+	sharedata.flush()
+	assert(obj.item[n].price == n and obj.item[n + 1].price == (n + 1) * 10 and obj.list[N] == "list" .. N)
+	print(string.format("sharedata %d items x %d : update %.2f s, patch %.2f s", N, n, t1 / 100, t2 / 100))
+
+	sharedata.delete "data"
+
+	-- snapshot
+	local filename = os.tmpname()
+	local value = gen()
+	start = skynet.now()
+	local cobj = sd.host.new(value)
+	t1 = skynet.now() - start
+	sd.host.save(cobj, filename)
+	sd.host.delete(cobj)
+	start = skynet.now()
+	sharedata.map("snapshot", filename)
+	t2 = skynet.now() - start
+	-- save replaces the file, the mapped pages are still valid
+	cobj = sd.host.new { version = 2 }
+	sd.host.save(cobj, filename)
+	sd.host.delete(cobj)
+	os.remove(filename)
+	print(string.format("sharedata %d items : new %.2f s, map %.2f s", N, t1 / 100, t2 / 100))
+	local snap = sharedata.query "snapshot"
+	skynet.sleep(1)	-- wait for the monitor
+	assert(snap.version == 1 and #snap.item == N and snap.item[N].name == "item" .. N and snap.list[1] == "list1")
+	local keys = 0
+	for k, v in pairs(snap.item[1]) do
+		assert(v == value.item[1][k] or type(v) == "table")
+		keys = keys + 1
+	end
+	assert(keys == 4 and snap.item[2].attr.mp == 4)
+	assert(sharedata.deepcopy("snapshot", "item", 3).attr.hp == 3)
+	sharedata.patch("snapshot", { { { "item", 1, "price" }, 1 } })
+	sharedata.flush()
+	assert(snap.item[1].price == 1 and snap.item[2].price == 20 and snap.list[N] == "list" .. N)
+	sharedata.delete "snapshot"
+	check_broken_snapshot()
+
+	-- lookup
+	local conf = { id = {} }
+	local names = {}
+	for i = 1, 1000 do
+		names[i] = "attribute" .. i
+		conf[names[i]] = i
+		conf.id[i * 7] = i
+	end
+	sharedata.new("lookup", conf)
+	local lookup = sharedata.query "lookup"
+	skynet.sleep(1)	-- wait for the monitor
+	local cobj = lookup.__obj
+	local index = require "sharedata.core".index
+	for i = 1, 1000 do
+		assert(index(cobj, names[i]) == i and lookup.id[i * 7] == i)
+	end
+	assert(index(cobj, "attribute") == nil and lookup.id[1] == nil)
+	local n = 1000
+	start = os.clock()
+	for i = 1, n do
+		for j = 1, 1000 do
+			index(cobj, names[j])
+		end
+	end
+	t1 = os.clock() - start
+	local id = lookup.id.__obj
+	start = os.clock()
+	for i = 1, n do
+		for j = 7, 7000, 7 do
+			index(id, j)
+		end
+	end
+	t2 = os.clock() - start
+	print(string.format("sharedata lookup %d : string key %.3f s, integer key %.3f s", n * 1000, t1, t2))
+	sharedata.delete "lookup"
+
+	-- columns
+	local M = 100000
+	local curve = { exp = {}, rate = {}, small = {}, mixed = { 1, 2.5, 3 }, big = { 1, 1 << 40 } }
+	for i = 1, M do
+		curve.exp[i] = i * i
+		curve.rate[i] = i / 8
+		curve.small[i] = i % 100 - 50
+	end
+	sharedata.new("curve", curve)
+	local c = sharedata.query "curve"
+	skynet.sleep(1)	-- wait for the monitor
+	assert(#c.exp == M and c.exp[M] == M * M and math.type(c.exp[1]) == "integer")
+	assert(c.rate[4] == 0.5 and math.type(c.rate[8]) == "float" and c.small[1] == -49)
+	assert(c.mixed[2] == 2.5 and math.type(c.mixed[1]) == "integer" and c.big[2] == 1 << 40)
+	local keys = 0
+	for k, v in pairs(c.small) do
+		assert(v == curve.small[k])
+		keys = keys + 1
+	end
+	assert(keys == M)
+	local s = sharedata.slice(c.exp, 9, 11)
+	assert(#s == 3 and s[1] == 81 and s[3] == 121)
+	assert(#sharedata.slice(c.exp, M - 1, M + 10) == 2 and #sharedata.slice(c.exp, 10, 9) == 0)
+	assert(sharedata.sum(c.small) == -50 * M // 100 and sharedata.sum(c.exp, 1, 3) == 14)
+	assert(sharedata.sum(c.rate, 1, 4) == 1.25 and sharedata.sum(c.mixed) == 6.5)
+	assert(sharedata.bsearch(c.exp, 0) == 0 and sharedata.bsearch(c.exp, 1) == 1)
+	assert(sharedata.bsearch(c.exp, 99) == 9 and sharedata.bsearch(c.exp, 100) == 10 and sharedata.bsearch(c.exp, 1e20) == M)
+	assert(sharedata.bsearch(c.rate, 0.3) == 2 and sharedata.bsearch(c.mixed, 2.5) == 2)
+	assert(sharedata.deepcopy("curve", "exp")[M] == M * M)
+	start = os.clock()
+	local sum = 0
+	local exp = c.exp
+	for i = 1, M do
+		sum = sum + exp[i]
+	end
+	t1 = os.clock() - start
+	start = os.clock()
+	assert(sharedata.sum(exp) == sum)
+	t2 = os.clock() - start
+	print(string.format("sharedata sum %d : index %.3f s, sum %.4f s", M, t1, t2))
+	sharedata.delete "curve"
+	skynet.exit()
+end)
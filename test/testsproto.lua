@@ -0,0 +1,215 @@
+local skynet = require "skynet"
+local sproto = require "sproto"
+
+local N = 100000
+
+local sp = sproto.parse [[
+.package {
+	type 0 : integer
+	session 1 : integer
+	ud 2 : integer
+}
+
+.Item {
+	id 0 : integer
+	count 1 : integer
+	name 2 : string
+}
+
+.Position {
+	x 0 : integer
+	y 1 : integer
+	z 2 : integer
+}
+
+.Player {
+	id 0 : integer
+	name 1 : string
+	level 2 : integer
+	exp 3 : integer
+	online 4 : boolean
+	pos 5 : Position
+	items 6 : *Item(id)
+	skills 7 : *integer
+	title 8 : string
+	rate 9 : integer(2)
+}
+
+move 1 {
+	request {
+		x 0 : integer
+		y 1 : integer
+	}
+}
+
+update 2 {
+	request {
+		player 0 : Player
+	}
+	response {
+		ok 0 : boolean
+	}
+}
+]]
+
+local player = {
+	id = 10001,
+	name = "player",
+	level = 30,
+	exp = 123456789012,
+	online = true,
+	pos = { x = 100, y = -200, z = 3 },
+	items = {},
+	skills = { 1, 2, 3, 4, 5, 6, 7, 8 },
+	title = "knight",
+	rate = 1.25,
+}
+for i = 1, 10 do
+	player.items[i] = { id = i, count = i * 10, name = "item" .. i }
+end
+
+local function check()
+	local bin = sp:encode("Player", player)
+	local p = sp:decode("Player", bin)
+	assert(p.id == 10001 and p.name == "player" and p.exp == 123456789012 and p.online == true)
+	assert(p.pos.y == -200 and p.items[3].count == 30 and p.items[10].name == "item10")
+	assert(#p.skills == 8 and p.skills[8] == 8 and p.rate == 1.25 and p.title == "knight")
+	-- decode into the existing table
+	local header = {}
+	local h, sz = sp:decode("package", sp:encode("package", { type = 2, session = 1 }), header)
+	assert(h == header and header.type == 2 and header.session == 1 and header.ud == nil)
+
+	local host = sp:host "package"
+	local request = host:attach(sp)
+	local t, name, args, response = host:dispatch(request("update", { player = player }, 1))
+	assert(t == "REQUEST" and name == "update" and args.player.items[1].id == 1)
+	local t, session, result = host:dispatch(response { ok = true })
+	assert(t == "RESPONSE" and session == 1 and result.ok == true)
+
+	-- dispatch to the registered handlers directly
+	local server = sp:host "package"
+	server:register {
+		move = function(args, ud)
+			assert(args.x == 1 and args.y == 2 and ud == 7)
+		end,
+		update = function(args)
+			return { ok = args.player.id == 10001 }
+		end,
+	}
+	assert(server:handle(request("move", { x = 1, y = 2 }, nil, 7)) == nil)
+	local resp = server:handle(request("update", { player = player }, 2))
+	local t, session, result = host:dispatch(resp)
+	assert(t == "RESPONSE" and session == 2 and result.ok == true)
+	local h, offset = sp:decode("package", sproto.unpack(resp))
+	assert(h.session == 2 and sp:decode("update.response", sproto.unpack(resp), nil, offset).ok == true)
+
+	-- the cached plans are dropped with the sproto object, the addresses of the types may be reused
+	local tmp = sproto.parse ".T { a 0 : integer }"
+	assert(tmp:decode("T", tmp:encode("T", { a = 1 })).a == 1)
+	tmp = nil
+	collectgarbage()
+	tmp = sproto.parse ".T { b 0 : integer }"
+	assert(tmp:decode("T", tmp:encode("T", { b = 2 })).b == 2)
+end
+
+-- the reference 0-pack, written in the same way as sproto_pack (scalar)
+local function ref_pack(src)
+	src = src .. string.rep("\0", (8 - #src % 8) % 8)
+	local result = {}
+	local ff = {}
+	local function flush()
+		if #ff > 0 then
+			result[#result+1] = string.char(0xff, #ff - 1) .. table.concat(ff)
+			ff = {}
+		end
+	end
+	for i = 1, #src, 8 do
+		local seg = src:sub(i, i+7)
+		local header = 0
+		local bytes = {}
+		for j = 1, 8 do
+			local b = seg:byte(j)
+			if b ~= 0 then
+				header = header | (1 << (j-1))
+				bytes[#bytes+1] = string.char(b)
+			end
+		end
+		local notzero = #bytes
+		if notzero == 8 or (notzero >= 6 and #ff > 0) then
+			ff[#ff+1] = seg
+			if #ff == 256 then
+				flush()
+			end
+		else
+			flush()
+			result[#result+1] = string.char(header) .. table.concat(bytes)
+		end
+	end
+	flush()
+	return table.concat(result)
+end
+
+-- differential test of sproto.pack/unpack with random buffers of different zero density
+local function check_pack()
+	math.randomseed(0)
+	for i = 1, 2000 do
+		local n = math.random(0, 3000)
+		local density = math.random(0, 100)
+		local t = {}
+		for j = 1, n do
+			t[j] = math.random(100) <= density and math.random(255) or 0
+		end
+		local src = string.char(table.unpack(t, 1, math.min(n, 200)))
+		if n > 200 then
+			local tmp = {}
+			for j = 201, n, 200 do
+				tmp[#tmp+1] = string.char(table.unpack(t, j, math.min(n, j + 199)))
+			end
+			src = src .. table.concat(tmp)
+		end
+		local packed = sproto.pack(src)
+		assert(packed == ref_pack(src), "pack mismatch")
+		local unpacked = sproto.unpack(packed)
+		assert(unpacked == src .. string.rep("\0", #unpacked - #src) and #unpacked - #src < 8, "unpack mismatch")
+	end
+end
+
+local function bench(name, f)
+	local start = os.clock()
+	for i = 1, N do
+		f()
+	end
+	local t = os.clock() - start
+	print(string.format("sproto %-16s : %.3f s for %d, %.2f M/s", name, t, N, N / t / 1000000))
+end
+
+skynet.start(function()
+	check()
+	check_pack()
+	local move = { x = 1, y = 2 }
+	local move_bin = sp:request_encode("move", move)
+	local player_bin = sp:encode("Player", player)
+	bench("encode move", function() sp:request_encode("move", move) end)
+	bench("decode move", function() sp:request_decode("move", move_bin) end)
+	bench("encode player", function() sp:encode("Player", player) end)
+	bench("decode player", function() sp:decode("Player", player_bin) end)
+	local host = sp:host "package"
+	local request = host:attach(sp)
+	local move_req = request("move", move)
+	local update_req = request("update", { player = { id = 1, pos = move } }, 1)
+	bench("dispatch move", function() host:dispatch(move_req) end)
+	bench("dispatch update", function()
+		local _, _, args, response = host:dispatch(update_req)
+		response { ok = true }
+	end)
+	host:register {
+		move = function(args) end,
+		update = function(args) return { ok = true } end,
+	}
+	bench("handle move", function() host:handle(move_req) end)
+	bench("handle update", function() host:handle(update_req) end)
+	local packed = sproto.pack(player_bin)
+	bench("pack player", function() sproto.pack(player_bin) end)
+	bench("unpack player", function() sproto.unpack(packed) end)
+	skynet.exit()
+end)
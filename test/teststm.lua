@@ -11,14 +11,45 @@ skynet.start(function()
 		print("read:", obj(skynet.unpack))
 		skynet.ret()
 		skynet.error("sleep and read")
+		local function delta(msg, sz)
+			return "delta", skynet.unpack(msg, sz)
+		end
 		for i=1,10 do
 			skynet.sleep(10)
-			print("read:", obj(skynet.unpack))
+			print("read:", stm.version(obj), obj(skynet.unpack, nil, delta))
 		end
 		skynet.exit()
 	end)
 end)
 
+elseif mode == "bench" then
+
+skynet.start(function()
+	local obj = stm.new(skynet.pack(1,2,3,4,5))
+	local reader = stm.newcopy(stm.copy(obj))
+	assert(reader(skynet.unpack) == true)
+	local N = 1000000
+	local start = os.clock()
+	for i=1,N do
+		reader(skynet.unpack)
+	end
+	local t1 = os.clock() - start
+	start = os.clock()
+	for i=1,N // 10 do
+		obj(skynet.pack(i))
+		reader(skynet.unpack)
+	end
+	local t2 = os.clock() - start
+	print(string.format("stm read (not update) %d : %.3f s, update and read %d : %.3f s", N, t1, N // 10, t2))
+	-- the readers drop the last copy when the writer is released
+	local version = stm.version(reader)
+	obj = nil
+	collectgarbage "collect"
+	assert(stm.version(reader) == version + 1)
+	assert(reader(skynet.unpack) == false)
+	skynet.exit()
+end)
+
 else
 
 skynet.start(function()
@@ -28,9 +59,12 @@ skynet.start(function()
 	skynet.call(slave, "lua", copy)
 	for i=1,5 do
 		skynet.sleep(20)
-		print("write", i)
-		obj(skynet.pack("hello world", i))
+		print("write", i, stm.version(obj))
+		-- publish the full message and the delta from the previous version
+		local msg, sz = skynet.pack("hello world", i)
+		obj(msg, sz, skynet.packstring("change", i))
 	end
+	skynet.newservice(SERVICE_NAME, "bench")
  	skynet.exit()
 end)
 end